@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "BatteryGauge.h"
+
+
+// the nominal reference voltage, used only when the chip has no eFuse
+// calibration at all
+#define DEFAULT_VREF             (1100)
+
+// LiPo open circuit voltage (mV) at every 5% of charge, from 100% down to
+// 0%.  The curve is quite flat between 3.75 and 3.9 V, which is why a
+// linear mapping spends most of the battery's life reporting 50-60%.
+static const uint16_t dischargeCurve[] = {
+    4200, 4150, 4110, 4080, 4020, 3980, 3950, 3910, 3870, 3850,  // 100% - 55%
+    3840, 3820, 3800, 3790, 3770, 3750, 3730, 3710, 3690, 3610,  //  50% -  5%
+    3270                                                         //   0%
+};
+#define DISCHARGE_CURVE_POINTS   (sizeof(dischargeCurve) / sizeof(dischargeCurve[0]))
+#define DISCHARGE_CURVE_STEP     (100 / (DISCHARGE_CURVE_POINTS - 1))
+
+
+BatteryGauge::BatteryGauge() :
+    channel(ADC1_CHANNEL_7),
+    smoothedMillivolts(-1),
+    windowStartLevel(-1),
+    windowStart(0),
+    dischargeRate(0),
+    remainingMinutes(-1),
+    console(NULL)
+{
+}
+
+
+bool
+BatteryGauge::begin(adc1_channel_t channel, Stream *console)
+{
+    this->channel = channel;
+    this->console = console;
+
+    // the divided cell voltage tops out at 2.1V, which needs the 11dB range
+    adc1_config_width(ADC_WIDTH_BIT_12);
+    adc1_config_channel_atten(channel, ADC_ATTEN_DB_11);
+
+    esp_adc_cal_value_t calibration = esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12,
+                                                               DEFAULT_VREF, &characteristics);
+
+    switch (calibration) {
+        case ESP_ADC_CAL_VAL_EFUSE_TP:   console->println("battery gauge: two point ADC calibration"); break;
+        case ESP_ADC_CAL_VAL_EFUSE_VREF: console->printf("battery gauge: eFuse Vref %d mV\n", characteristics.vref); break;
+        default:                         console->println("battery gauge: no ADC calibration, using default Vref"); break;
+    }
+
+    return true;
+}
+
+
+int
+BatteryGauge::readMillivolts()
+{
+    // adc1_config_channel_atten() is repeated here because the speed
+    // sampler's I2S setup reprograms ADC1 whenever it gets it back
+    adc1_config_channel_atten(channel, ADC_ATTEN_DB_11);
+
+    uint32_t sum = 0;
+    for (int i = 0; i < BATTERY_OVERSAMPLE; i++) {
+        sum += adc1_get_raw(channel);
+    }
+
+    // esp_adc_cal_raw_to_voltage() only takes whole counts, which throws
+    // away what the oversampling bought.  Apply the same linear calibration
+    // (coeff_a is scaled by 2^16) to the sum instead.
+    uint64_t scaled = uint64_t(characteristics.coeff_a) * sum;
+    uint32_t pinMillivolts = uint32_t((scaled + (uint64_t(BATTERY_OVERSAMPLE) << 15)) / (uint64_t(BATTERY_OVERSAMPLE) << 16))
+                             + characteristics.coeff_b;
+
+    return pinMillivolts * BATTERY_DIVIDER;
+}
+
+
+void
+BatteryGauge::sample()
+{
+    int reading = readMillivolts();
+
+    if (smoothedMillivolts < 0) {
+        smoothedMillivolts = reading << BATTERY_SMOOTHING_SHIFT;
+    }
+    else {
+        smoothedMillivolts += reading - (smoothedMillivolts >> BATTERY_SMOOTHING_SHIFT);
+    }
+
+    updateRate(millis());
+}
+
+
+void
+BatteryGauge::updateRate(unsigned long now)
+{
+    int32_t level = chargeLevel(millivolts());
+
+    if (windowStartLevel < 0) {
+        windowStartLevel = level;
+        windowStart = now;
+        return;
+    }
+
+    if (now - windowStart < BATTERY_RATE_WINDOW) {
+        return;
+    }
+
+    int32_t drop = windowStartLevel - level;
+    windowStartLevel = level;
+    windowStart = now;
+
+    if (drop <= 0) {
+        // charging, or resting; either way there's nothing to estimate from
+        dischargeRate = 0;
+        remainingMinutes = -1;
+        return;
+    }
+
+    // smooth the rate over several windows (1/2 new, 1/2 old), since WiFi
+    // load makes it jump around a lot
+    dischargeRate = (dischargeRate == 0) ? drop : (dischargeRate + drop) / 2;
+
+    remainingMinutes = (level * (BATTERY_RATE_WINDOW / 60000UL)) / dischargeRate;
+}
+
+
+// charge level in 1/256 percent, interpolated along the curve so that slow
+// changes show up long before a whole percent goes by
+int32_t
+BatteryGauge::chargeLevel(int millivolts)
+{
+    if (millivolts >= dischargeCurve[0]) {
+        return 100 << 8;
+    }
+
+    for (unsigned i = 1; i < DISCHARGE_CURVE_POINTS; i++) {
+        if (millivolts >= dischargeCurve[i]) {
+            int32_t above = dischargeCurve[i - 1], below = dischargeCurve[i];
+            int32_t pct = (DISCHARGE_CURVE_POINTS - 1 - i) * DISCHARGE_CURVE_STEP;
+            return (pct << 8) + (((millivolts - below) * DISCHARGE_CURVE_STEP) << 8) / (above - below);
+        }
+    }
+
+    return 0;
+}
+
+
+int
+BatteryGauge::percentFor(int millivolts)
+{
+    return (chargeLevel(millivolts) + 128) >> 8;
+}
@@ -0,0 +1,97 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include "Arduino.h"
+
+#include <driver/adc.h>
+#include <esp_adc_cal.h>
+
+
+// Battery voltage, charge and time remaining for a single cell LiPo.
+//
+// The voltage is read through ADC1 using the chip's eFuse calibration
+// (Vref or two point, whichever was burned at the factory), oversampled
+// and converted in fixed point so the result has better than 1 LSB of
+// resolution.  Charge comes from a LiPo discharge curve rather than a
+// straight line between empty and full, and the time remaining from the
+// smoothed rate the charge is going down.
+//
+// The caller owns the ADC scheduling: sample() takes a few ms, and must
+// not be called while something else (the speed sampler's I2S DMA) has
+// ADC1.
+
+// readings averaged together for each sample
+#define BATTERY_OVERSAMPLE       (64)
+
+// the cell is read through a 1:2 divider (on the Huzzah32 feather)
+#define BATTERY_DIVIDER          (2)
+
+// battery voltage smoothing, as a power of 2 (1/4 new, 3/4 old)
+#define BATTERY_SMOOTHING_SHIFT  (2)
+
+// how long to measure the discharge over before estimating time remaining
+// (in ms).  The charge only goes down by a few tenths of a percent a minute,
+// so the window needs to be long enough to see it.
+#define BATTERY_RATE_WINDOW      (5*60*1000UL)   // 5 minutes
+
+
+class BatteryGauge
+{
+  public:
+    BatteryGauge();
+
+    bool begin(adc1_channel_t channel, Stream *console);
+
+    // read the battery (blocking, for a few ms), and update the estimates
+    void sample();
+
+    int  millivolts()       { return (smoothedMillivolts + (1 << (BATTERY_SMOOTHING_SHIFT - 1))) >> BATTERY_SMOOTHING_SHIFT; }
+    int  percent()          { return percentFor(millivolts()); }
+
+    // estimated minutes until empty, or -1 if not known (not enough
+    // history yet, or the battery isn't discharging)
+    int  minutesRemaining() { return remainingMinutes; }
+
+    static int percentFor(int millivolts);
+
+  private:
+    static int32_t chargeLevel(int millivolts);
+
+    int  readMillivolts();
+    void updateRate(unsigned long now);
+
+    adc1_channel_t                channel;
+    esp_adc_cal_characteristics_t characteristics;
+
+    int32_t         smoothedMillivolts;   // << BATTERY_SMOOTHING_SHIFT
+
+    // discharge rate tracking, in 1/256 of a percent
+    int32_t         windowStartLevel;
+    unsigned long   windowStart;
+    int32_t         dischargeRate;        // per BATTERY_RATE_WINDOW, 0 if unknown
+    int             remainingMinutes;
+
+    Stream         *console;
+};
@@ -23,7 +23,11 @@
 
 
 BatteryService::BatteryService() :
-    batteryLevel(0)
+    batteryLevel(0),
+    minutesRemaining(-1),
+    batteryService(NULL),
+    batteryLevelCharacteristic(NULL),
+    timeRemainingCharacteristic(NULL)
 {
 }
 
@@ -42,6 +46,10 @@ BatteryService::begin(BLEServer *bleServer, Stream *console)
                                                                               | BLECharacteristic::PROPERTY_NOTIFY);
             batteryLevelCharacteristic->setCallbacks(this);
 
+            timeRemainingCharacteristic = batteryService->createCharacteristic(BATTERY_TIME_REMAINING_CHARACTERISTIC_UUID,
+                                                                               BLECharacteristic::PROPERTY_READ
+                                                                               | BLECharacteristic::PROPERTY_NOTIFY);
+            timeRemainingCharacteristic->setCallbacks(this);
 
             batteryService->start();
         }
@@ -68,14 +76,38 @@ BatteryService::onRead(BLECharacteristic *characteristic)
     if (characteristic->getUUID().equals(BLEUUID(BATTERY_LEVEL_CHARACTERISTIC_UUID))) {
         characteristic->setValue(batteryLevel);
     }
+    else if (characteristic->getUUID().equals(BLEUUID(BATTERY_TIME_REMAINING_CHARACTERISTIC_UUID))) {
+        setTimeRemainingValue(characteristic);
+    }
 }
 
 
 void
-BatteryService::setBatteryLevel(int batteryLevel)
+BatteryService::setTimeRemainingValue(BLECharacteristic *characteristic)
 {
-    this->batteryLevel = batteryLevel;
+    int16_t value = minutesRemaining;
+    characteristic->setValue((uint8_t *) &value, sizeof(value));
+}
 
-    batteryLevelCharacteristic->setValue(batteryLevel);
-    batteryLevelCharacteristic->notify();
+
+void
+BatteryService::setBatteryLevel(int batteryLevel, int minutesRemaining)
+{
+    if (!batteryLevelCharacteristic) {
+        return;
+    }
+
+    if (batteryLevel != this->batteryLevel) {
+        this->batteryLevel = batteryLevel;
+
+        batteryLevelCharacteristic->setValue(batteryLevel);
+        batteryLevelCharacteristic->notify();
+    }
+
+    if (minutesRemaining != this->minutesRemaining) {
+        this->minutesRemaining = minutesRemaining;
+
+        setTimeRemainingValue(timeRemainingCharacteristic);
+        timeRemainingCharacteristic->notify();
+    }
 }
@@ -32,6 +32,9 @@
 #define BATTERY_LEVEL_SERVICE_UUID         ((uint16_t) 0x180F)
 #define BATTERY_LEVEL_CHARACTERISTIC_UUID  ((uint16_t) 0x2A19)
 
+// estimated minutes of battery life left, as an int16 (-1 if not known)
+#define BATTERY_TIME_REMAINING_CHARACTERISTIC_UUID "426c7565-39e1-4688-b7f5-4b646f626279"
+
 
 
 class BatteryService :
@@ -44,13 +47,17 @@ class BatteryService :
     void onWrite(BLECharacteristic *characteristic);
     void onRead(BLECharacteristic *characteristic);
 
-    void setBatteryLevel(int batteryLevel);
+    void setBatteryLevel(int batteryLevel, int minutesRemaining);
 
 private:
+    void setTimeRemainingValue(BLECharacteristic *characteristic);
+
     int batteryLevel;
+    int minutesRemaining;
 
     BLEService *batteryService;
     BLECharacteristic *batteryLevelCharacteristic;
+    BLECharacteristic *timeRemainingCharacteristic;
 
     Stream *console;
 };
@@ -0,0 +1,121 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "DisplayFrameBuffer.h"
+
+#include <Wire.h>
+
+
+// HT16K33 commands
+#define HT16K33_DISPLAY_RAM      (0x00)   // + byte offset, 2 bytes per digit (low, high)
+#define HT16K33_BRIGHTNESS       (0xE0)   // | 0-15
+
+
+DisplayFrameBuffer::DisplayFrameBuffer(Adafruit_AlphaNum4& display) :
+    display(display),
+    address(0),
+    shownValid(false),
+    brightness(-1)
+{
+}
+
+
+void
+DisplayFrameBuffer::begin(uint8_t address)
+{
+    this->address = address;
+
+    display.begin(address);
+    invalidate();
+}
+
+
+void
+DisplayFrameBuffer::invalidate()
+{
+    shownValid = false;
+    brightness = -1;
+}
+
+
+bool
+DisplayFrameBuffer::flush()
+{
+    // find the span of display RAM bytes that changed
+    uint8_t wanted[DISPLAY_DIGITS * 2];
+    int first = -1, last = -1;
+
+    for (int i = 0; i < DISPLAY_DIGITS; i++) {
+        wanted[i * 2]     = display.displaybuffer[i] & 0xFF;
+        wanted[i * 2 + 1] = display.displaybuffer[i] >> 8;
+
+        for (int b = i * 2; b <= i * 2 + 1; b++) {
+            uint8_t current = (b & 1) ? (shown[i] >> 8) : (shown[i] & 0xFF);
+            if (!shownValid || wanted[b] != current) {
+                if (first < 0) {
+                    first = b;
+                }
+                last = b;
+            }
+        }
+    }
+
+    if (first < 0) {
+        return false;
+    }
+
+    // the HT16K33 auto-increments its RAM address, so the whole span goes
+    // in one transaction
+    Wire.beginTransmission(address);
+    Wire.write(HT16K33_DISPLAY_RAM + first);
+    for (int b = first; b <= last; b++) {
+        Wire.write(wanted[b]);
+    }
+    if (Wire.endTransmission() != 0) {
+        // we don't know what made it, so send everything next time
+        shownValid = false;
+        return true;
+    }
+
+    for (int i = 0; i < DISPLAY_DIGITS; i++) {
+        shown[i] = display.displaybuffer[i];
+    }
+    shownValid = true;
+
+    return true;
+}
+
+
+void
+DisplayFrameBuffer::setBrightness(uint8_t newBrightness)
+{
+    if (newBrightness > 15) {
+        newBrightness = 15;
+    }
+
+    if (newBrightness == brightness) {
+        return;
+    }
+
+    Wire.beginTransmission(address);
+    Wire.write(HT16K33_BRIGHTNESS | newBrightness);
+    brightness = (Wire.endTransmission() == 0) ? newBrightness : -1;
+}
@@ -0,0 +1,68 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include "Arduino.h"
+
+#include <Adafruit_LEDBackpack.h>
+
+
+// A shadow of what the HT16K33 behind an Adafruit_AlphaNum4 is actually
+// showing.  Digits are still drawn into the library's displaybuffer (so
+// its font is used), but flush() only sends the display RAM bytes that
+// differ from what was last sent, in a single I2C transaction covering
+// the changed span, and nothing at all when nothing changed.  Brightness
+// is cached the same way.
+//
+// The caller is responsible for holding the I2C bus around flush() and
+// setBrightness().
+
+#define DISPLAY_DIGITS  (4)
+
+class DisplayFrameBuffer
+{
+  public:
+    DisplayFrameBuffer(Adafruit_AlphaNum4& display);
+
+    void begin(uint8_t address);
+
+    void writeDigitAscii(uint8_t n, uint8_t ascii, bool dot = false) { display.writeDigitAscii(n, ascii, dot); }
+    void clear()                                                     { display.clear(); }
+
+    // send whatever has changed, return true if anything was sent
+    bool flush();
+
+    void setBrightness(uint8_t brightness);
+
+    // forget what the display is showing, so the next flush() sends it all
+    void invalidate();
+
+  private:
+    Adafruit_AlphaNum4& display;
+    uint8_t             address;
+
+    uint16_t            shown[DISPLAY_DIGITS];
+    bool                shownValid;
+    int                 brightness;    // -1 if not known
+};
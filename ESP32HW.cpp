@@ -19,10 +19,12 @@
  *
  */
 
-#include <FunctionalInterrupt.h>
 
 #include "ESP32HW.h"
 
+#include "driver/gpio.h"
+#include "soc/gpio_struct.h"
+
 ////////////////////////////////////////////////////////////////////////////////
 ////////////////////////////////////////////////////////////////////////////////
 //
@@ -32,18 +34,29 @@
 
 // HW Data Processing Rates (measured in ms)
 
-// update whether or not the throttle has moved
-#define ACCELEROMETER_MOTION_READ_RATE  (1000/5)   // 5Hz
+// the throttle is idle once it hasn't moved for this long.  This is only a
+// deadline against the last motion interrupt, the accelerometer isn't read.
+#define THROTTLE_IDLE_TIME              (2*60*1000UL)   // 2 minutes
 
-// how frequently we report (via the delegate) the speed & direction
+// how frequently we report (via the delegate) the speed & direction.  The
+// potentiometer itself is sampled continuously by the SpeedSampler, and
+// each report averages everything sampled since the last one.
 #define SPEED_POT_REPORT_RATE           (1000/20)  // 20Hz
 
-// internally, how often we read the potentiometer (to implement oversampling)
-// read the speed pot 5 times for every report we make upstream
-#define SPEED_POT_READ_RATE             (SPEED_POT_REPORT_RATE/5)
+// The HW is scanned by its own task, pinned to the core that the Arduino
+// loop (and with it the controller and its network calls) is NOT on, so
+// a stalled connection can't hold up the buttons or the knob.
+#define HW_SCAN_TASK_CORE               (0)
+#define HW_SCAN_TASK_PRIORITY           (2)        // above the loop task
+#define HW_SCAN_TASK_STACK              (4096)
+
+// how often the scan task's timer statistics go to the console
+#define HW_STATS_REPORT_RATE            (5*60*1000UL)   // 5 minutes
 
-// how frequently we read the battery level
-#define BATTERY_CHECK_READ_RATE         (2500)     // every 2.5 seconds
+// how frequently we read the battery level.  Each read takes ADC1 away from
+// the speed sampler for a few ms, and the cell voltage changes slowly, so
+// this is kept well apart.
+#define BATTERY_CHECK_READ_RATE         (15000)    // every 15 seconds
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -59,6 +72,10 @@
 // I2C address of the SX1509 GPIO expander.
 #define SX1509_I2C_ADDRESS       (0x3E)
 
+// the SX1509's LED driver clock (ClkX) is 2 MHz / 2^(divider-1).  At
+// 250 kHz, blink times from 65 ms to 1 s are available.
+#define SX1509_LED_CLOCK_DIVIDER (4)
+
 // the INTR output pin of the SX1509 is attached to this pin on the ESP32
 #define SX1509_INTR_PIN          (27)  // ESP32 A10
 
@@ -80,6 +97,10 @@
 
 // Linear potentiometer used for speed control (analog value read via ADC)
 #define SPEED_KNOB               (36)   // ESP32 A4
+#define SPEED_KNOB_ADC_CHANNEL   (ADC1_CHANNEL_0)   // which is GPIO36
+
+// how the speed knob's travel maps onto speed (see SpeedCurve.h)
+#define SPEED_KNOB_CURVE         (LinearCurve)
 
 // Toggle Switch for direction selection.  At most ONE of these two will be
 // connected to ground.  Using a CENTER OFF toggle, it is possible that
@@ -87,11 +108,25 @@
 #define DIR_LEFT                 (15)
 #define DIR_RIGHT                (33)
 
-// Basic Pilot Light -- blink under direct ESP32 control
+// A quadrature encoder in place of the speed knob (SPEED_INPUT_ENCODER)
+#define ENCODER_A                (18)   // ESP32 MO
+#define ENCODER_B                (19)   // ESP32 MI
+#define ENCODER_STOP             (5)    // ESP32 SCK, the encoder's push switch
+#define ENCODER_PCNT_UNIT        (PCNT_UNIT_0)
+
+// The second cab's knob and toggle, on the dispatcher's enclosure
+#define SPEED_KNOB2              (34)   // ESP32 A2
+#define SPEED_KNOB2_ADC_CHANNEL  (ADC1_CHANNEL_6)   // which is GPIO34
+#define DIR2_LEFT                (4)    // ESP32 A5
+#define DIR2_RIGHT               (25)   // ESP32 A1
+
+// Basic Pilot Light -- blinked by the ESP32's LED PWM hardware
 #define PILOT_LIGHT              (21)
+#define PILOT_LIGHT_CHANNEL      (0)    // LEDC channel
 
 // battery level is read through this pin (analog value read via ADC)
-#define BATTERY_LEVEL_PIN        (36)   // A13
+#define BATTERY_LEVEL_PIN        (35)   // A13
+#define BATTERY_ADC_CHANNEL      (ADC1_CHANNEL_7)   // which is GPIO35
 
 // do not report any changes to the current battery level until they exceed this
 // value (in mV)
@@ -138,6 +173,79 @@
 ////////////////////////////////////////////////////////////////////////////////
 
 
+////////////////////////////////////////////////////////////////////////////////
+//
+// The buttons on the SX1509, and the function each one sends.  This is
+// the only place a button needs to be added.
+//
+
+typedef struct ButtonMapping {
+    uint8_t     pin;        // SX1509 pin
+    uint8_t     function;   // function number sent to the delegate
+    const char *name;
+} ButtonMapping;
+
+static constexpr ButtonMapping buttonMap[] = {
+    { BRAKE,   9, "BRAKE"   },
+    { BUTTON1, 0, "BUTTON1" },
+    { BUTTON2, 1, "BUTTON2" },
+    { BUTTON3, 2, "BUTTON3" },
+    { BUTTON4, 3, "BUTTON4" },
+    { BUTTON5, 4, "BUTTON5" },
+    { BUTTON6, 5, "BUTTON6" },
+    { BUTTON7, 6, "BUTTON7" },
+    { BUTTON8, 7, "BUTTON8" },
+};
+
+#define BUTTON_COUNT  (sizeof(buttonMap) / sizeof(buttonMap[0]))
+#define NO_BUTTON     (0xFF)
+
+// all of the SX1509 pins that are buttons, as a bit mask
+static constexpr uint16_t
+buttonPinMask(unsigned i = 0)
+{
+    return (i >= BUTTON_COUNT) ? 0 : uint16_t((1 << buttonMap[i].pin) | buttonPinMask(i + 1));
+}
+
+// the buttonMap entry for an SX1509 pin, or NO_BUTTON
+static constexpr uint8_t
+buttonForPin(unsigned pin, unsigned i = 0)
+{
+    return (i >= BUTTON_COUNT) ? NO_BUTTON : (buttonMap[i].pin == pin) ? i : buttonForPin(pin, i + 1);
+}
+
+#define BUTTON_PIN_MASK  (buttonPinMask())
+
+// indexed by SX1509 pin
+static constexpr uint8_t buttonsByPin[16] = {
+    buttonForPin(0),  buttonForPin(1),  buttonForPin(2),  buttonForPin(3),
+    buttonForPin(4),  buttonForPin(5),  buttonForPin(6),  buttonForPin(7),
+    buttonForPin(8),  buttonForPin(9),  buttonForPin(10), buttonForPin(11),
+    buttonForPin(12), buttonForPin(13), buttonForPin(14), buttonForPin(15),
+};
+
+// ESP32 inputs for each cab
+typedef struct CabInputs {
+    adc1_channel_t speedChannel;
+    uint8_t        dirLeft;
+    uint8_t        dirRight;
+} CabInputs;
+
+static const CabInputs cabInputs[CAB_COUNT] = {
+    { SPEED_KNOB_ADC_CHANNEL,  DIR_LEFT,  DIR_RIGHT },
+#if CAB_COUNT > 1
+    { SPEED_KNOB2_ADC_CHANNEL, DIR2_LEFT, DIR2_RIGHT },
+#endif
+};
+
+// SX1509 input data registers.  B (pins 15-8) is immediately followed by A
+// (pins 7-0), and the chip auto-increments, so one read gets all 16.
+#define SX1509_REG_DATA_B        (0x10)
+
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
 // LEDs are in an active-low configuration
 #define GPIO_OFF (1)
 #define GPIO_ON  (0)
@@ -149,6 +257,20 @@
 #define TWENTYFOUR_HOUR_TIME  (0)
 
 
+// Holds the I2C bus for the life of the object.  The lock is recursive, so
+// it's fine to take it again further down the same call.  Until begin()
+// creates the lock there is no scan task either, so nothing to do.
+class I2CLock
+{
+  public:
+    I2CLock(SemaphoreHandle_t lock) : lock(lock) { if (lock) xSemaphoreTakeRecursive(lock, portMAX_DELAY); }
+    ~I2CLock() { if (lock) xSemaphoreGiveRecursive(lock); }
+
+  private:
+    SemaphoreHandle_t lock;
+};
+
+
 //
 //
 ////////////////////////////////////////////////////////////////////////////////
@@ -157,22 +279,31 @@
 
 ESP32HW::ESP32HW() :
     numericDisplay(),
-    accelerometer(),
+    display(numericDisplay),
+    motion(ACCEL_I2C_ADDRESS),
     hapticMotorController(),
+    haptics(HAPTIC_I2C_ADDRESS),
     gpio(),
     pilotLight(),
-    statusLED(gpio, STATUS_RED, STATUS_GREEN, STATUS_BLUE),
-    handle_gpio(false),
-    handle_accelerometer(false),
-    speedAccumulator(0),
-    speedCount(0),
-    previousTogglePosition(UnknownPosition),
-    previousSpeedValue(0),
-    penultimateSpeedValue(0),
-    batteryCheck(),
-    accelerometerCheck(),
-    speedPotReadCheck(),
-    speedCheck()
+    statusLED(gpio, SX1509_I2C_ADDRESS, STATUS_RED, STATUS_GREEN, STATUS_BLUE),
+    speedSampler(),
+    isrEvents(),
+    isrEventsLost(false),
+    pressedButtons(0),
+    moving(true),        // so a throttle that's never touched still goes idle
+    cabs(),
+    scheduler(),
+    idleTimer(-1),
+    hapticTimer(-1),
+    hapticsScheduled(false),
+    hapticsRequested(false),
+    scanTask(NULL),
+    i2cLock(NULL),
+    events(),
+    droppedEvents(0),
+    eventsPosted(false),
+    lowPower(false),
+    lowPowerRequested(false)
 {
     Serial.begin(115200);
     Serial1.begin(115200, SERIAL_8N1, CONSOLE_TX, CONSOLE_RX);
@@ -181,22 +312,127 @@ ESP32HW::ESP32HW() :
 #else
     console = &Serial;
 #endif
+
+    for (int cab = 0; cab < CAB_COUNT; cab++) {
+        cabs[cab].speedCurve.setCurve(SPEED_KNOB_CURVE);
+        cabs[cab].previousTogglePosition = UnknownPosition;
+        cabs[cab].previousSpeedValue = 0;
+    }
 }
 
 
 void
 ESP32HW::resetStats()
 {
-    previousSpeedValue = penultimateSpeedValue = -1;
-    previousTogglePosition = UnknownPosition;
+    for (int cab = 0; cab < CAB_COUNT; cab++) {
+        cabs[cab].previousSpeedValue = -1;
+        cabs[cab].previousTogglePosition = UnknownPosition;
+    }
+}
+
+
+void
+ESP32HW::setSpeedSteps(int cab, int steps)
+{
+    if (cab < 0 || cab >= CAB_COUNT) {
+        return;
+    }
+
+    int stepCount = cabs[cab].speedCurve.setSpeedSteps(steps);
+    console->printf("speed curve: cab %d using %d steps\n", cab, stepCount);
+
+#if SPEED_INPUT_ENCODER
+    speedEncoder.setSpeedSteps(stepCount);
+#endif
+
+    // the current knob position may be a different speed now
+    cabs[cab].previousSpeedValue = -1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Light sleep wakeup.  A GPIO wakeup is a level interrupt on the pin, but
+// the SX1509 and accelerometer interrupts are edges while awake (their
+// lines stay asserted until the scan task clears them over I2C), so the
+// level is only armed while the scan task waits, and a pin that wakes us
+// goes straight back to its edge, in its ISR, before it can retrigger.
+//
+
+typedef struct WakeupPin {
+    gpio_num_t      pin;
+    gpio_int_type_t wakeLevel;
+    gpio_int_type_t awakeType;    // GPIO_INTR_DISABLE if it has no ISR
+} WakeupPin;
+
+// indexes into wakeupPins, for the ISRs
+#define WAKEUP_SX1509  (0)
+#define WAKEUP_ACCEL   (1)
+
+static DRAM_ATTR const WakeupPin wakeupPins[] = {
+    { (gpio_num_t) SX1509_INTR_PIN, GPIO_INTR_LOW_LEVEL,  GPIO_INTR_NEGEDGE },
+    { (gpio_num_t) ACCEL_INTR_PIN,  GPIO_INTR_HIGH_LEVEL, GPIO_INTR_POSEDGE },
+#if SPEED_INPUT_ENCODER
+    // the PCNT stops in light sleep, so the first edge of a turn wakes up
+    // (both phases are high at a detent)
+    { (gpio_num_t) ENCODER_A,       GPIO_INTR_LOW_LEVEL,  GPIO_INTR_DISABLE },
+    { (gpio_num_t) ENCODER_STOP,    GPIO_INTR_LOW_LEVEL,  GPIO_INTR_DISABLE },
+#endif
+};
+#define WAKEUP_PIN_COUNT (sizeof(wakeupPins) / sizeof(wakeupPins[0]))
+
+
+// put a pin back the way it is while awake; called from its ISR too
+static void IRAM_ATTR
+disarm_wakeup_pin(const WakeupPin& wakeup)
+{
+    GPIO.pin[wakeup.pin].wakeup_enable = 0;
+    GPIO.pin[wakeup.pin].int_type = wakeup.awakeType;
+}
+
+
+// Arm the wakeups, just before the scan task waits.  A line that's already
+// asserted has an event on its way (or being handled), and arming its
+// level would only retrigger it, so that pin is left as it is.
+void
+ESP32HW::arm_wakeup()
+{
+#if CONFIG_PM_ENABLE
+    for (size_t index = 0; index < WAKEUP_PIN_COUNT; index++) {
+        const WakeupPin& wakeup = wakeupPins[index];
+        int assertedLevel = (wakeup.wakeLevel == GPIO_INTR_HIGH_LEVEL) ? 1 : 0;
+
+        if (gpio_get_level(wakeup.pin) != assertedLevel) {
+            gpio_wakeup_enable(wakeup.pin, wakeup.wakeLevel);
+        }
+    }
+#endif
+}
+
+
+// and back to edges once it's running again
+void
+ESP32HW::disarm_wakeup()
+{
+#if CONFIG_PM_ENABLE
+    for (size_t index = 0; index < WAKEUP_PIN_COUNT; index++) {
+        disarm_wakeup_pin(wakeupPins[index]);
+    }
+#endif
 }
 
 
+////////////////////////////////////////////////////////////////////////////////
+
+
 bool
 ESP32HW::begin()
 {
     bool rv = true;
 
+    // the scan task and the controller both talk to devices on the I2C bus
+    i2cLock = xSemaphoreCreateRecursiveMutex();
+
     // anything that's externally visible should be done before anything
     // else to eliminate noticeable flashes or other oddities that the user
     // can see
@@ -206,35 +442,200 @@ ESP32HW::begin()
     rv &= setup_gpio();
     rv &= setup_accelerometer();
     rv &= setup_haptic_motor();
+    rv &= setup_battery_gauge();      // before the speed sampler takes ADC1
     rv &= setup_speed_direction();
 
+#if CONFIG_PM_ENABLE
+    // light sleep ends on a button, the accelerometer or the encoder (see
+    // wakeupPins, armed by the scan task); the toggle and knob are still
+    // scanned between sleeps
+    esp_sleep_enable_gpio_wakeup();
+#endif
+
+    setup_timers();
+
+    if (rv) {
+        xTaskCreatePinnedToCore(scan_task, "hwScan", HW_SCAN_TASK_STACK, this,
+                                HW_SCAN_TASK_PRIORITY, &scanTask, HW_SCAN_TASK_CORE);
+    }
+
     return rv;
 }
 
-// This method is called every time the accelerometer interrupt changes state
-//
+
+void
+ESP32HW::scan_task(void *arg)
+{
+    ESP32HW *hw = (ESP32HW *) arg;
+
+    for (;;) {
+        hw->scan();
+        hw->scheduler.run();
+
+        if (hw->eventsPosted) {
+            hw->eventsPosted = false;
+            if (hw->delegate) {
+                hw->delegate->eventsPending();
+            }
+        }
+
+        // sleep until the next timer is due; an interrupt, or a request
+        // from the other core, ends the wait early
+        uint32_t wait = hw->scheduler.untilNext();
+        hw->arm_wakeup();
+        ulTaskNotifyTake(pdTRUE, (wait == SCHEDULER_NO_DEADLINE) ? portMAX_DELAY : pdMS_TO_TICKS(wait));
+        hw->disarm_wakeup();
+    }
+}
+
+
+// Everything the scan task does on a schedule.  These all run on the scan
+// task, and must be added before it starts.
+void
+ESP32HW::setup_timers()
+{
+    scheduler.add("speed",   SPEED_POT_REPORT_RATE,   std::bind(&ESP32HW::report_speed, this));
+    scheduler.add("battery", BATTERY_CHECK_READ_RATE, std::bind(&ESP32HW::report_battery_level, this));
+    scheduler.add("stats",   HW_STATS_REPORT_RATE,    std::bind(&Scheduler::printStats, &scheduler, console));
+
+    // restarted by every motion interrupt
+    idleTimer = scheduler.add("idle", THROTTLE_IDLE_TIME, std::bind(&ESP32HW::report_idle, this));
+
+    // only runs while the motor is busy
+    hapticTimer = scheduler.add("haptics", 0, std::bind(&ESP32HW::service_haptics, this));
+}
+
+
+// once an effect is queued, poll the motor until it's played
 void
-ESP32HW::accelerometer_isr()
+ESP32HW::start_haptics()
+{
+    if (!hapticsScheduled) {
+        hapticsScheduled = true;
+        scheduler.setPeriod(hapticTimer, HAPTIC_POLL_INTERVAL);
+    }
+}
+
+
+void
+ESP32HW::service_haptics()
+{
+    bool busy = haptics.busy();
+
+    if (busy) {
+        I2CLock lock(i2cLock);
+        haptics.check();
+        busy = haptics.busy();
+    }
+
+    if (busy != hapticsScheduled) {
+        hapticsScheduled = busy;
+        scheduler.setPeriod(hapticTimer, busy ? HAPTIC_POLL_INTERVAL : 0);
+    }
+}
+
+
+void
+ESP32HW::setLowPower(bool lowPower)
+{
+    // the scan task owns the speed sampler, so it makes the change
+    lowPowerRequested = lowPower;
+    if (scanTask) {
+        xTaskNotifyGive(scanTask);
+    }
+}
+
+
+// Queue an input event for the controller's core.  This is only ever
+// called from the scan task, which makes it the ring's single producer.
+void
+ESP32HW::post_event(HWEventType type, int value, int arg, int extra, uint32_t timestamp)
+{
+    HWEvent event;
+    event.type      = type;
+    event.arg       = arg;
+    event.value     = value;
+    event.extra     = extra;
+    event.timestamp = timestamp ? timestamp : micros();
+
+    if (!events.push(event)) {
+        droppedEvents++;
+    }
+    eventsPosted = true;
+}
+
+// Record an interrupt for the scan task.  Both ISRs are attached from the
+// same core, and GPIO interrupts on a core are dispatched one at a time, so
+// the ISRs together are still a single producer for the ring.
+//
+// The whole ISR path is in IRAM, so it still runs while a flash write
+// (the journal, settings) has the cache disabled; isrEvents is part of the
+// global controller, so it's in DRAM.
+void IRAM_ATTR
+ESP32HW::post_isr_event(ISRSource source, uint8_t level)
+{
+    ISREvent event;
+    event.source    = source;
+    event.level     = level;
+    event.timestamp = micros();
+
+    if (!isrEvents.push(event)) {
+        isrEventsLost = true;
+    }
+
+    if (scanTask) {
+        BaseType_t woken = pdFALSE;
+        vTaskNotifyGiveFromISR(scanTask, &woken);
+        if (woken) {
+            portYIELD_FROM_ISR();
+        }
+    }
+}
+
+
+// the input level of a pin, read straight from the GPIO registers
+// (digitalRead() is in flash)
+static inline int IRAM_ATTR
+read_pin_level(int pin)
+{
+    if (pin < 32) {
+        return (GPIO.in >> pin) & 1;
+    }
+    return (GPIO.in1.data >> (pin - 32)) & 1;
+}
+
+
+// This method is called every time the accelerometer raises its interrupt
+// (free-fall or motion)
+//
+void IRAM_ATTR
+ESP32HW::accelerometer_isr(void *arg)
 {
-    handle_accelerometer = true;
-    accelerometer_value_at_intr = digitalRead(ACCEL_INTR_PIN);
+    ESP32HW *hw = (ESP32HW *) arg;
+
+    disarm_wakeup_pin(wakeupPins[WAKEUP_ACCEL]);
+    hw->post_isr_event(AccelerometerInterrupt, read_pin_level(ACCEL_INTR_PIN));
 }
 
 
 // This method is called every time the SX1509 interrupt drops low
 // (indicating that one or more inputs have been registered).
 //
-void
-ESP32HW::gpio_isr()
+void IRAM_ATTR
+ESP32HW::gpio_isr(void *arg)
 {
-    handle_gpio = true;
+    ESP32HW *hw = (ESP32HW *) arg;
+
+    disarm_wakeup_pin(wakeupPins[WAKEUP_SX1509]);
+    hw->post_isr_event(GPIOInterrupt);
 }
 
 
 bool
 ESP32HW::setup_pilot_light()
 {
-    pilotLight.begin(PILOT_LIGHT);
+    pilotLight.begin(PILOT_LIGHT, PILOT_LIGHT_CHANNEL);
+    return true;
 }
 
 
@@ -250,35 +651,16 @@ ESP32HW::setup_gpio()
 
     gpio.debounceTime(16);
 
-    statusLED.begin();
+    gpio.clock(INTERNAL_CLOCK_2MHZ, SX1509_LED_CLOCK_DIVIDER);
+    statusLED.begin(SX1509_LED_CLOCK_DIVIDER);
 
-#ifdef BRAKE
-    setup_button(BRAKE);
-#endif
-#ifdef BUTTON1
-    setup_button(BUTTON1);
-#endif
-#ifdef BUTTON2
-    setup_button(BUTTON2);
-#endif
-#ifdef BUTTON3
-    setup_button(BUTTON3);
-#endif
-#ifdef BUTTON4
-    setup_button(BUTTON4);
-#endif
-#ifdef BUTTON5
-    setup_button(BUTTON5);
-#endif
-#ifdef BUTTON6
-    setup_button(BUTTON6);
-#endif
-#ifdef BUTTON7
-    setup_button(BUTTON7);
-#endif
-#ifdef BUTTON8
-    setup_button(BUTTON8);
-#endif
+    for (unsigned i = 0; i < BUTTON_COUNT; i++) {
+        setup_button(buttonMap[i].pin);
+    }
+
+    // anything held down at power on is already pressed, not a change
+    gpio.interruptSource();
+    pressedButtons = ~read_gpio_inputs() & BUTTON_PIN_MASK;
 
 #ifdef LED1
     setup_led(LED1);
@@ -302,7 +684,7 @@ ESP32HW::setup_gpio()
     setup_led(LED7);
 #endif
 
-    attachInterrupt(SX1509_INTR_PIN, std::bind(&ESP32HW::gpio_isr, this), FALLING);
+    attachInterruptArg(SX1509_INTR_PIN, gpio_isr, this, FALLING);
 
     console->println("gpio initialized");
     return true;
@@ -312,13 +694,12 @@ ESP32HW::setup_gpio()
 bool
 ESP32HW::setup_accelerometer()
 {
-    if (! accelerometer.begin(ACCEL_I2C_ADDRESS)) {
+    if (!motion.begin()) {
         return false;
     }
 
-    accelerometer.setRange(LIS3DH_RANGE_4_G);
-
-    attachInterrupt(ACCEL_INTR_PIN, std::bind(&ESP32HW::accelerometer_isr, this), CHANGE);
+    // INT1 is latched high until the scan task has read why
+    attachInterruptArg(ACCEL_INTR_PIN, accelerometer_isr, this, RISING);
 
     console->println("accelerometer initialized");
     return true;
@@ -340,9 +721,9 @@ ESP32HW::setup_haptic_motor()
 bool
 ESP32HW::setup_numeric_display()
 {
-    numericDisplay.begin(ALPHANUM_DISPLAY_ADDRESS);
-    numericDisplay.clear();
-    numericDisplay.writeDisplay();
+    display.begin(ALPHANUM_DISPLAY_ADDRESS);
+    display.clear();
+    display.flush();
 
     console->println("numeric display initialized");
     return true;
@@ -352,10 +733,36 @@ ESP32HW::setup_numeric_display()
 bool
 ESP32HW::setup_speed_direction()
 {
-  pinMode(DIR_LEFT, INPUT_PULLUP);
-  pinMode(DIR_RIGHT, INPUT_PULLUP);
+  for (int cab = 0; cab < CAB_COUNT; cab++) {
+      pinMode(cabInputs[cab].dirLeft, INPUT_PULLUP);
+      pinMode(cabInputs[cab].dirRight, INPUT_PULLUP);
+  }
 
+#if SPEED_INPUT_ENCODER
+  return speedEncoder.begin(ENCODER_PCNT_UNIT, ENCODER_A, ENCODER_B, ENCODER_STOP);
+#else
   analogReadResolution(12);   // 0-4095, no matter what the hardware support
+
+  adc1_channel_t channels[CAB_COUNT];
+  for (int cab = 0; cab < CAB_COUNT; cab++) {
+      channels[cab] = cabInputs[cab].speedChannel;
+  }
+
+  return speedSampler.begin(channels, CAB_COUNT);
+#endif
+}
+
+
+bool
+ESP32HW::setup_battery_gauge()
+{
+    if (!batteryGauge.begin(BATTERY_ADC_CHANNEL, console)) {
+        return false;
+    }
+
+    // take a first reading now, rather than waiting for the first check
+    batteryGauge.sample();
+    return true;
 }
 
 
@@ -378,95 +785,83 @@ ESP32HW::setup_led(int pin)
 
 
 
-void
-ESP32HW::read_one_button(int intrStatus, int buttonPin, int funcNum, const char *name)
+// read the (debounced) level of all 16 SX1509 pins, in one I2C transaction
+//   bit N is pin N, and a 0 is a pressed button (they're all pulled up)
+uint16_t
+ESP32HW::read_gpio_inputs()
 {
-  if (intrStatus & (1 << buttonPin)) {
-    int pressed = !gpio.digitalRead(buttonPin);
-    //console->printf("%s %s\n", name, pressed ? "PRESSED" : "RELEASED");
+    Wire.beginTransmission(SX1509_I2C_ADDRESS);
+    Wire.write(SX1509_REG_DATA_B);
+    if (Wire.endTransmission(false) != 0) {
+        return 0xFFFF;
+    }
 
-    if (delegate) {
-        delegate->functionButtonChanged(funcNum, pressed ? true : false);
+    if (Wire.requestFrom(SX1509_I2C_ADDRESS, 2) != 2) {
+        return 0xFFFF;
     }
-  }
-}
 
+    uint16_t inputs = Wire.read() << 8;
+    inputs |= Wire.read();
+    return inputs;
+}
 
 
 /* This function gets called whenever the interrupt handler indicates that
  * we need to process a button change event from the SX1509.  Only those
  * buttons that have changed will be indicated in the interrupt source,
- * so we read the new value and send the function state accordingly.
+ * so we read all the inputs at once and send the function state for each
+ * changed button.
+ *
+ * The SX1509 only interrupts again once the source has been read, so a
+ * quick press and release can both happen before we get here.  That shows
+ * up as a button flagged as changed that's still in the state we last
+ * reported, and is sent as the press and release it must have been.
+ *
+ * timestamp: micros() when the interrupt fired
  */
 void
-ESP32HW::read_buttons()
+ESP32HW::read_buttons(uint32_t timestamp)
 {
-    if (!delegate) {
-        return;
-    }
-
-    unsigned int intrStatus = gpio.interruptSource();
-    // For debugging handiness, print the intrStatus variable.
-    // console->print("button interrupt: "); console->print(intrStatus, BIN); console->println("");
-
-    // Each bit in intStatus represents a single SX1509 I/O.  Check all thet
-    // we know about each time we get notified of a change.
+    I2CLock lock(i2cLock);
 
-    // TODO: put the buttons into a map (name:pin)
-#ifdef BRAKE
-    read_one_button(intrStatus, BRAKE,   9, "BRAKE");
-#endif
+    uint16_t changed = gpio.interruptSource() & BUTTON_PIN_MASK;
+    // For debugging handiness, print the changed buttons.
+    // console->print("button interrupt: "); console->print(changed, BIN); console->println("");
 
-#ifdef BUTTON1
-    read_one_button(intrStatus, BUTTON1, 0, "BUTTON1");
-#endif
-#ifdef BUTTON2
-    read_one_button(intrStatus, BUTTON2, 1, "BUTTON2");
-#endif
-#ifdef BUTTON3
-    read_one_button(intrStatus, BUTTON3, 2, "BUTTON3");
-#endif
-#ifdef BUTTON4
-    read_one_button(intrStatus, BUTTON4, 3, "BUTTON4");
-#endif
-#ifdef BUTTON5
-    read_one_button(intrStatus, BUTTON5, 4, "BUTTON5");
-#endif
-#ifdef BUTTON6
-    read_one_button(intrStatus, BUTTON6, 5, "BUTTON6");
-#endif
-#ifdef BUTTON7
-    read_one_button(intrStatus, BUTTON7, 6, "BUTTON7");
-#endif
-#ifdef BUTTON8
-    read_one_button(intrStatus, BUTTON8, 7, "BUTTON8");
-#endif
-}
+    if (!changed) {
+        return;
+    }
 
+    uint16_t pressed = ~read_gpio_inputs() & BUTTON_PIN_MASK;
 
+    while (changed) {
+        int pin = __builtin_ctz(changed);
+        uint16_t bit = 1 << pin;
+        changed &= changed - 1;
 
-void
-ESP32HW::read_speed_potentiometer()
-{
-    int rawSpeedValue = analogRead(SPEED_KNOB);
+        const ButtonMapping &button = buttonMap[buttonsByPin[pin]];
+        bool isPressed = pressed & bit;
+        //console->printf("%s %s\n", button.name, isPressed ? "PRESSED" : "RELEASED");
 
-    // MAGIC NUMBERS:
-    //   4095 is the max analog value for 12 bits
-    //   126 is the maximum speed value for the WiThrottle protocol
-    int reading = map(rawSpeedValue, 0, 4095, 0, 126);
+        if (isPressed == bool(pressedButtons & bit)) {
+            // the edge we missed
+            post_event(ButtonEvent, !isPressed, button.function, 0, timestamp);
+        }
+        post_event(ButtonEvent, isPressed, button.function, 0, timestamp);
+    }
 
-    speedAccumulator += reading;
-    speedCount += 1;
+    pressedButtons = pressed;
 }
 
 
+
 TogglePosition
-ESP32HW::read_toggle_position()
+ESP32HW::read_toggle_position(int cab)
 {
     TogglePosition togglePosition = UnknownPosition; // This should never happen
 
-    int d1 = !digitalRead(DIR_LEFT);
-    int d2 = !digitalRead(DIR_RIGHT);
+    int d1 = !digitalRead(cabInputs[cab].dirLeft);
+    int d2 = !digitalRead(cabInputs[cab].dirRight);
 
     if (!d1 && !d2) {
         togglePosition = CenterOff;
@@ -486,92 +881,106 @@ ESP32HW::read_toggle_position()
 void
 ESP32HW::report_speed()
 {
-    bool turnedToZero = false;
-    bool turnedToMax = false;
-
     if (!delegate) {
         // no one is listening, just stop...
         return;
     }
 
-    if (speedCount == 0) {
-        // no data has been accumulated, so don't do anything...
+#if SPEED_INPUT_ENCODER
+    // the encoder already counts in the decoder's speed steps
+    report_cab_speed(0, speedEncoder.update());
+#else
+    int rawSpeedValues[CAB_COUNT];
+    if (!speedSampler.read(rawSpeedValues)) {
+        // nothing has been sampled since the last report, so don't do anything...
         return;
     }
 
-    bool speed_changed = false;
-    bool toggle_position_changed = false;
+    for (int cab = 0; cab < CAB_COUNT; cab++) {
+        // the curve table gives a WiThrottle speed (0-126) that's already
+        // on one of the decoder's speed steps
+        CabInputState& state = cabs[cab];
+        report_cab_speed(cab, state.speedCurve.lookup(state.speedFilter.update(rawSpeedValues[cab])));
+    }
+#endif
+}
 
-    int speedValue = speedAccumulator / speedCount;
 
-    TogglePosition togglePosition = read_toggle_position();
+// The speed and toggle position are the same to the delegate, whatever
+// the knob is
+void
+ESP32HW::report_cab_speed(int cab, int speedValue)
+{
+    CabInputState& state = cabs[cab];
+
+    bool turnedToZero = false;
+    bool turnedToMax = false;
+    bool speed_changed = false;
+    bool toggle_position_changed = false;
 
-    // reset the accumulator
-    speedAccumulator = speedCount = 0;
+    TogglePosition togglePosition = read_toggle_position(cab);
 
-    if (speedValue == 0 && previousSpeedValue > 0) {
+    if (speedValue == 0 && state.previousSpeedValue > 0) {
         turnedToZero = true;
     }
-    if (speedValue == 126 && previousSpeedValue != 126) {
+    if (speedValue == MAX_SPEED_VALUE && state.previousSpeedValue != MAX_SPEED_VALUE) {
         turnedToMax = true;
     }
 
     if (togglePosition == CenterOff) {
         // center off position
         speedValue = 0;
+#if SPEED_INPUT_ENCODER
+        // and an encoder doesn't pick up where it left off
+        speedEncoder.stop();
+#endif
         turnedToZero = turnedToMax = false;
 
-        if (previousSpeedValue != 0) {
-            previousSpeedValue = penultimateSpeedValue = 0;
+        if (state.previousSpeedValue != 0) {
+            state.previousSpeedValue = 0;
             speed_changed = true;
         }
     }
 
-    if (togglePosition != previousTogglePosition) {
+    if (togglePosition != state.previousTogglePosition) {
         toggle_position_changed = true;
-        previousTogglePosition = togglePosition;
+        state.previousTogglePosition = togglePosition;
     }
 
-    if (speedValue != previousSpeedValue && speedValue != penultimateSpeedValue) {
-        penultimateSpeedValue = previousSpeedValue;
-        previousSpeedValue = speedValue;
+    if (speedValue != state.previousSpeedValue) {
+        state.previousSpeedValue = speedValue;
         speed_changed = true;
     }
 
     if (toggle_position_changed) {
         //console->printf("toggle position changed: %d\n", togglePosition);
-        delegate->togglePositionChanged(togglePosition);
+        post_event(ToggleEvent, togglePosition, cab);
     }
     if (speed_changed) {
         //console->printf("speed changed: %d, toggle position: %d\n", speedValue, togglePosition);
-        delegate->speedChanged(speedValue, togglePosition);
+        post_event(SpeedEvent, speedValue, togglePosition, cab);
     }
 
+    // (these are only queued, the scan task plays them when the motor is free)
     if (turnedToZero) {
-        triggerHapticMotor(26);
+        haptics.request(26, HapticHigh);
+        start_haptics();
     }
     else if (turnedToMax) {
-        triggerHapticMotor(17);
+        haptics.request(17);
+        start_haptics();
     }
 }
 
 
 // return the battery voltage, as reported in mV
-int
+void
 ESP32HW::read_battery_level()
 {
-    int rawBatteryADCLevel = analogRead(BATTERY_LEVEL_PIN);
-
-    // TODO: perform an ADC calibration before using the ADCs
-
-    // there's a voltage divider on the input, so the raw reading is half of the battery
-    // voltage level.   The nominal voltage is 3300 mV, with a calibration reference of
-    // 1.100 V.   The full multiplication is done before dividing by the resolution of the
-    // ADC, giving us something in the ballpark of the real voltage reading.
-
-    int actualBatteryVoltage = int((float(rawBatteryADCLevel)*2.0 * 3300 * 1.100) / 4095.0);
-
-    return actualBatteryVoltage;
+    // the gauge needs ADC1 back from the speed sampler for a moment
+    speedSampler.pause();
+    batteryGauge.sample();
+    speedSampler.resume();
 }
 
 
@@ -582,13 +991,24 @@ ESP32HW::report_battery_level()
         return;
     }
 
-    int battery_level = read_battery_level();
-    static int last_battery_level = -1;
+    read_battery_level();
+
+    int millivolts = batteryGauge.millivolts();
+    int percent = batteryGauge.percent();
+    int minutesRemaining = batteryGauge.minutesRemaining();
 
-    if (abs(battery_level - last_battery_level) > BATTERY_CHANGE_THRESHOLD) {
-        delegate->batteryLevelChanged(battery_level);
+    static int last_millivolts = -1;
+    static int last_percent = -1;
+    static int last_minutes_remaining = -1;
 
-        last_battery_level = battery_level;
+    if (abs(millivolts - last_millivolts) > BATTERY_CHANGE_THRESHOLD
+        || percent != last_percent
+        || minutesRemaining != last_minutes_remaining) {
+        post_event(BatteryEvent, millivolts, percent, minutesRemaining);
+
+        last_millivolts = millivolts;
+        last_percent = percent;
+        last_minutes_remaining = minutesRemaining;
     }
 }
 
@@ -596,56 +1016,126 @@ ESP32HW::report_battery_level()
 void
 ESP32HW::report_motion()
 {
-}
+    I2CLock lock(i2cLock);
+
+    // both sources are latched; if the other one latched while the first
+    // was being cleared, INT1 is still high and there won't be another edge
+    for (int tries = 0; tries < 3; tries++) {
+        int magnitude = 0;
+
+        switch (motion.check(&magnitude)) {
+            case Fell:
+                post_event(FallEvent, 0);
+                break;
+            case Moved:
+                post_event(MotionEvent, min(magnitude, (int) INT16_MAX));
+                break;
+            case NoMotion:
+                break;
+        }
+
+        if (!digitalRead(ACCEL_INTR_PIN)) {
+            break;
+        }
+    }
 
+    moving = true;
+    scheduler.restart(idleTimer);
+}
 
 
-bool
-ESP32HW::check()
+void
+ESP32HW::report_idle()
 {
-    bool actionTaken = false;
-
-    if (pilotLight.check()) {
-        actionTaken = true;
+    if (moving) {
+        moving = false;
+        post_event(IdleEvent, 0);
     }
+}
+
 
 
-    if (handle_gpio) {
-        read_buttons();
-        handle_gpio = false;
+// Everything the scan task does whenever it wakes up; the periodic work is
+// all on the scheduler
+void
+ESP32HW::scan()
+{
+    if (lowPower != lowPowerRequested) {
+        lowPower = lowPowerRequested;
+        speedSampler.setLowPower(lowPower);
     }
 
-    if (handle_accelerometer) {
-        console->printf("* ACCEL INTR ==> %d\n", accelerometer_value_at_intr);
-        handle_accelerometer = false;
+    // a new effect starts the haptics timer, which then services the
+    // motor until it's done
+    if (hapticsRequested) {
+        hapticsRequested = false;
+        start_haptics();
     }
 
-    if (batteryCheck.hasPassed(BATTERY_CHECK_READ_RATE)) {
-        batteryCheck.restart();
-        actionTaken = true;
+    ISREvent interrupt;
+    while (isrEvents.pop(interrupt)) {
+        switch (interrupt.source) {
+            case GPIOInterrupt:
+                read_buttons(interrupt.timestamp);
+                break;
+            case AccelerometerInterrupt:
+                report_motion();
+                break;
+        }
+    }
 
-        report_battery_level();
+    if (isrEventsLost) {
+        // the SX1509 holds its interrupt until it's been read, so if its
+        // event was the one lost, nothing would ever fire again
+        isrEventsLost = false;
+        read_buttons(micros());
     }
+}
 
-    if (accelerometerCheck.hasPassed(ACCELEROMETER_MOTION_READ_RATE)) {
-        accelerometerCheck.restart();
-        actionTaken = true;
 
-        report_motion();
-    }
+// Hand everything the scan task has queued up to the delegate, on the
+// caller's core.
+bool
+ESP32HW::check()
+{
+    bool actionTaken = false;
 
-    if (speedPotReadCheck.hasPassed(SPEED_POT_READ_RATE)) {
-        speedPotReadCheck.restart();
+    HWEvent event;
+    while (events.pop(event)) {
         actionTaken = true;
 
-        read_speed_potentiometer();
-    }
+        if (!delegate) {
+            continue;
+        }
 
-    if (speedCheck.hasPassed(SPEED_POT_REPORT_RATE)) {
-        speedCheck.restart();
-        actionTaken = true;
+        switch (event.type) {
+            case SpeedEvent:
+                delegate->speedChanged(event.extra, event.value, (TogglePosition) event.arg);
+                break;
+            case ToggleEvent:
+                delegate->togglePositionChanged(event.arg, (TogglePosition) event.value);
+                break;
+            case ButtonEvent:
+                delegate->functionButtonChanged(event.arg, event.value ? true : false, event.timestamp);
+                break;
+            case BatteryEvent:
+                delegate->batteryLevelChanged(event.value, event.arg, event.extra);
+                break;
+            case MotionEvent:
+                delegate->throttleMoved(event.value);
+                break;
+            case IdleEvent:
+                delegate->throttleIdle();
+                break;
+            case FallEvent:
+                delegate->throttleFell();
+                break;
+        }
+    }
 
-        report_speed();
+    unsigned dropped = droppedEvents.exchange(0);
+    if (dropped) {
+        console->printf("HW event queue overflowed, %u events dropped\n", dropped);
     }
 
     return actionTaken;
@@ -658,16 +1148,18 @@ ESP32HW::setLight(int light, uint8_t state)
 {
     state = 255 - state;   // the LED is active LOW, so state==0 should be OFF
     if (light == 9) { // corresponds to function number, TODO: fix this
+        I2CLock lock(i2cLock);
         gpio.digitalWrite(LED1, state);
     }
 }
 
 
 void
-ESP32HW::setRGB(int light, uint8_t red, uint8_t green, uint8_t blue)
+ESP32HW::setRGB(int light, uint8_t red, uint8_t green, uint8_t blue, LEDPattern pattern)
 {
     if (light==0) {
-        statusLED.set(red, green, blue);
+        I2CLock lock(i2cLock);
+        statusLED.set(red, green, blue, pattern);
     }
 }
 
@@ -675,9 +1167,13 @@ ESP32HW::setRGB(int light, uint8_t red, uint8_t green, uint8_t blue)
 void
 ESP32HW::triggerHapticMotor(int mode)
 {
-    hapticMotorController.setWaveform(0, mode);
-    hapticMotorController.setWaveform(1, 0);
-    hapticMotorController.go();
+    haptics.request(mode);
+    hapticsRequested = true;
+
+    // the scan task plays it
+    if (scanTask) {
+        xTaskNotifyGive(scanTask);
+    }
 }
 
 
@@ -692,23 +1188,26 @@ ESP32HW::setTimeDisplay(int hour, int minute)
         hour = 12;
     }
 
-    numericDisplay.writeDigitAscii(0, hour >= 10 ? '1' : ' ');
+    display.writeDigitAscii(0, hour >= 10 ? '1' : ' ');
 #else
     if (hour >= 20) {
-        numericDisplay.writeDigitAscii(0, '2');
+        display.writeDigitAscii(0, '2');
     }
     else if (hour >= 10) {
-        numericDisplay.writeDigitAscii(0, '1');
+        display.writeDigitAscii(0, '1');
     }
     else {
-        numericDisplay.writeDigitAscii(0, '0');
+        display.writeDigitAscii(0, '0');
     }
 #endif
-    numericDisplay.writeDigitAscii(1, '0' + (hour % 10), true);
+    display.writeDigitAscii(1, '0' + (hour % 10), true);
+
+    display.writeDigitAscii(2, '0' + (minute / 10));
+    display.writeDigitAscii(3, '0' + (minute % 10));
 
-    numericDisplay.writeDigitAscii(2, '0' + (minute / 10));
-    numericDisplay.writeDigitAscii(3, '0' + (minute % 10));
-    numericDisplay.writeDisplay();
+    // usually only the colon or the last digit has changed (or nothing has)
+    I2CLock lock(i2cLock);
+    display.flush();
 }
 
 
@@ -729,7 +1228,8 @@ ESP32HW::setTimeStatus(TimeStatus status)
     }
 
     //console->printf("clock brightness set to %d\n", brightness);
-    numericDisplay.setBrightness(brightness);
+    I2CLock lock(i2cLock);
+    display.setBrightness(brightness);
 }
 
 
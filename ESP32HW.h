@@ -26,15 +26,95 @@
 #include <Adafruit_GFX.h>
 #include <Adafruit_LEDBackpack.h>
 
-#include <Adafruit_LIS3DH.h>
-#include <Adafruit_Sensor.h>
-
 #include <SparkFunSX1509.h>
 
 #include <Adafruit_DRV2605.h>
 
 #include "PilotLight.h"
 #include "RGBLED.h"
+#include "SpeedSampler.h"
+#include "SpeedEncoder.h"
+#include "SpeedFilter.h"
+#include "SpeedCurve.h"
+#include "BatteryGauge.h"
+#include "SPSCRing.h"
+#include "DisplayFrameBuffer.h"
+#include "HapticSequencer.h"
+#include "MotionDetector.h"
+#include "Scheduler.h"
+
+
+// Smoothing for this board's speed knob, applied to each (already
+// averaged) reading in raw ADC counts before it becomes a speed value.
+//   median of 3 - drops an odd bad reading
+//   EMA 1/2     - takes off the remaining noise
+//   deadband    - 16 counts is about half a speed step, so a knob resting
+//                 between two steps doesn't flicker between them
+typedef FilterPipeline<MedianFilter<3>,
+                       EMAFilter<1>,
+                       DeadbandFilter<16, 0, 4095> > SpeedKnobFilter;
+
+// How many cabs (speed knob and direction toggle) this board has.  The
+// dispatcher's enclosure has 2; see cabInputs in ESP32HW.cpp for the pins.
+#ifndef CAB_COUNT
+#define CAB_COUNT (1)
+#endif
+
+// The speed knob is a potentiometer (0), or a quadrature encoder with a
+// push to stop switch (1).  There are only pins for one encoder.
+#ifndef SPEED_INPUT_ENCODER
+#define SPEED_INPUT_ENCODER (0)
+#endif
+
+#if SPEED_INPUT_ENCODER && CAB_COUNT > 1
+#error "an encoder speed knob is only supported with a single cab"
+#endif
+
+// everything kept for each cab's inputs
+typedef struct CabInputState {
+    SpeedKnobFilter    speedFilter;
+    SpeedCurveTable    speedCurve;
+    TogglePosition     previousTogglePosition;
+    int                previousSpeedValue;
+} CabInputState;
+
+// Input events, queued by the HW scan task and handed to the delegate by
+// check() on the controller's core
+typedef enum HWEventType {
+    SpeedEvent = 0,     // value: speed, arg: toggle position, extra: cab
+    ToggleEvent,        // value: toggle position, arg: cab
+    ButtonEvent,        // value: pressed, arg: function number
+    BatteryEvent,       // value: mV, arg: percent, extra: minutes remaining
+    MotionEvent,        // value: size of the movement (mg)
+    FallEvent,
+    IdleEvent
+} HWEventType;
+
+typedef struct HWEvent {
+    uint8_t  type;      // HWEventType
+    uint8_t  arg;
+    int16_t  value;
+    int16_t  extra;
+    uint32_t timestamp; // micros() when the change happened (or was seen)
+} HWEvent;
+
+#define HW_EVENT_QUEUE_SIZE  (32)
+
+
+// Interrupts, queued by the ISRs for the scan task
+typedef enum ISRSource {
+    GPIOInterrupt = 0,
+    AccelerometerInterrupt
+} ISRSource;
+
+typedef struct ISREvent {
+    uint8_t  source;    // ISRSource
+    uint8_t  level;     // the interrupt pin, for pins that interrupt on CHANGE
+    uint32_t timestamp; // micros() in the ISR
+} ISREvent;
+
+#define ISR_EVENT_QUEUE_SIZE (16)
+
 
 class ESP32HW : public ThrottleHW
 {
@@ -47,7 +127,8 @@ class ESP32HW : public ThrottleHW
 
     void setLight(int light, uint8_t state);  // state: 0=off
 
-    void setRGB(int light, uint8_t red, uint8_t green, uint8_t blue);  // all colors: 0=off, !0=PWM
+    void setRGB(int light, uint8_t red, uint8_t green, uint8_t blue,
+                LEDPattern pattern = LEDSteady);  // all colors: 0=off, !0=PWM
 
     void triggerHapticMotor(int mode);
 
@@ -55,6 +136,12 @@ class ESP32HW : public ThrottleHW
 
     void setTimeStatus(TimeStatus status);
 
+    int cabCount() { return CAB_COUNT; }
+
+    void setSpeedSteps(int cab, int steps);
+
+    void setLowPower(bool lowPower);
+
     void resetStats();
 
     std::string getHWVersion();
@@ -63,16 +150,33 @@ class ESP32HW : public ThrottleHW
 private:
     // HW interfaces
     Adafruit_AlphaNum4 numericDisplay;
-    Adafruit_LIS3DH    accelerometer;
+    DisplayFrameBuffer display;
+    MotionDetector     motion;
     Adafruit_DRV2605   hapticMotorController;
+    HapticSequencer    haptics;
     SX1509             gpio;
 
     PilotLight         pilotLight;
     SX1509RGBLED       statusLED;
+    SpeedSampler       speedSampler;
+#if SPEED_INPUT_ENCODER
+    SpeedEncoder       speedEncoder;
+#endif
+    BatteryGauge       batteryGauge;
 
     // methods
-    void               accelerometer_isr();
-    void               gpio_isr();
+    static void        scan_task(void *arg);
+    void               scan();
+    void               setup_timers();
+    void               start_haptics();
+    void               service_haptics();
+    void               arm_wakeup();
+    void               disarm_wakeup();
+    void               post_event(HWEventType type, int value, int arg = 0, int extra = 0, uint32_t timestamp = 0);
+    void               post_isr_event(ISRSource source, uint8_t level = 0);
+
+    static void        accelerometer_isr(void *arg);
+    static void        gpio_isr(void *arg);
 
     bool               setup_pilot_light();
     bool               setup_gpio();
@@ -80,38 +184,47 @@ private:
     bool               setup_haptic_motor();
     bool               setup_numeric_display();
     bool               setup_speed_direction();
+    bool               setup_battery_gauge();
 
     void               setup_led(int pin);
     void               setup_button(int pin);
 
-    void               read_one_button(int intrStatus, int buttonPin, int funcNum, const char *name);
-    void               read_buttons();
+    uint16_t           read_gpio_inputs();
+    void               read_buttons(uint32_t timestamp);
 
-    TogglePosition     read_toggle_position();
-    void               read_speed_potentiometer();
+    TogglePosition     read_toggle_position(int cab);
     void               report_speed();
+    void               report_cab_speed(int cab, int speedValue);
 
-    int                read_battery_level();
+    void               read_battery_level();
     void               report_battery_level();
     void               report_motion();
+    void               report_idle();
 
     // internal state
-    bool               handle_gpio;
-    bool               handle_accelerometer;
+    SPSCRing<ISREvent, ISR_EVENT_QUEUE_SIZE> isrEvents;
+    volatile bool      isrEventsLost;
 
-    int                accelerometer_value_at_intr;
+    uint16_t           pressedButtons;      // by SX1509 pin, as last reported
 
-    int                speedAccumulator;
-    int                speedCount;
+    bool               moving;
 
-    TogglePosition     previousTogglePosition;
-    int                previousSpeedValue;
-    int                penultimateSpeedValue;
+    CabInputState      cabs[CAB_COUNT];
+
+    // everything periodic in the scan task
+    Scheduler          scheduler;
+    int                idleTimer;
+    int                hapticTimer;
+    bool               hapticsScheduled;
+    volatile bool      hapticsRequested;    // by the controller since the last scan
 
-    // internal timer helpers
-    Chrono             batteryCheck;
-    Chrono             accelerometerCheck;
-    Chrono             speedPotReadCheck;
-    Chrono             speedCheck;
+    // scan task, and what it shares with the controller's core
+    TaskHandle_t       scanTask;
+    SemaphoreHandle_t  i2cLock;
+    SPSCRing<HWEvent, HW_EVENT_QUEUE_SIZE> events;
+    std::atomic<unsigned> droppedEvents;
+    bool               eventsPosted;        // by this scan, only used by the scan task
 
+    bool               lowPower;            // as applied by the scan task
+    volatile bool      lowPowerRequested;
 };
@@ -0,0 +1,309 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "EventJournal.h"
+
+#include "rom/rtc.h"
+
+#include <algorithm>
+
+
+#define JOURNAL_SECTOR_MAGIC   (0x4A544B42)   // "BKTJ"
+
+// events held in RAM between writes (one flash write of this many events)
+#define JOURNAL_BATCH_SIZE     (64)
+
+// write the batch once it's this full, or after this long, whichever is first
+#define JOURNAL_FLUSH_LEVEL    (JOURNAL_BATCH_SIZE / 2)
+#define JOURNAL_FLUSH_INTERVAL (5000)  // ms
+
+#define JOURNAL_TASK_STACK     (3072)
+#define JOURNAL_TASK_PRIORITY  (1)     // just above idle
+
+
+typedef struct __attribute__((packed)) JournalSectorHeader {
+    uint32_t magic;
+    uint32_t sequence;
+} JournalSectorHeader;
+
+
+EventJournal::EventJournal() :
+    partition(NULL),
+    sectorCount(0),
+    headSector(0),
+    headOffset(0),
+    headSequence(0),
+    pending(NULL),
+    pendingCount(0),
+    droppedCount(0),
+    writer(NULL)
+{
+    vPortCPUInitializeMutex(&pendingLock);
+}
+
+
+bool
+EventJournal::begin(Stream *console)
+{
+    this->console = console;
+
+    partition = esp_partition_find_first(ESP_PARTITION_TYPE_DATA, JOURNAL_PARTITION_SUBTYPE,
+                                         JOURNAL_PARTITION_LABEL);
+    if (!partition) {
+        console->println("no journal partition, event journal disabled");
+        return false;
+    }
+
+    sectorCount = partition->size / SPI_FLASH_SEC_SIZE;
+    if (sectorCount < 2) {
+        console->println("journal partition too small");
+        partition = NULL;
+        return false;
+    }
+
+    if (!findHead()) {
+        partition = NULL;
+        return false;
+    }
+
+    pending = new JournalEvent[JOURNAL_BATCH_SIZE];
+
+    xTaskCreate(writerTask, "journal", JOURNAL_TASK_STACK, this, JOURNAL_TASK_PRIORITY, &writer);
+
+    console->printf("event journal: %u sectors, head at sector %u offset %u\n",
+                    sectorCount, headSector, headOffset);
+
+    log(JOURNAL_BOOT, rtc_get_reset_reason(0));
+    return true;
+}
+
+
+// Find the sector with the highest sequence number, and the first unused
+// event slot within it.  A blank journal is started at sector 0.
+bool
+EventJournal::findHead()
+{
+    bool found = false;
+
+    for (size_t sector = 0; sector < sectorCount; sector++) {
+        JournalSectorHeader header;
+
+        if (esp_partition_read(partition, sector * SPI_FLASH_SEC_SIZE, &header, sizeof(header)) != ESP_OK) {
+            return false;
+        }
+        if (header.magic != JOURNAL_SECTOR_MAGIC) {
+            continue;
+        }
+        if (!found || (int32_t) (header.sequence - headSequence) > 0) {
+            headSector = sector;
+            headSequence = header.sequence;
+            found = true;
+        }
+    }
+
+    if (!found) {
+        headSequence = 0;
+        return startSector(0);
+    }
+
+    // an erased slot reads back as all 0xFF
+    size_t base = headSector * SPI_FLASH_SEC_SIZE;
+    headOffset = sizeof(JournalSectorHeader);
+
+    while (headOffset + sizeof(JournalEvent) <= SPI_FLASH_SEC_SIZE) {
+        JournalEvent event;
+        if (esp_partition_read(partition, base + headOffset, &event, sizeof(event)) != ESP_OK) {
+            return false;
+        }
+        if (event.type == 0xFF) {
+            break;
+        }
+        headOffset += sizeof(JournalEvent);
+    }
+
+    return true;
+}
+
+
+// erase a sector and stamp it with the next sequence number
+bool
+EventJournal::startSector(size_t sector)
+{
+    size_t base = sector * SPI_FLASH_SEC_SIZE;
+
+    if (esp_partition_erase_range(partition, base, SPI_FLASH_SEC_SIZE) != ESP_OK) {
+        return false;
+    }
+
+    JournalSectorHeader header;
+    header.magic = JOURNAL_SECTOR_MAGIC;
+    header.sequence = headSequence + 1;
+
+    if (esp_partition_write(partition, base, &header, sizeof(header)) != ESP_OK) {
+        return false;
+    }
+
+    // read() maps offsets from the head, on the BLE task
+    portENTER_CRITICAL(&pendingLock);
+    headSector = sector;
+    headSequence = header.sequence;
+    headOffset = sizeof(header);
+    portEXIT_CRITICAL(&pendingLock);
+
+    return true;
+}
+
+
+void
+EventJournal::log(JournalEventType type, int value, uint8_t arg)
+{
+    if (!partition) {
+        return;
+    }
+
+    JournalEvent event;
+    event.timestamp = millis();
+    event.type = type;
+    event.arg = arg;
+    event.value = constrain(value, INT16_MIN, INT16_MAX);
+
+    bool wakeWriter = false;
+
+    portENTER_CRITICAL(&pendingLock);
+    if (pendingCount < JOURNAL_BATCH_SIZE) {
+        pending[pendingCount++] = event;
+        wakeWriter = (pendingCount == JOURNAL_FLUSH_LEVEL);
+    }
+    else {
+        droppedCount++;
+    }
+    portEXIT_CRITICAL(&pendingLock);
+
+    if (wakeWriter) {
+        xTaskNotifyGive(writer);
+    }
+}
+
+
+void
+EventJournal::flush()
+{
+    if (writer) {
+        xTaskNotifyGive(writer);
+    }
+}
+
+
+void
+EventJournal::writerTask(void *journal)
+{
+    EventJournal *self = (EventJournal *) journal;
+
+    while (true) {
+        ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(JOURNAL_FLUSH_INTERVAL));
+        self->writePending();
+    }
+}
+
+
+// runs on the writer task only
+void
+EventJournal::writePending()
+{
+    JournalEvent batch[JOURNAL_BATCH_SIZE];
+    size_t count;
+    uint32_t dropped;
+
+    portENTER_CRITICAL(&pendingLock);
+    count = pendingCount;
+    memcpy(batch, pending, count * sizeof(JournalEvent));
+    pendingCount = 0;
+    dropped = droppedCount;
+    droppedCount = 0;
+    portEXIT_CRITICAL(&pendingLock);
+
+    if (dropped) {
+        console->printf("journal: %u events dropped\n", dropped);
+    }
+
+    size_t written = 0;
+    while (written < count) {
+        if (headOffset + sizeof(JournalEvent) > SPI_FLASH_SEC_SIZE) {
+            if (!startSector((headSector + 1) % sectorCount)) {
+                console->println("journal: sector erase failed");
+                return;
+            }
+        }
+
+        // as many events as fit in the rest of this sector, in one write
+        size_t room = (SPI_FLASH_SEC_SIZE - headOffset) / sizeof(JournalEvent);
+        size_t chunk = std::min(room, count - written);
+
+        if (esp_partition_write(partition, headSector * SPI_FLASH_SEC_SIZE + headOffset,
+                                &batch[written], chunk * sizeof(JournalEvent)) != ESP_OK) {
+            console->println("journal: write failed");
+            return;
+        }
+
+        portENTER_CRITICAL(&pendingLock);
+        headOffset += chunk * sizeof(JournalEvent);
+        portEXIT_CRITICAL(&pendingLock);
+        written += chunk;
+    }
+}
+
+
+size_t
+EventJournal::size()
+{
+    return partition ? sectorCount * SPI_FLASH_SEC_SIZE : 0;
+}
+
+
+size_t
+EventJournal::read(size_t offset, uint8_t *buffer, size_t length)
+{
+    if (offset >= size()) {
+        return 0;
+    }
+    length = std::min(length, size() - offset);
+
+    // the writer task moves the head; this runs on the BLE task
+    portENTER_CRITICAL(&pendingLock);
+    size_t head = headSector;
+    portEXIT_CRITICAL(&pendingLock);
+
+    // the oldest sector is the one after the head
+    size_t done = 0;
+    while (done < length) {
+        size_t logical = offset + done;
+        size_t sector = (head + 1 + logical / SPI_FLASH_SEC_SIZE) % sectorCount;
+        size_t within = logical % SPI_FLASH_SEC_SIZE;
+        size_t chunk = std::min(length - done, (size_t) SPI_FLASH_SEC_SIZE - within);
+
+        if (esp_partition_read(partition, sector * SPI_FLASH_SEC_SIZE + within, buffer + done, chunk) != ESP_OK) {
+            break;
+        }
+        done += chunk;
+    }
+
+    return done;
+}
@@ -0,0 +1,124 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include "Arduino.h"
+
+#include "esp_partition.h"
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/task.h>
+
+
+// The journal lives in its own data partition (see partitions.csv)
+#define JOURNAL_PARTITION_LABEL    "journal"
+#define JOURNAL_PARTITION_SUBTYPE  ((esp_partition_subtype_t) 0x40)
+
+
+typedef enum JournalEventType {
+    JOURNAL_BOOT = 0,           // value: reset reason
+    JOURNAL_STATE,              // value: ThrottleState
+    JOURNAL_WIFI_CONNECTED,     // value: RSSI
+    JOURNAL_WIFI_DISCONNECTED,
+    JOURNAL_SERVER_CONNECTED,
+    JOURNAL_SERVER_DISCONNECTED,
+    JOURNAL_SPEED,              // value: speed sent, arg: cab
+    JOURNAL_DIRECTION,          // value: Direction sent, arg: cab
+    JOURNAL_BUTTON,             // arg: function number, value: pressed
+    JOURNAL_BATTERY,            // value: battery mV, arg: percent
+    JOURNAL_BUTTON_LATENCY,     // arg: function number, value: interrupt to command sent, in 0.1 ms
+    JOURNAL_MOTION,             // value: size of the movement (mg)
+    JOURNAL_FELL,
+    JOURNAL_IDLE,
+    JOURNAL_WAKE_LATENCY,       // value: from the interrupt of the input that woke us to its command being sent, in 0.1 ms
+    JOURNAL_CONNECTION,         // arg: ConnectionState left, value: time spent in it, in 10 ms
+    JOURNAL_FIRST_SPEED,        // arg: 0 after power on, 1 after losing the connection; value: time to the first speed sent, in 10 ms
+} JournalEventType;
+
+
+// one journal entry, exactly as it is stored in flash
+typedef struct __attribute__((packed)) JournalEvent {
+    uint32_t timestamp;         // millis() when logged
+    uint8_t  type;              // JournalEventType, 0xFF for an unwritten slot
+    uint8_t  arg;
+    int16_t  value;
+} JournalEvent;
+
+
+// A fixed size ring of binary events in flash, for working out what a
+// throttle was doing after the fact.
+//
+// The partition is a ring of flash sectors, each starting with a header
+// carrying an ever increasing sequence number, so the newest sector (and
+// therefore where to carry on writing) can be found at boot.  Sectors are
+// filled in order and only erased when the ring wraps back round to them,
+// which spreads wear evenly over the whole partition.
+//
+// log() only copies the event into RAM.  A low priority task writes the
+// buffered events out in batches, so the main loop no longer blocks on
+// the flash calls themselves.  It still stalls while they run, though:
+// erasing and writing flash disable the cache on both cores, so anything
+// not in IRAM waits too.  The worst case is a sector erase as the ring
+// moves on (tens of ms typically, a few hundred at the flash chip's
+// limit); writing a batch of at most 64 events (512 bytes) takes a few ms.
+class EventJournal
+{
+  public:
+    EventJournal();
+
+    bool begin(Stream *console);
+
+    // safe to call from any task (but not from an ISR)
+    void log(JournalEventType type, int value = 0, uint8_t arg = 0);
+
+    // ask for the buffered events to be written out now
+    void flush();
+
+    // the journal's flash contents, oldest sector first, as a flat byte
+    // range that can be read in chunks
+    size_t size();
+    size_t read(size_t offset, uint8_t *buffer, size_t length);
+
+  private:
+    static void writerTask(void *journal);
+
+    bool findHead();
+    void writePending();
+    bool startSector(size_t sector);
+
+    const esp_partition_t *partition;
+    size_t             sectorCount;
+    size_t             headSector;       // sector currently being filled
+    size_t             headOffset;       // next free byte within it
+    uint32_t           headSequence;
+
+    JournalEvent       *pending;         // RAM batch awaiting the writer task
+    size_t             pendingCount;
+    uint32_t           droppedCount;     // events lost because the batch was full
+    portMUX_TYPE       pendingLock;      // over the batch, and the head (for read())
+
+    TaskHandle_t       writer;
+
+    Stream             *console;
+};
@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "HapticSequencer.h"
+
+#include <Wire.h>
+
+
+// DRV2605 registers
+#define DRV2605_REG_WAVESEQ1     (0x04)   // through WAVESEQ8 at 0x0B
+#define DRV2605_REG_GO           (0x0C)
+
+// The library effects run from about 10 ms to a bit over a second, most of
+// the short clicks and ticks being under 100 ms.  Nothing is read from the
+// chip until this much time per effect has passed, and after that the GO
+// bit is polled (it clears itself when the sequence ends).
+#define HAPTIC_EFFECT_ESTIMATE   (60)     // ms
+
+
+HapticSequencer::HapticSequencer(uint8_t address) :
+    address(address),
+    queued(0),
+    nextOrder(0),
+    playing(false),
+    expectedEnd(0),
+    lastPoll(0)
+{
+    vPortCPUInitializeMutex(&queueLock);
+}
+
+
+void
+HapticSequencer::request(uint8_t effect, HapticPriority priority)
+{
+    if (effect == 0) {
+        return;  // 0 ends a sequence, it isn't an effect
+    }
+
+    portENTER_CRITICAL(&queueLock);
+
+    int lowest = -1;
+    for (int i = 0; i < queued; i++) {
+        if (queue[i].effect == effect) {
+            // already waiting, it just may matter more now
+            if (priority > queue[i].priority) {
+                queue[i].priority = priority;
+            }
+            portEXIT_CRITICAL(&queueLock);
+            return;
+        }
+        if (lowest < 0 || queue[i].priority < queue[lowest].priority
+            || (queue[i].priority == queue[lowest].priority && int16_t(queue[i].order - queue[lowest].order) > 0)) {
+            lowest = i;
+        }
+    }
+
+    int slot = queued;
+    if (queued == HAPTIC_QUEUE_SIZE) {
+        // full: only something more important (bumping the newest of the
+        // least important) gets in
+        slot = (priority > queue[lowest].priority) ? lowest : -1;
+    }
+    else {
+        queued++;
+    }
+
+    if (slot >= 0) {
+        queue[slot].effect   = effect;
+        queue[slot].priority = priority;
+        queue[slot].order    = nextOrder++;
+    }
+
+    portEXIT_CRITICAL(&queueLock);
+}
+
+
+bool
+HapticSequencer::isPlaying(unsigned long now)
+{
+    if (!playing) {
+        return false;
+    }
+
+    if (long(now - expectedEnd) < 0 || now - lastPoll < HAPTIC_POLL_INTERVAL) {
+        return true;
+    }
+    lastPoll = now;
+
+    Wire.beginTransmission(address);
+    Wire.write(DRV2605_REG_GO);
+    if (Wire.endTransmission(false) != 0 || Wire.requestFrom(address, (uint8_t) 1) != 1) {
+        // can't tell, so assume it's done rather than going silent
+        playing = false;
+        return false;
+    }
+
+    playing = Wire.read() & 0x01;
+    return playing;
+}
+
+
+bool
+HapticSequencer::play(const uint8_t *effects, int count)
+{
+    // all eight slots and GO in one transaction: the sequence ends at the
+    // first 0, and GO follows WAVESEQ8
+    Wire.beginTransmission(address);
+    Wire.write(DRV2605_REG_WAVESEQ1);
+    for (int i = 0; i < HAPTIC_QUEUE_SIZE; i++) {
+        Wire.write(i < count ? effects[i] : 0);
+    }
+    Wire.write(0x01);
+    return Wire.endTransmission() == 0;
+}
+
+
+void
+HapticSequencer::check()
+{
+    unsigned long now = millis();
+
+    // keep polling until the motor stops, even with nothing waiting, so
+    // busy() goes false again
+    if (isPlaying(now)) {
+        return;
+    }
+
+    if (!queued) {
+        // (read without the lock; a stale value only means waiting a scan)
+        return;
+    }
+
+    uint8_t effects[HAPTIC_QUEUE_SIZE];
+    int count = 0;
+
+    portENTER_CRITICAL(&queueLock);
+
+    // highest priority first, and oldest first within a priority
+    while (queued) {
+        int next = 0;
+        for (int i = 1; i < queued; i++) {
+            if (queue[i].priority > queue[next].priority
+                || (queue[i].priority == queue[next].priority && int16_t(queue[i].order - queue[next].order) < 0)) {
+                next = i;
+            }
+        }
+        effects[count++] = queue[next].effect;
+        queue[next] = queue[--queued];
+    }
+
+    portEXIT_CRITICAL(&queueLock);
+
+    playing = play(effects, count);
+    expectedEnd = now + count * HAPTIC_EFFECT_ESTIMATE;
+    lastPoll = now;
+}
@@ -0,0 +1,85 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include "Arduino.h"
+
+
+// Plays DRV2605 library effects without ever waiting on the motor.
+//
+// request() only queues the effect (it's safe from any task, and never
+// touches I2C).  check(), called regularly from the HW scan task, starts
+// the next sequence once the previous one has finished: up to 8 queued
+// effects, highest priority first, are loaded into the DRV2605's eight
+// waveform slots and fired with a single I2C transaction.  An effect
+// that's already waiting isn't queued twice.
+//
+// The caller is responsible for holding the I2C bus around check().
+
+#define HAPTIC_QUEUE_SIZE        (8)     // the DRV2605 has 8 waveform slots
+
+// how often check() needs calling while busy()
+#define HAPTIC_POLL_INTERVAL     (10)    // ms
+
+typedef enum HapticPriority {
+    HapticLow = 0,
+    HapticNormal,
+    HapticHigh
+} HapticPriority;
+
+
+class HapticSequencer
+{
+  public:
+    HapticSequencer(uint8_t address);
+
+    void request(uint8_t effect, HapticPriority priority = HapticNormal);
+
+    // start the next sequence if the motor is free
+    void check();
+
+    // something is playing or waiting to
+    bool busy() { return queued || playing; }
+
+  private:
+    bool isPlaying(unsigned long now);
+    bool play(const uint8_t *effects, int count);
+
+    typedef struct QueuedEffect {
+        uint8_t  effect;
+        uint8_t  priority;
+        uint16_t order;       // to keep equal priorities first come, first played
+    } QueuedEffect;
+
+    uint8_t       address;
+
+    portMUX_TYPE  queueLock;
+    QueuedEffect  queue[HAPTIC_QUEUE_SIZE];
+    volatile int  queued;
+    uint16_t      nextOrder;
+
+    bool          playing;
+    unsigned long expectedEnd;    // millis() when the sequence should be done
+    unsigned long lastPoll;
+};
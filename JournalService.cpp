@@ -0,0 +1,108 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "JournalService.h"
+
+#include <algorithm>
+
+// the largest value a BLE attribute can hold
+#define JOURNAL_CHUNK_SIZE (512)
+
+
+JournalService::JournalService(EventJournal& journal) :
+    journal(journal),
+    readOffset(0)
+{
+}
+
+
+void
+JournalService::begin(BLEServer *bleServer, Stream *console)
+{
+    this->console = console;
+
+    if (bleServer) {
+        journalService = bleServer->createService(JOURNAL_SERVICE_UUID);
+
+        if (journalService) {
+            dataCharacteristic = journalService->createCharacteristic(JOURNAL_DATA_CHARACTERISTIC_UUID,
+                                                                      BLECharacteristic::PROPERTY_READ);
+            dataCharacteristic->setCallbacks(this);
+
+            offsetCharacteristic = journalService->createCharacteristic(JOURNAL_OFFSET_CHARACTERISTIC_UUID,
+                                                                        BLECharacteristic::PROPERTY_READ
+                                                                        | BLECharacteristic::PROPERTY_WRITE);
+            offsetCharacteristic->setCallbacks(this);
+
+            sizeCharacteristic = journalService->createCharacteristic(JOURNAL_SIZE_CHARACTERISTIC_UUID,
+                                                                      BLECharacteristic::PROPERTY_READ);
+            sizeCharacteristic->setCallbacks(this);
+
+            journalService->start();
+        }
+        console->println("journal service started");
+    }
+}
+
+
+void
+JournalService::onWrite(BLECharacteristic *characteristic)
+{
+    if (!characteristic) {
+        return;
+    }
+
+    if (characteristic->getUUID().equals(BLEUUID(JOURNAL_OFFSET_CHARACTERISTIC_UUID))) {
+        std::string value = characteristic->getValue();
+        uint32_t offset = 0;
+
+        memcpy(&offset, value.data(), std::min(value.size(), sizeof(offset)));
+        readOffset = offset;
+
+        // get whatever is still buffered into flash before it's read
+        journal.flush();
+        console->printf("journal read offset set to %u\n", readOffset);
+    }
+}
+
+
+void
+JournalService::onRead(BLECharacteristic *characteristic)
+{
+    if (!characteristic) {
+        return;
+    }
+
+    if (characteristic->getUUID().equals(BLEUUID(JOURNAL_DATA_CHARACTERISTIC_UUID))) {
+        uint8_t chunk[JOURNAL_CHUNK_SIZE];
+        size_t count = journal.read(readOffset, chunk, sizeof(chunk));
+
+        characteristic->setValue(chunk, count);
+        readOffset += count;
+    }
+    else if (characteristic->getUUID().equals(BLEUUID(JOURNAL_OFFSET_CHARACTERISTIC_UUID))) {
+        characteristic->setValue((uint8_t *) &readOffset, sizeof(readOffset));
+    }
+    else if (characteristic->getUUID().equals(BLEUUID(JOURNAL_SIZE_CHARACTERISTIC_UUID))) {
+        uint32_t size = journal.size();
+        characteristic->setValue((uint8_t *) &size, sizeof(size));
+    }
+}
@@ -0,0 +1,65 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include "Arduino.h"
+
+#include <BLEDevice.h>
+#include <BLEUtils.h>
+#include <BLEServer.h>
+
+#include "EventJournal.h"
+
+
+#define JOURNAL_SERVICE_UUID                 "426c7565-3800-4688-b7f5-4b646f626279"
+#define JOURNAL_DATA_CHARACTERISTIC_UUID     "426c7565-38e1-4688-b7f5-4b646f626279"
+#define JOURNAL_OFFSET_CHARACTERISTIC_UUID   "426c7565-38e2-4688-b7f5-4b646f626279"
+#define JOURNAL_SIZE_CHARACTERISTIC_UUID     "426c7565-38e3-4688-b7f5-4b646f626279"
+
+
+// Bulk read access to the EventJournal.  Write a byte offset (uint32, little
+// endian; normally 0) to the offset characteristic, then read the data
+// characteristic repeatedly: each read returns the next chunk of the
+// journal, oldest first, until an empty value marks the end.
+class JournalService :
+    public BLECharacteristicCallbacks
+{
+  public:
+    JournalService(EventJournal& journal);
+    void begin(BLEServer *bleServer, Stream *console);
+
+    void onWrite(BLECharacteristic *characteristic);
+    void onRead(BLECharacteristic *characteristic);
+
+  private:
+    EventJournal& journal;
+    uint32_t readOffset;
+
+    BLEService *journalService;
+    BLECharacteristic *dataCharacteristic;
+    BLECharacteristic *offsetCharacteristic;
+    BLECharacteristic *sizeCharacteristic;
+
+    Stream *console;
+};
@@ -0,0 +1,218 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "MotionDetector.h"
+
+#include <Wire.h>
+
+
+// LIS3DH registers
+#define LIS3DH_REG_WHO_AM_I      (0x0F)
+#define LIS3DH_REG_CTRL1         (0x20)
+#define LIS3DH_REG_CTRL2         (0x21)
+#define LIS3DH_REG_CTRL3         (0x22)
+#define LIS3DH_REG_CTRL4         (0x23)
+#define LIS3DH_REG_CTRL5         (0x24)
+#define LIS3DH_REG_CTRL6         (0x25)
+#define LIS3DH_REG_REFERENCE     (0x26)
+#define LIS3DH_REG_OUT_X_L       (0x28)
+#define LIS3DH_REG_FIFO_CTRL     (0x2E)
+#define LIS3DH_REG_FIFO_SRC      (0x2F)
+#define LIS3DH_REG_INT1_CFG      (0x30)
+#define LIS3DH_REG_INT1_SRC      (0x31)
+#define LIS3DH_REG_INT1_THS      (0x32)
+#define LIS3DH_REG_INT1_DURATION (0x33)
+#define LIS3DH_REG_INT2_CFG      (0x34)
+#define LIS3DH_REG_INT2_SRC      (0x35)
+#define LIS3DH_REG_INT2_THS      (0x36)
+#define LIS3DH_REG_INT2_DURATION (0x37)
+#define LIS3DH_REG_ACT_THS       (0x3E)
+#define LIS3DH_REG_ACT_DUR       (0x3F)
+
+#define LIS3DH_WHO_AM_I          (0x33)
+#define LIS3DH_AUTO_INCREMENT    (0x80)   // or'd into a register address
+#define LIS3DH_INT_ACTIVE        (0x40)   // IA bit in INT1_SRC/INT2_SRC
+#define LIS3DH_FIFO_DEPTH        (32)
+
+// The settings below assume this data rate and range:
+//   50 Hz, all axes, normal mode
+//   +/- 4g, block data update, so 1 threshold LSB is 32 mg
+#define MOTION_CTRL1             (0x47)
+#define MOTION_CTRL4             (0x90)
+#define MOTION_MG_PER_LSB        (32)
+#define MOTION_SAMPLE_MS         (20)
+
+// free-fall: every axis under 350 mg for at least 100 ms (a throttle
+// falling off a layout edge is in the air for about 250 ms)
+#define FREE_FALL_THRESHOLD      (350 / MOTION_MG_PER_LSB)
+#define FREE_FALL_DURATION       (100 / MOTION_SAMPLE_MS)
+
+// motion: any axis changing by more than 100 mg (picking it up, not the
+// layout shaking because a train went by)
+#define MOTION_THRESHOLD         (100 / MOTION_MG_PER_LSB)
+
+// sleep-to-wake: after 10 s of nothing over 100 mg, the chip drops to its
+// low power rate on its own until it moves again
+#define INACTIVE_THRESHOLD       (100 / MOTION_MG_PER_LSB)
+#define INACTIVE_DURATION        ((10 * 1000 / MOTION_SAMPLE_MS - 1) / 8)   // ACT_DUR is in 8/ODR
+
+
+MotionDetector::MotionDetector(uint8_t address) :
+    address(address)
+{
+}
+
+
+bool
+MotionDetector::writeRegister(uint8_t reg, uint8_t value)
+{
+    Wire.beginTransmission(address);
+    Wire.write(reg);
+    Wire.write(value);
+    return Wire.endTransmission() == 0;
+}
+
+
+int
+MotionDetector::readRegister(uint8_t reg)
+{
+    Wire.beginTransmission(address);
+    Wire.write(reg);
+    if (Wire.endTransmission(false) != 0 || Wire.requestFrom(address, (uint8_t) 1) != 1) {
+        return -1;
+    }
+    return Wire.read();
+}
+
+
+bool
+MotionDetector::begin()
+{
+    if (readRegister(LIS3DH_REG_WHO_AM_I) != LIS3DH_WHO_AM_I) {
+        return false;
+    }
+
+    bool ok = true;
+
+    ok &= writeRegister(LIS3DH_REG_CTRL1, MOTION_CTRL1);
+    ok &= writeRegister(LIS3DH_REG_CTRL2, 0x82);               // high-pass (normal mode) on IA2 only
+    ok &= writeRegister(LIS3DH_REG_CTRL4, MOTION_CTRL4);
+    ok &= writeRegister(LIS3DH_REG_CTRL5, 0x4A);               // FIFO on, latch IA1 and IA2
+    ok &= writeRegister(LIS3DH_REG_CTRL6, 0x00);
+
+    // the FIFO has to pass through bypass to be (re)started in stream mode
+    ok &= writeRegister(LIS3DH_REG_FIFO_CTRL, 0x00);
+    ok &= writeRegister(LIS3DH_REG_FIFO_CTRL, 0x80);           // stream
+
+    ok &= writeRegister(LIS3DH_REG_INT1_THS, FREE_FALL_THRESHOLD);
+    ok &= writeRegister(LIS3DH_REG_INT1_DURATION, FREE_FALL_DURATION);
+    ok &= writeRegister(LIS3DH_REG_INT1_CFG, 0x95);            // AND of X, Y and Z low
+
+    ok &= writeRegister(LIS3DH_REG_INT2_THS, MOTION_THRESHOLD);
+    ok &= writeRegister(LIS3DH_REG_INT2_DURATION, 0);
+    ok &= writeRegister(LIS3DH_REG_INT2_CFG, 0x2A);            // OR of X, Y and Z high
+
+    ok &= writeRegister(LIS3DH_REG_ACT_THS, INACTIVE_THRESHOLD);
+    ok &= writeRegister(LIS3DH_REG_ACT_DUR, INACTIVE_DURATION);
+
+    // reset the high-pass filter to where it is now, and clear anything
+    // that latched while all this was being set up
+    readRegister(LIS3DH_REG_REFERENCE);
+    readRegister(LIS3DH_REG_INT1_SRC);
+    readRegister(LIS3DH_REG_INT2_SRC);
+
+    ok &= writeRegister(LIS3DH_REG_CTRL3, 0x60);               // IA1 and IA2 to the INT1 pin
+
+    return ok;
+}
+
+
+// Read everything in the FIFO in one burst, and return the largest
+// sample-to-sample change on any axis, in mg.
+int
+MotionDetector::readFIFO()
+{
+    int fifoSource = readRegister(LIS3DH_REG_FIFO_SRC);
+    if (fifoSource < 0) {
+        return 0;
+    }
+
+    int samples = fifoSource & 0x1F;
+    if (fifoSource & 0x40) {   // overrun: it's full
+        samples = LIS3DH_FIFO_DEPTH;
+    }
+    if (samples < 2) {
+        return 0;
+    }
+
+    // With the FIFO on, a burst read from OUT_X_L wraps around the six
+    // output registers, taking the next sample each time.  The ESP32 Wire
+    // buffer won't hold the whole FIFO, so it's read in a few bursts.
+    int16_t previous[3] = { 0, 0, 0 };
+    int largest = 0;
+    int sample = 0;
+
+    while (sample < samples) {
+        int batch = min(samples - sample, 16);
+
+        Wire.beginTransmission(address);
+        Wire.write(LIS3DH_REG_OUT_X_L | LIS3DH_AUTO_INCREMENT);
+        if (Wire.endTransmission(false) != 0
+            || Wire.requestFrom(address, (uint8_t) (batch * 6)) != batch * 6) {
+            break;
+        }
+
+        for (int i = 0; i < batch; i++, sample++) {
+            for (int axis = 0; axis < 3; axis++) {
+                // left justified 10 bit data, 8 mg/LSB at +/- 4g
+                int16_t value = int16_t(Wire.read() | (Wire.read() << 8)) >> 6;
+                if (sample > 0) {
+                    largest = max(largest, abs(value - previous[axis]) * 8);
+                }
+                previous[axis] = value;
+            }
+        }
+    }
+
+    return largest;
+}
+
+
+MotionResult
+MotionDetector::check(int *magnitude)
+{
+    // reading the sources is what clears the latches
+    int freeFall = readRegister(LIS3DH_REG_INT1_SRC);
+    int motion = readRegister(LIS3DH_REG_INT2_SRC);
+
+    if (freeFall > 0 && (freeFall & LIS3DH_INT_ACTIVE)) {
+        return Fell;
+    }
+
+    if (motion > 0 && (motion & LIS3DH_INT_ACTIVE)) {
+        if (magnitude) {
+            *magnitude = readFIFO();
+        }
+        return Moved;
+    }
+
+    return NoMotion;
+}
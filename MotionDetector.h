@@ -0,0 +1,68 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include "Arduino.h"
+
+
+// On-chip motion and free-fall detection with the LIS3DH.
+//
+// The chip does all of the watching, and only interrupts (on INT1) when
+// something happens:
+//   IA1 - free-fall: all three axes below a low threshold together
+//   IA2 - motion: any axis of the high-passed signal above a threshold
+// Both are latched, so a short event can't be missed, and are cleared by
+// check().  Samples collect in the FIFO (stream mode), and are read in a
+// single burst when motion is reported, to give its size.  The chip's own
+// activity/inactivity function drops it to a low data rate while it's
+// left alone, and brings it back as soon as it moves.
+//
+// Nothing is read from the chip unless INT1 has fired.  The caller is
+// responsible for holding the I2C bus around begin() and check().
+
+typedef enum MotionResult {
+    NoMotion = 0,
+    Moved,
+    Fell
+} MotionResult;
+
+
+class MotionDetector
+{
+  public:
+    MotionDetector(uint8_t address);
+
+    bool begin();
+
+    // call after INT1 fires: work out why, and clear the latched interrupts
+    //   magnitude: the largest acceleration change (mg) in the FIFO, for Moved
+    MotionResult check(int *magnitude);
+
+  private:
+    bool    writeRegister(uint8_t reg, uint8_t value);
+    int     readRegister(uint8_t reg);
+    int     readFIFO();
+
+    uint8_t address;
+};
@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "MultiThrottleConnection.h"
+
+// the server's replies for one multi-throttle start "M<id>"
+#define isMultiThrottleLine(line) ((line).size() >= 2 && (line)[0] == 'M')
+
+
+CabStream::CabStream() :
+    connection(NULL),
+    id('T'),
+    input(),
+    inputRead(0),
+    line()
+{
+}
+
+
+int
+CabStream::available()
+{
+    return input.size() - inputRead;
+}
+
+
+int
+CabStream::read()
+{
+    if (inputRead >= input.size()) {
+        return -1;
+    }
+
+    int c = (uint8_t) input[inputRead++];
+    if (inputRead == input.size()) {
+        input.clear();
+        inputRead = 0;
+    }
+    return c;
+}
+
+
+int
+CabStream::peek()
+{
+    if (inputRead >= input.size()) {
+        return -1;
+    }
+    return (uint8_t) input[inputRead];
+}
+
+
+// Commands are queued a line at a time, so the ID can be put in place
+size_t
+CabStream::write(uint8_t c)
+{
+    line += (char) c;
+
+    if (c == '\n') {
+        if (isMultiThrottleLine(line) && line[1] == 'T') {
+            line[1] = id;
+        }
+        if (connection) {
+            connection->queue(line);
+        }
+        line.clear();
+    }
+
+    return 1;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+MultiThrottleConnection::MultiThrottleConnection() :
+    client(NULL),
+    cabs(),
+    cabCount(1),
+    incoming(),
+    outgoing(),
+    console(NULL),
+    listener(NULL)
+{
+}
+
+
+void
+MultiThrottleConnection::begin(int cabCount, Stream *console, ServerLineListener *listener)
+{
+    this->console = console;
+    this->listener = listener;
+    this->cabCount = constrain(cabCount, 1, min(MAX_CABS, (int) strlen(MULTI_THROTTLE_IDS)));
+
+    for (int cab = 0; cab < this->cabCount; cab++) {
+        cabs[cab].connection = this;
+        cabs[cab].id = MULTI_THROTTLE_IDS[cab];
+    }
+}
+
+
+void
+MultiThrottleConnection::connect(Client *client)
+{
+    this->client = client;
+
+    incoming.clear();
+    outgoing.clear();
+    for (int cab = 0; cab < cabCount; cab++) {
+        cabs[cab].input.clear();
+        cabs[cab].inputRead = 0;
+        cabs[cab].line.clear();
+    }
+}
+
+
+void
+MultiThrottleConnection::disconnect()
+{
+    connect(NULL);
+}
+
+
+void
+MultiThrottleConnection::receive()
+{
+    if (!client) {
+        return;
+    }
+
+    uint8_t buffer[128];
+    int available;
+    while ((available = client->available()) > 0) {
+        int count = client->read(buffer, min(available, (int) sizeof(buffer)));
+        if (count <= 0) {
+            break;
+        }
+
+        for (int i = 0; i < count; i++) {
+            incoming += (char) buffer[i];
+            if (buffer[i] == '\n') {
+                route(incoming);
+                incoming.clear();
+            }
+        }
+    }
+}
+
+
+void
+MultiThrottleConnection::route(std::string& line)
+{
+    if (!isMultiThrottleLine(line)) {
+        cabs[0].input += line;
+        if (listener) {
+            listener->serverLine(0, line);
+        }
+        return;
+    }
+
+    for (int cab = 0; cab < cabCount; cab++) {
+        if (line[1] == cabs[cab].id) {
+            line[1] = 'T';
+            cabs[cab].input += line;
+            if (listener) {
+                listener->serverLine(cab, line);
+            }
+            return;
+        }
+    }
+
+    // for a multi-throttle that isn't ours: drop it
+}
+
+
+void
+MultiThrottleConnection::queue(const std::string& line)
+{
+    outgoing += line;
+
+    if (outgoing.size() >= MULTI_THROTTLE_MAX_QUEUED) {
+        send();
+    }
+}
+
+
+size_t
+MultiThrottleConnection::send()
+{
+    if (outgoing.empty()) {
+        return 0;
+    }
+
+    size_t written = 0;
+    if (client && client->connected()) {
+        written = client->write((const uint8_t *) outgoing.data(), outgoing.size());
+        if (written != outgoing.size() && console) {
+            console->printf("connection: only %u of %u bytes sent\n", written, outgoing.size());
+        }
+    }
+
+    outgoing.clear();
+    return written;
+}
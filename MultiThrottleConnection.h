@@ -0,0 +1,120 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include <string>
+
+#include "Arduino.h"
+#include "Client.h"
+
+#include "ThrottleHW.h"
+
+
+// The multi-throttle ID each cab's commands are sent under.  Cab 0 keeps
+// the 'T' that the WiThrottle library always writes, so a single cab
+// throttle looks just as it always has to the server.
+#define MULTI_THROTTLE_IDS       "TS"
+
+// send early if this much is queued, rather than growing without bound
+#define MULTI_THROTTLE_MAX_QUEUED (1460)   // one TCP segment
+
+
+class MultiThrottleConnection;
+
+
+// Sees each line from the server once it has been routed to a cab, for
+// what the WiThrottle library doesn't report (the roster, function labels)
+class ServerLineListener
+{
+  public:
+    virtual void serverLine(int cab, const std::string& line) = 0;
+};
+
+
+// What one cab's WiThrottle instance sees as its connection to the server
+class CabStream : public Stream
+{
+  public:
+    CabStream();
+
+    int available();
+    int read();
+    int peek();
+    void flush() { }     // output is sent by MultiThrottleConnection::send()
+    size_t write(uint8_t c);
+    using Print::write;
+
+  private:
+    friend class MultiThrottleConnection;
+
+    MultiThrottleConnection *connection;
+    char                     id;
+    std::string              input;      // from the server, for this cab
+    size_t                   inputRead;
+    std::string              line;       // being written, up to its newline
+};
+
+
+// One TCP connection to the WiThrottle server, shared by a WiThrottle
+// protocol instance for each cab.  Each cab's commands go out under its
+// own multi-throttle ID, and whatever the server sends for that ID comes
+// back to it (with the ID put back to 'T').  Everything else the server
+// sends (fast time, roster, track power, ...) goes to cab 0.
+//
+// Output from all of the cabs is queued, and written to the connection
+// all at once by send(): call it once per pass through the loop.
+class MultiThrottleConnection
+{
+  public:
+    MultiThrottleConnection();
+
+    void begin(int cabCount, Stream *console, ServerLineListener *listener = NULL);
+
+    // start (or stop) using a connected client; anything queued is dropped
+    void connect(Client *client);
+    void disconnect();
+
+    Stream *stream(int cab) { return &cabs[cab]; }
+
+    // read everything the server has sent, and hand it to the cabs
+    void receive();
+
+    // write everything the cabs have queued, in one go
+    //   return the number of bytes written
+    size_t send();
+
+  private:
+    friend class CabStream;
+
+    void queue(const std::string& line);
+    void route(std::string& line);
+
+    Client      *client;
+    CabStream   cabs[MAX_CABS];
+    int         cabCount;
+    std::string incoming;          // a partial line from the server
+    std::string outgoing;
+    Stream      *console;
+    ServerLineListener *listener;
+};
@@ -24,42 +24,36 @@
 
 #include "Arduino.h"
 
-#include <Chrono.h>
-
-#define PILOT_LIGHT_BLINK_TIME (1000)
+// The pilot light is blinked by an LEDC channel: a 0.5 Hz square wave,
+// so it's on for a second, off for a second, with no software involved.
+//
+// The LEDC timer runs from REF_TICK at this rate, so CPU frequency
+// changes don't affect it (the light holds its state through light sleep).
+#define PILOT_LIGHT_BLINK_TIME (1000)   // ms on, and then off
+#define PILOT_LIGHT_FREQUENCY  (1000.0 / (2 * PILOT_LIGHT_BLINK_TIME))   // Hz
+#define PILOT_LIGHT_RESOLUTION (13)     // bits
 
 class PilotLight
 {
   public:
     PilotLight():
         pin(-1),
-        timer()
+        channel(-1)
     {
     }
 
     void
-    begin(int pin)
+    begin(int pin, int channel)
     {
         this->pin = pin;
-        pinMode(pin, OUTPUT);
-        digitalWrite(pin, 1);  // turn off the light at the start
-    }
-
-    bool check()
-    {
-        if (timer.hasPassed(PILOT_LIGHT_BLINK_TIME)) {
-            timer.restart();
-
-            int state = digitalRead(pin);
-            state = !state;
-            digitalWrite(pin, state);
+        this->channel = channel;
 
-            return true;
-        }
-        return false;
+        ledcSetup(channel, PILOT_LIGHT_FREQUENCY, PILOT_LIGHT_RESOLUTION);
+        ledcAttachPin(pin, channel);
+        ledcWrite(channel, 1 << (PILOT_LIGHT_RESOLUTION - 1));   // 50%
     }
 
   private:
     int pin;
-    Chrono timer;
+    int channel;
 };
@@ -0,0 +1,155 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "PowerGovernor.h"
+
+
+PowerGovernor::PowerGovernor() :
+    task(NULL),
+    idle(false),
+    lastActivity(0),
+    wakePending(false),
+#if CONFIG_PM_ENABLE
+    cpuLock(NULL),
+#endif
+    console(NULL)
+{
+}
+
+
+void
+PowerGovernor::begin(Stream *console)
+{
+    this->console = console;
+
+    task = xTaskGetCurrentTaskHandle();
+    lastActivity = millis();
+
+#if CONFIG_PM_ENABLE
+    esp_pm_config_esp32_t config;
+    config.max_freq_mhz       = POWER_ACTIVE_MHZ;
+    config.min_freq_mhz       = POWER_IDLE_MHZ;
+    config.light_sleep_enable = true;
+
+    esp_err_t rv = esp_pm_configure(&config);
+    if (rv == ESP_OK) {
+        esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, "throttle", &cpuLock);
+        esp_pm_lock_acquire(cpuLock);
+        console->println("power: automatic light sleep when idle");
+    }
+    else {
+        console->printf("power: esp_pm_configure failed (%d)\n", rv);
+    }
+#else
+    console->println("power: clock scaling when idle (no light sleep in this core)");
+#endif
+}
+
+
+void
+PowerGovernor::signal()
+{
+    if (task) {
+        xTaskNotifyGive(task);
+    }
+}
+
+
+void
+PowerGovernor::activity()
+{
+    lastActivity = millis();
+
+    if (idle) {
+        signal();   // so the clock is back up before anything is sent
+    }
+}
+
+
+void
+PowerGovernor::enterIdle()
+{
+#if CONFIG_PM_ENABLE
+    if (cpuLock) {
+        esp_pm_lock_release(cpuLock);
+    }
+#else
+    setCpuFrequencyMhz(POWER_IDLE_MHZ);
+#endif
+    idle = true;
+    console->println("power: idle");
+}
+
+
+void
+PowerGovernor::exitIdle()
+{
+    wakePending = true;
+
+#if CONFIG_PM_ENABLE
+    if (cpuLock) {
+        esp_pm_lock_acquire(cpuLock);
+    }
+#else
+    setCpuFrequencyMhz(POWER_ACTIVE_MHZ);
+#endif
+    idle = false;
+}
+
+
+PowerTransition
+PowerGovernor::wait()
+{
+    uint32_t signalled = ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(idle ? POWER_IDLE_WAIT : POWER_ACTIVE_WAIT));
+
+    if (signalled) {
+        lastActivity = millis();
+
+        if (idle) {
+            exitIdle();
+            return PowerWake;
+        }
+    }
+    else if (!idle && millis() - lastActivity > POWER_IDLE_TIME) {
+        enterIdle();
+        return PowerIdle;
+    }
+
+    return PowerNoChange;
+}
+
+
+uint32_t
+PowerGovernor::commandSent(uint32_t inputAt)
+{
+    if (!wakePending) {
+        return 0;
+    }
+
+    wakePending = false;
+
+    if (!inputAt) {
+        return 0;
+    }
+
+    uint32_t latency = micros() - inputAt;
+    return latency ? latency : 1;
+}
@@ -0,0 +1,105 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include "Arduino.h"
+
+#if CONFIG_PM_ENABLE
+#include <esp_pm.h>
+#endif
+
+
+// Decides when the throttle is idle, and keeps the controller's task from
+// spinning.
+//
+// The controller blocks in wait() instead of polling.  Anything with input
+// for it (the HW scan task) calls signal(), which wakes it immediately;
+// otherwise wait() returns after a short timeout so the network can be
+// serviced.  After POWER_IDLE_TIME with no input the governor goes idle:
+// the CPU clock comes down and the waits get longer.  The first signal
+// brings the full clock back before wait() returns, i.e. before any
+// command can be sent, and the time from that wake up to the first
+// command sent is measured.
+//
+// With power management in the core (CONFIG_PM_ENABLE) the clock is
+// managed by holding a CPU_FREQ_MAX lock while active, and idle time is
+// spent in automatic light sleep.  Without it, the clock is switched
+// directly and idle time is spent in the idle task at the lower clock.
+
+#define POWER_IDLE_TIME          (30*1000UL)   // ms without input before going idle
+#define POWER_ACTIVE_WAIT        (5)           // ms, longest wait while active
+#define POWER_IDLE_WAIT          (50)          // ms, longest wait while idle
+
+#define POWER_ACTIVE_MHZ         (240)
+#define POWER_IDLE_MHZ           (80)          // the lowest that WiFi allows
+
+typedef enum PowerTransition {
+    PowerNoChange = 0,
+    PowerWake,              // was idle, input arrived
+    PowerIdle               // no input for POWER_IDLE_TIME
+} PowerTransition;
+
+
+class PowerGovernor
+{
+  public:
+    PowerGovernor();
+
+    // call from the task that will wait()
+    void begin(Stream *console);
+
+    // from any task (not an ISR): input is waiting
+    void signal();
+
+    // block until signal()ed or timed out
+    //   return what changed, so the caller can follow along
+    PowerTransition wait();
+
+    // input that didn't come through signal() (BLE, the server)
+    void activity();
+
+    // call once a command has been sent to the server, with the micros()
+    // timestamp of the input behind it (taken at its interrupt), or 0 if
+    // that isn't known
+    //   return us from that input to this command, if it's the first since
+    //   waking and its input time is known, otherwise 0
+    uint32_t commandSent(uint32_t inputAt);
+
+    bool isIdle() { return idle; }
+
+  private:
+    void enterIdle();
+    void exitIdle();
+
+    TaskHandle_t  task;
+    bool          idle;
+    unsigned long lastActivity;
+    bool          wakePending;
+
+#if CONFIG_PM_ENABLE
+    esp_pm_lock_handle_t cpuLock;
+#endif
+
+    Stream       *console;
+};
@@ -0,0 +1,169 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include <Wire.h>
+
+#include "RGBLED.h"
+
+
+// SX1509 LED driver registers.  Each pin has TOn, IOn and Off; the pins
+// that can breathe (4-7, 12-15) also have TRise and TFall, immediately
+// after.  The chip auto-increments, so one write covers a pin.
+static const uint8_t ledRegisters[16] = {
+    0x29, 0x2C, 0x2F, 0x32,
+    0x35, 0x3A, 0x3F, 0x44,
+    0x49, 0x4C, 0x4F, 0x52,
+    0x55, 0x5A, 0x5F, 0x64,
+};
+
+#define canBreathe(pin)          ((pin) & 0x04)
+
+#define SX1509_REG_DATA_B        (0x10)   // followed by DATA_A
+
+
+// pattern timing, in ms.  0 on time is steady (the SX1509's static mode).
+typedef struct LEDTiming {
+    uint16_t on;
+    uint16_t off;
+    uint16_t rise;
+    uint16_t fall;
+} LEDTiming;
+
+static const LEDTiming ledTimings[LEDPatternCount] = {
+    // on   off   rise  fall
+    {    0,    0,    0,    0 },    // LEDSteady
+    {  500,  500,    0,    0 },    // LEDBlink
+    {  250,  250,    0,    0 },    // LEDFastBlink
+    {  500,  500, 1000, 1000 },    // LEDBreathe
+    {    1,    1, 1500, 1500 },    // LEDFade (shortest possible holds)
+};
+
+
+void
+SX1509RGBLED::set(uint8_t red, uint8_t green, uint8_t blue, LEDPattern pattern)
+{
+    if (commonAnode) {
+        red = 255 - red;
+        green = 255 - green;
+        blue = 255 - blue;
+        pattern = LEDSteady;
+    }
+
+    if (pattern >= LEDPatternCount) {
+        pattern = LEDSteady;
+    }
+
+    setPin(redPin, red, pattern);
+    setPin(greenPin, green, pattern);
+    setPin(bluePin, blue, pattern);
+
+    if (pattern != LEDSteady) {
+        restart();
+    }
+}
+
+
+/*
+ * The SX1509's LED times are register values 1-15 in single units, or
+ * 16-31 in units highScale times as long.  Pick the nearest.
+ */
+uint8_t
+SX1509RGBLED::timeRegister(uint32_t ms, uint32_t unitNs, uint32_t highScale)
+{
+    if (ms == 0 || unitNs == 0) {
+        return 0;
+    }
+
+    uint32_t unitUs = (unitNs + 500) / 1000;
+    uint32_t units = (ms * 1000 + unitUs / 2) / unitUs;
+
+    if (units <= 15) {
+        return units ? units : 1;
+    }
+
+    // between 15 and the shortest high range time (16 * highScale), take
+    // whichever is nearer; rounding to the high range must not fall below
+    // 16, since the chip reads 9-15 as low range values
+    if (units * 2 < 15 + 16 * highScale) {
+        return 15;
+    }
+
+    units = (units + highScale / 2) / highScale;
+    if (units < 16) {
+        return 16;
+    }
+    return (units > 31) ? 31 : units;
+}
+
+
+void
+SX1509RGBLED::setPin(int pin, uint8_t intensity, LEDPattern pattern)
+{
+    const LEDTiming& timing = ledTimings[intensity ? pattern : LEDSteady];
+
+    // TOn/TOff count 64 ClkX periods per unit, times 255 steps; a fade
+    // counts one ClkX period per step of intensity (IOff is always 0)
+    uint32_t onUnitNs = 64 * 255 * clockNs;
+    uint32_t slopeUnitNs = intensity * 255 * clockNs;
+
+    uint8_t regs[5];
+    regs[0] = timeRegister(timing.on, onUnitNs, 8);
+    regs[1] = intensity;
+    regs[2] = timeRegister(timing.off, onUnitNs, 8) << 3;
+    regs[3] = timeRegister(timing.rise, slopeUnitNs, 16);
+    regs[4] = timeRegister(timing.fall, slopeUnitNs, 16);
+
+    Wire.beginTransmission(address);
+    Wire.write(ledRegisters[pin]);
+    Wire.write(regs, canBreathe(pin) ? 5 : 3);
+    Wire.endTransmission();
+}
+
+
+/*
+ * Each pin's pattern starts over when its data bit goes low, so pulse
+ * all three together to keep the colors in step.
+ */
+void
+SX1509RGBLED::restart()
+{
+    uint16_t pins = (1 << redPin) | (1 << greenPin) | (1 << bluePin);
+
+    Wire.beginTransmission(address);
+    Wire.write(SX1509_REG_DATA_B);
+    if (Wire.endTransmission(false) != 0) {
+        return;
+    }
+    if (Wire.requestFrom(address, (uint8_t) 2) != 2) {
+        return;
+    }
+    uint16_t data = Wire.read() << 8;
+    data |= Wire.read();
+
+    uint16_t values[2] = { uint16_t(data | pins), uint16_t(data & ~pins) };
+    for (int i = 0; i < 2; i++) {
+        Wire.beginTransmission(address);
+        Wire.write(SX1509_REG_DATA_B);
+        Wire.write(values[i] >> 8);
+        Wire.write(values[i] & 0xFF);
+        Wire.endTransmission();
+    }
+}
@@ -26,23 +26,42 @@
 
 #include <SparkFunSX1509.h> // Include SX1509 library
 
+#include "ThrottleHW.h"
+
+
+// An RGB LED on three SX1509 LED driver pins.  Blinking and breathing are
+// done by the SX1509 itself: once a pattern is set, nothing more happens
+// on the CPU or the I2C bus until the next change.
+//
+// The SX1509's LED timing comes from its ClkX, which is set chip wide
+// (SX1509::clock()); begin() must be told the divider that's in use.
+// Patterns assume a common cathode LED; one with a common anode only
+// shows steady colors.
+
 class SX1509RGBLED
 {
   public:
-    SX1509RGBLED(SX1509& sx1509, int redPin, int greenPin, int bluePin, bool commonAnode = false):
+    SX1509RGBLED(SX1509& sx1509, uint8_t address, int redPin, int greenPin, int bluePin, bool commonAnode = false):
         sx1509(sx1509),
+        address(address),
         redPin(redPin),
         greenPin(greenPin),
         bluePin(bluePin),
-        commonAnode(commonAnode)
+        commonAnode(commonAnode),
+        clockNs(500)
     {
     }
 
     /* Configure the appropriate SX1509 pins and then turn LED OFF
+     *
+     * clockDivider is the SX1509's ClkX divider (1-7), as passed to
+     * SX1509::clock()
      */
     void
-    begin()
+    begin(uint8_t clockDivider = 1)
     {
+        clockNs = 500 << (clockDivider - 1);    // fOSC is 2 MHz
+
         sx1509.pinMode(redPin, ANALOG_OUTPUT);
         sx1509.pinMode(greenPin, ANALOG_OUTPUT);
         sx1509.pinMode(bluePin, ANALOG_OUTPUT);
@@ -61,20 +80,24 @@ class SX1509RGBLED
     void
     set(uint8_t red, uint8_t green, uint8_t blue)
     {
-        if (commonAnode) {
-            red = 255 - red;
-            green = 255 - green;
-            blue = 255 - blue;
-        }
-        sx1509.analogWrite(redPin, red);
-        sx1509.analogWrite(greenPin, green);
-        sx1509.analogWrite(bluePin, blue);
+        set(red, green, blue, LEDSteady);
     }
 
+    /* Set the colors, and how they're shown.  All three colors follow the
+     * same pattern, in step.
+     */
+    void set(uint8_t red, uint8_t green, uint8_t blue, LEDPattern pattern);
+
   private:
+    void    setPin(int pin, uint8_t intensity, LEDPattern pattern);
+    void    restart();
+    uint8_t timeRegister(uint32_t ms, uint32_t unitNs, uint32_t highScale);
+
     SX1509& sx1509;
+    uint8_t address;
     int redPin;
     int greenPin;
     int bluePin;
     bool commonAnode;
+    uint32_t clockNs;          // one ClkX period
 };
@@ -0,0 +1,433 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "RosterCache.h"
+
+#include "StorageRecord.h"
+
+#include <algorithm>
+
+#define ROSTER_FILE     "/roster"
+
+#define ROSTER_MAGIC    (0x52544B42)   // "BKTR"
+#define ROSTER_VERSION  (1)
+
+// roster updates arrive from the server in bursts
+#define WRITE_BEHIND_DELAY (5000)  // ms
+
+// WiThrottle supports F0 - F28
+#define MAX_FUNCTION_LABELS (29)
+
+
+static bool
+entryBefore(const RosterEntry& entry, const std::pair<uint16_t, bool>& key)
+{
+    if (entry.address != key.first) {
+        return entry.address < key.first;
+    }
+    return entry.longAddress < key.second;
+}
+
+
+RosterCache::RosterCache(ThrottleStorage& storage) :
+    storage(storage),
+    entries(),
+    lastSelectedAddress(),
+    dirty(false),
+    writeBehindTimer(),
+    sequence(0),
+    useCount(0)
+{
+}
+
+
+bool
+RosterCache::begin(Stream *console)
+{
+    this->console = console;
+
+    // the filesystem has already been mounted by ThrottleData
+    std::string payload;
+    uint16_t version;
+
+    if (!readRecord(storage, ROSTER_FILE, ROSTER_MAGIC, &version, &sequence, payload)
+        || version != ROSTER_VERSION
+        || !unpackRoster(payload)) {
+        entries.clear();
+        lastSelectedAddress = "";
+        console->println("no roster cache");
+        return false;
+    }
+
+    console->printf("roster cache: %d entries, last selected '%s'\n",
+                    (int) entries.size(), lastSelectedAddress.c_str());
+    return true;
+}
+
+
+void
+RosterCache::check()
+{
+    if (dirty && writeBehindTimer.hasPassed(WRITE_BEHIND_DELAY)) {
+        commit();
+    }
+}
+
+
+bool
+RosterCache::commit()
+{
+    if (!dirty) {
+        return true;
+    }
+
+    bool rv = writeRecord(storage, ROSTER_FILE, ROSTER_MAGIC, ROSTER_VERSION, sequence + 1, packRoster());
+    if (rv) {
+        sequence++;
+        dirty = false;
+    }
+    else {
+        // try again after the next delay
+        writeBehindTimer.restart();
+    }
+
+    return rv;
+}
+
+
+void
+RosterCache::cacheChanged()
+{
+    dirty = true;
+    writeBehindTimer.restart();
+}
+
+
+bool
+RosterCache::parseAddress(const std::string& address, uint16_t *number, bool *longAddress)
+{
+    if (address.size() < 2 || (address[0] != 'S' && address[0] != 'L')) {
+        return false;
+    }
+
+    long value = strtol(address.c_str() + 1, NULL, 10);
+    if (value <= 0 || value > 10239) {
+        return false;
+    }
+
+    *number = value;
+    *longAddress = (address[0] == 'L');
+    return true;
+}
+
+
+std::string
+RosterCache::formatAddress(uint16_t number, bool longAddress)
+{
+    char buffer[8];
+    snprintf(buffer, sizeof(buffer), "%c%u", longAddress ? 'L' : 'S', number);
+    return buffer;
+}
+
+
+std::vector<std::string>
+RosterCache::splitFunctionLabels(const std::string& labels)
+{
+    static const std::string separator = "]\\[";
+    std::vector<std::string> result;
+
+    size_t start = 0;
+    if (labels.compare(0, separator.size(), separator) == 0) {
+        start = separator.size();
+    }
+
+    while (start <= labels.size() && result.size() < MAX_FUNCTION_LABELS) {
+        size_t end = labels.find(separator, start);
+        if (end == std::string::npos) {
+            end = labels.size();
+        }
+        result.push_back(labels.substr(start, end - start));
+        start = end + separator.size();
+    }
+
+    return result;
+}
+
+
+bool
+RosterCache::parseRosterList(const std::string& line, std::vector<RosterEntry>& entries)
+{
+    static const std::string separator = "]\\[";
+    static const std::string field = "}|{";
+
+    if (line.compare(0, 2, "RL") != 0) {
+        return false;
+    }
+
+    std::string list = line.substr(0, line.find_last_not_of("\r\n") + 1);
+    size_t start = list.find(separator);
+
+    while (start != std::string::npos) {
+        start += separator.size();
+        size_t end = list.find(separator, start);
+        std::string item = list.substr(start, end == std::string::npos ? std::string::npos : end - start);
+
+        // name}|{address}|{S or L
+        size_t nameEnd = item.find(field);
+        size_t addressEnd = (nameEnd == std::string::npos) ? nameEnd : item.find(field, nameEnd + field.size());
+        if (addressEnd != std::string::npos && addressEnd + field.size() < item.size()) {
+            RosterEntry entry;
+            long number = strtol(item.c_str() + nameEnd + field.size(), NULL, 10);
+
+            entry.description = item.substr(0, nameEnd);
+            entry.longAddress = (item[addressEnd + field.size()] == 'L');
+            entry.lastUsed = 0;
+            if (number > 0 && number <= 10239) {
+                entry.address = number;
+                entries.push_back(entry);
+            }
+        }
+
+        start = end;
+    }
+
+    return true;
+}
+
+
+bool
+RosterCache::parseFunctionLabelLine(const std::string& line, std::string& address,
+                                    std::vector<std::string>& labels)
+{
+    static const std::string marker = "<;>";
+
+    // M, the throttle ID, L for labels, then the address
+    if (line.size() < 4 || line[0] != 'M' || line[2] != 'L') {
+        return false;
+    }
+
+    size_t addressEnd = line.find(marker, 3);
+    if (addressEnd == std::string::npos) {
+        return false;
+    }
+
+    address = line.substr(3, addressEnd - 3);
+
+    size_t start = addressEnd + marker.size();
+    size_t end = line.find_last_not_of("\r\n");
+    labels = splitFunctionLabels((end == std::string::npos || end < start)
+                                 ? std::string() : line.substr(start, end + 1 - start));
+    return true;
+}
+
+
+std::vector<RosterEntry>::iterator
+RosterCache::lowerBound(uint16_t address, bool longAddress)
+{
+    return std::lower_bound(entries.begin(), entries.end(), std::make_pair(address, longAddress), entryBefore);
+}
+
+
+const RosterEntry *
+RosterCache::find(uint16_t address, bool longAddress)
+{
+    std::vector<RosterEntry>::iterator entry = lowerBound(address, longAddress);
+
+    if (entry == entries.end() || entry->address != address || entry->longAddress != longAddress) {
+        return NULL;
+    }
+    touch(*entry);
+    return &(*entry);
+}
+
+
+const RosterEntry *
+RosterCache::find(const std::string& address)
+{
+    uint16_t number;
+    bool longAddress;
+
+    if (!parseAddress(address, &number, &longAddress)) {
+        return NULL;
+    }
+    return find(number, longAddress);
+}
+
+
+RosterEntry&
+RosterCache::findOrInsert(uint16_t address, bool longAddress)
+{
+    std::vector<RosterEntry>::iterator entry = lowerBound(address, longAddress);
+
+    if (entry != entries.end() && entry->address == address && entry->longAddress == longAddress) {
+        touch(*entry);
+        return *entry;
+    }
+
+    if (entries.size() >= MAX_ROSTER_ENTRIES) {
+        // make room by dropping the least recently used entry, but never
+        // the loco we'd restore on boot
+        uint16_t keepNumber = 0;
+        bool keepLong = false;
+        bool keepAny = parseAddress(lastSelectedAddress, &keepNumber, &keepLong);
+
+        std::vector<RosterEntry>::iterator victim = entries.end();
+        for (std::vector<RosterEntry>::iterator candidate = entries.begin(); candidate != entries.end(); ++candidate) {
+            if (keepAny && candidate->address == keepNumber && candidate->longAddress == keepLong) {
+                continue;
+            }
+            if (victim == entries.end() || candidate->lastUsed < victim->lastUsed) {
+                victim = candidate;
+            }
+        }
+        entries.erase(victim);
+        entry = lowerBound(address, longAddress);
+    }
+
+    RosterEntry newEntry;
+    newEntry.address = address;
+    newEntry.longAddress = longAddress;
+    touch(newEntry);
+
+    return *entries.insert(entry, newEntry);
+}
+
+
+void
+RosterCache::touch(RosterEntry& entry)
+{
+    entry.lastUsed = ++useCount;
+}
+
+
+void
+RosterCache::updateDescription(uint16_t address, bool longAddress, const std::string& description)
+{
+    RosterEntry& entry = findOrInsert(address, longAddress);
+
+    if (entry.description != description) {
+        entry.description = description;
+        cacheChanged();
+    }
+}
+
+
+void
+RosterCache::updateFunctionLabels(uint16_t address, bool longAddress, const std::vector<std::string>& labels)
+{
+    RosterEntry& entry = findOrInsert(address, longAddress);
+
+    if (entry.functionLabels != labels) {
+        entry.functionLabels = labels;
+        if (entry.functionLabels.size() > MAX_FUNCTION_LABELS) {
+            entry.functionLabels.resize(MAX_FUNCTION_LABELS);
+        }
+        cacheChanged();
+    }
+}
+
+
+std::string
+RosterCache::getLastSelectedAddress()
+{
+    return lastSelectedAddress;
+}
+
+
+void
+RosterCache::saveLastSelectedAddress(const std::string& address)
+{
+    if (lastSelectedAddress != address) {
+        lastSelectedAddress = address;
+        cacheChanged();
+    }
+}
+
+
+std::string
+RosterCache::packRoster()
+{
+    RecordWriter writer;
+
+    writer.putString(lastSelectedAddress);
+    writer.putU16(entries.size());
+
+    for (size_t index = 0; index < entries.size(); index++) {
+        const RosterEntry& entry = entries[index];
+
+        writer.putU16(entry.address);
+        writer.putU8(entry.longAddress ? 1 : 0);
+        writer.putString(entry.description);
+        writer.putU8(entry.functionLabels.size());
+        for (size_t label = 0; label < entry.functionLabels.size(); label++) {
+            writer.putString(entry.functionLabels[label]);
+        }
+    }
+
+    return writer.payload;
+}
+
+
+bool
+RosterCache::unpackRoster(const std::string& payload)
+{
+    RecordReader reader(payload);
+    uint16_t count;
+
+    if (!reader.getString(lastSelectedAddress) || !reader.getU16(count)) {
+        return false;
+    }
+
+    entries.clear();
+    entries.reserve(count);
+
+    for (uint16_t index = 0; index < count; index++) {
+        RosterEntry entry;
+        uint8_t longAddress;
+        uint8_t labelCount;
+
+        if (!reader.getU16(entry.address)
+            || !reader.getU8(longAddress)
+            || !reader.getString(entry.description)
+            || !reader.getU8(labelCount)) {
+            return false;
+        }
+        entry.longAddress = longAddress;
+        entry.lastUsed = 0;     // older than anything used since boot
+
+        entry.functionLabels.resize(labelCount);
+        for (uint8_t label = 0; label < labelCount; label++) {
+            if (!reader.getString(entry.functionLabels[label])) {
+                return false;
+            }
+        }
+
+        entries.push_back(entry);
+    }
+
+    // written in sorted order, but don't trust the binary search to it
+    std::sort(entries.begin(), entries.end(),
+              [](const RosterEntry& a, const RosterEntry& b) {
+                  return entryBefore(a, std::make_pair(b.address, b.longAddress));
+              });
+
+    return true;
+}
@@ -0,0 +1,113 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include "Arduino.h"
+
+#include <Chrono.h>
+
+#include <string>
+#include <vector>
+
+#include "ThrottleStorage.h"
+
+
+// the most locomotives remembered; beyond this, new entries displace the
+// least recently used ones
+#define MAX_ROSTER_ENTRIES (64)
+
+
+typedef struct RosterEntry {
+    uint16_t                 address;
+    bool                     longAddress;
+    std::string              description;
+    std::vector<std::string> functionLabels;   // indexed by function number
+    uint32_t                 lastUsed;         // not saved: RAM only
+} RosterEntry;
+
+
+// A flash-backed cache of what the WiThrottle server has told us about its
+// locomotives, plus the last address this throttle had selected, so that
+// both are available straight after a reboot.
+//
+// Entries are held sorted by address, making lookups a binary search.
+// Changes are made in RAM and written out on a write-behind timer, in the
+// same way as ThrottleData.
+class RosterCache
+{
+  public:
+    RosterCache(ThrottleStorage& storage = defaultThrottleStorage());
+
+    bool begin(Stream *console);
+
+    // flush changes once they have been stable for a while, to be called
+    // VERY frequently
+    void check();
+    bool commit();
+
+    // WiThrottle address strings are "S3", "L1234"
+    static bool parseAddress(const std::string& address, uint16_t *number, bool *longAddress);
+    static std::string formatAddress(uint16_t number, bool longAddress);
+
+    // split a WiThrottle function label list ("]\[Headlight]\[Bell]\[Horn")
+    static std::vector<std::string> splitFunctionLabels(const std::string& labels);
+
+    // parse a server's roster list ("RL2]\[RGS 41}|{41}|{S]\[...")
+    static bool parseRosterList(const std::string& line, std::vector<RosterEntry>& entries);
+
+    // parse a function label line ("MTLL341<;>]\[Headlight]\[Bell")
+    static bool parseFunctionLabelLine(const std::string& line, std::string& address,
+                                       std::vector<std::string>& labels);
+
+    // return NULL if the address isn't in the cache
+    const RosterEntry *find(uint16_t address, bool longAddress);
+    const RosterEntry *find(const std::string& address);
+
+    void updateDescription(uint16_t address, bool longAddress, const std::string& description);
+    void updateFunctionLabels(uint16_t address, bool longAddress, const std::vector<std::string>& labels);
+
+    std::string getLastSelectedAddress();
+    void saveLastSelectedAddress(const std::string& address);
+
+  private:
+    std::vector<RosterEntry>::iterator lowerBound(uint16_t address, bool longAddress);
+    RosterEntry& findOrInsert(uint16_t address, bool longAddress);
+    void touch(RosterEntry& entry);
+    void cacheChanged();
+
+    std::string packRoster();
+    bool unpackRoster(const std::string& payload);
+
+    ThrottleStorage&         storage;
+
+    std::vector<RosterEntry> entries;          // sorted by (address, longAddress)
+    std::string              lastSelectedAddress;
+
+    bool                     dirty;
+    Chrono                   writeBehindTimer;
+    uint32_t                 sequence;
+    uint32_t                 useCount;         // stamps lastUsed
+
+    Stream                   *console;
+};
@@ -0,0 +1,91 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include <atomic>
+
+#ifdef ESP32
+#include "esp_attr.h"
+#else
+#define IRAM_ATTR
+#endif
+
+
+// A fixed size, lock-free ring buffer for exactly one producer and one
+// consumer, which may be on different cores.  Size must be a power of 2.
+//
+// The producer only ever writes head and the consumer only ever writes
+// tail; each publishes its update with a release store after the slot has
+// been written (or read), and reads the other's index with an acquire load.
+// Neither side ever blocks.
+//
+// push() is in IRAM so an ISR can produce while the flash cache is off;
+// the ring itself must then be in DRAM (not a const or flash object).
+
+template <typename T, unsigned Size>
+class SPSCRing
+{
+    static_assert(Size >= 2 && (Size & (Size - 1)) == 0, "SPSCRing size must be a power of 2");
+
+  public:
+    SPSCRing() : head(0), tail(0) {}
+
+    // producer side
+    //   return false (and drop the item) if the ring is full
+    bool IRAM_ATTR push(const T& item)
+    {
+        unsigned h = head.load(std::memory_order_relaxed);
+        if (h - tail.load(std::memory_order_acquire) >= Size) {
+            return false;
+        }
+
+        slots[h & (Size - 1)] = item;
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    // consumer side
+    //   return false if there was nothing to take
+    bool pop(T& item)
+    {
+        unsigned t = tail.load(std::memory_order_relaxed);
+        if (t == head.load(std::memory_order_acquire)) {
+            return false;
+        }
+
+        item = slots[t & (Size - 1)];
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const
+    {
+        return tail.load(std::memory_order_acquire) == head.load(std::memory_order_acquire);
+    }
+
+  private:
+    T                     slots[Size];
+    std::atomic<unsigned> head;    // next slot to write, only changed by the producer
+    std::atomic<unsigned> tail;    // next slot to read, only changed by the consumer
+};
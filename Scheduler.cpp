@@ -0,0 +1,202 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "Scheduler.h"
+
+
+Scheduler::Scheduler() :
+    timerCount(0),
+    heapSize(0)
+{
+}
+
+
+int
+Scheduler::add(const char *name, uint32_t periodMs, SchedulerCallback callback)
+{
+    if (timerCount >= SCHEDULER_MAX_TIMERS) {
+        return -1;
+    }
+
+    int id = timerCount++;
+    Timer &timer = timers[id];
+
+    timer.name     = name;
+    timer.period   = 0;
+    timer.callback = callback;
+    memset(&timer.stats, 0, sizeof(timer.stats));
+
+    setPeriod(id, periodMs);
+    return id;
+}
+
+
+void
+Scheduler::setPeriod(int id, uint32_t periodMs)
+{
+    if (id < 0 || id >= timerCount) {
+        return;
+    }
+
+    remove(id);
+
+    timers[id].period = periodMs * 1000;
+    if (timers[id].period) {
+        timers[id].deadline = micros() + timers[id].period;
+        push(id);
+    }
+}
+
+
+void
+Scheduler::run()
+{
+    uint32_t now = micros();
+
+    while (heapSize && int32_t(now - timers[heap[0]].deadline) >= 0) {
+        int id = pop();
+        Timer &timer = timers[id];
+
+        uint32_t late = now - timer.deadline;
+        timer.stats.runs++;
+        timer.stats.meanLate = timer.stats.meanLate - (timer.stats.meanLate >> 3) + (late >> 3);
+        if (late > timer.stats.maxLate) {
+            timer.stats.maxLate = late;
+        }
+
+        timer.deadline += timer.period;
+        if (int32_t(now - timer.deadline) >= 0) {
+            // a whole period (or more) was missed; don't try to catch up
+            timer.stats.skipped += late / timer.period;
+            timer.deadline = now + timer.period;
+        }
+
+        // back on the heap first, so the callback can change any timer
+        push(id);
+        timer.callback();
+
+        now = micros();
+    }
+}
+
+
+uint32_t
+Scheduler::untilNext()
+{
+    if (!heapSize) {
+        return SCHEDULER_NO_DEADLINE;
+    }
+
+    int32_t remaining = timers[heap[0]].deadline - micros();
+    if (remaining <= 0) {
+        return 0;
+    }
+    return (remaining + 999) / 1000;
+}
+
+
+void
+Scheduler::printStats(Stream *console)
+{
+    for (int id = 0; id < timerCount; id++) {
+        const Timer &timer = timers[id];
+        console->printf("timer %-10s every %6u ms: %u runs, %u skipped, late by %u us mean, %u us max\n",
+                        timer.name, timer.period / 1000, timer.stats.runs, timer.stats.skipped,
+                        timer.stats.meanLate, timer.stats.maxLate);
+    }
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// the heap itself
+//
+
+void
+Scheduler::push(int id)
+{
+    heap[heapSize] = id;
+    siftUp(heapSize++);
+}
+
+
+int
+Scheduler::pop()
+{
+    int id = heap[0];
+    heap[0] = heap[--heapSize];
+    siftDown(0);
+    return id;
+}
+
+
+void
+Scheduler::remove(int id)
+{
+    for (int i = 0; i < heapSize; i++) {
+        if (heap[i] == id) {
+            heap[i] = heap[--heapSize];
+            if (i < heapSize) {
+                siftUp(i);
+                siftDown(i);
+            }
+            return;
+        }
+    }
+}
+
+
+void
+Scheduler::siftUp(int index)
+{
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (!before(heap[index], heap[parent])) {
+            break;
+        }
+        uint8_t swap = heap[index]; heap[index] = heap[parent]; heap[parent] = swap;
+        index = parent;
+    }
+}
+
+
+void
+Scheduler::siftDown(int index)
+{
+    for (;;) {
+        int smallest = index;
+        int left = index * 2 + 1;
+        int right = left + 1;
+
+        if (left < heapSize && before(heap[left], heap[smallest])) {
+            smallest = left;
+        }
+        if (right < heapSize && before(heap[right], heap[smallest])) {
+            smallest = right;
+        }
+        if (smallest == index) {
+            break;
+        }
+
+        uint8_t swap = heap[index]; heap[index] = heap[smallest]; heap[smallest] = swap;
+        index = smallest;
+    }
+}
@@ -0,0 +1,101 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include "Arduino.h"
+
+#include <functional>
+
+
+// Periodic timers kept in a min-heap by deadline, so the next one due is
+// always known without checking them all.  The owner runs whatever is due
+// with run(), then sleeps for untilNext() (or until something else wakes
+// it).
+//
+// Deadlines advance by exactly one period each run, so timers don't drift;
+// a timer that has fallen more than a period behind skips ahead instead
+// of running several times in a row.  How late each run was is tracked
+// per timer.
+//
+// All methods must be called from the owning task.
+
+#define SCHEDULER_MAX_TIMERS     (8)
+#define SCHEDULER_NO_DEADLINE    (0xFFFFFFFF)
+
+typedef std::function<void()> SchedulerCallback;
+
+typedef struct TimerStats {
+    uint32_t runs;
+    uint32_t skipped;          // periods missed entirely
+    uint32_t meanLate;         // us, running average (1/8 new)
+    uint32_t maxLate;          // us
+} TimerStats;
+
+
+class Scheduler
+{
+  public:
+    Scheduler();
+
+    // call callback every periodMs, the first time one period from now
+    //   periodMs may be 0 to add the timer stopped
+    //   return the timer's id, or -1 if there's no room
+    int add(const char *name, uint32_t periodMs, SchedulerCallback callback);
+
+    // change a timer's period, and restart it (next due one period from
+    // now); 0 stops it
+    void setPeriod(int id, uint32_t periodMs);
+    void restart(int id) { setPeriod(id, timers[id].period / 1000); }
+
+    // run every timer that's due
+    void run();
+
+    // ms until the next deadline, or SCHEDULER_NO_DEADLINE
+    uint32_t untilNext();
+
+    const TimerStats& stats(int id) { return timers[id].stats; }
+    void printStats(Stream *console);
+
+  private:
+    typedef struct Timer {
+        const char        *name;
+        uint32_t          period;      // us, 0 if stopped
+        uint32_t          deadline;    // micros()
+        SchedulerCallback callback;
+        TimerStats        stats;
+    } Timer;
+
+    bool before(int a, int b) { return int32_t(timers[a].deadline - timers[b].deadline) < 0; }
+    void push(int id);
+    int  pop();
+    void remove(int id);
+    void siftUp(int index);
+    void siftDown(int index);
+
+    Timer   timers[SCHEDULER_MAX_TIMERS];
+    int     timerCount;
+
+    uint8_t heap[SCHEDULER_MAX_TIMERS];   // timer ids, soonest deadline first
+    int     heapSize;
+};
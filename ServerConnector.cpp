@@ -0,0 +1,269 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "ServerConnector.h"
+
+#include <errno.h>
+#include <fcntl.h>
+
+#include "lwip/dns.h"
+#include "lwip/sockets.h"
+#include "lwip/tcpip.h"
+
+
+// a name lookup on its way through the lwIP task, freed once it's answered
+typedef struct ServerLookup {
+    ServerConnector *connector;
+    uint32_t         generation;
+    std::string      host;
+} ServerLookup;
+
+
+ServerConnector::ServerConnector() :
+    step(StepIdle),
+    generation(0),
+    resolved(0),
+    resolveDone(false),
+    host(),
+    port(0),
+    sockfd(-1),
+    startedAt(0),
+    console(NULL)
+{
+}
+
+
+void
+ServerConnector::begin(Stream *console)
+{
+    this->console = console;
+    vPortCPUInitializeMutex(&resolveLock);
+}
+
+
+void
+ServerConnector::start(const char *host, uint16_t port)
+{
+    cancel();
+
+    this->host = host;
+    this->port = port;
+    startedAt = millis();
+
+    ServerLookup *lookup = new ServerLookup;
+    lookup->connector = this;
+    lookup->host = host;
+
+    portENTER_CRITICAL(&resolveLock);
+    lookup->generation = ++generation;
+    resolveDone = false;
+    portEXIT_CRITICAL(&resolveLock);
+
+    step = StepResolving;
+
+    if (tcpip_callback(&ServerConnector::lookupStart, lookup) != ERR_OK) {
+        delete lookup;
+        fail("can't look up the server name");
+    }
+}
+
+
+// called on the lwIP task: a numeric address (or one that's cached) comes
+// straight back, otherwise dnsFound() is called when the answer arrives
+void
+ServerConnector::lookupStart(void *arg)
+{
+    ServerLookup *lookup = (ServerLookup *) arg;
+    ip_addr_t address;
+
+    err_t err = dns_gethostbyname(lookup->host.c_str(), &address, &ServerConnector::dnsFound, lookup);
+    if (err == ERR_INPROGRESS) {
+        return;
+    }
+
+    lookup->connector->lookupFinished(lookup->generation, (err == ERR_OK) ? &address : NULL);
+    delete lookup;
+}
+
+
+// called on the lwIP task, with a NULL address if the lookup failed
+void
+ServerConnector::dnsFound(const char *name, const ip_addr_t *address, void *arg)
+{
+    ServerLookup *lookup = (ServerLookup *) arg;
+
+    lookup->connector->lookupFinished(lookup->generation, address);
+    delete lookup;
+}
+
+
+void
+ServerConnector::lookupFinished(uint32_t generation, const ip_addr_t *address)
+{
+    portENTER_CRITICAL(&resolveLock);
+    if (generation == this->generation) {    // not an abandoned lookup
+        resolved = address ? address->u_addr.ip4.addr : 0;
+        resolveDone = true;
+    }
+    portEXIT_CRITICAL(&resolveLock);
+}
+
+
+bool
+ServerConnector::startConnect(uint32_t resolved)
+{
+    sockfd = lwip_socket(AF_INET, SOCK_STREAM, 0);
+    if (sockfd < 0) {
+        fail("no socket");
+        return false;
+    }
+
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) | O_NONBLOCK);
+
+    struct sockaddr_in address;
+    memset(&address, 0, sizeof(address));
+    address.sin_family = AF_INET;
+    address.sin_addr.s_addr = resolved;
+    address.sin_port = htons(port);
+
+    int result = lwip_connect(sockfd, (struct sockaddr *) &address, sizeof(address));
+    if (result < 0 && errno != EINPROGRESS) {
+        fail("connect failed");
+        return false;
+    }
+
+    step = StepConnecting;
+    return true;
+}
+
+
+ConnectResult
+ServerConnector::poll()
+{
+    switch (step) {
+        case StepIdle:
+        case StepFailed:
+            return ConnectFailed;
+        case StepConnected:
+            return ConnectSucceeded;
+        case StepResolving:
+        case StepConnecting:
+            break;
+    }
+
+    if (millis() - startedAt > SERVER_CONNECT_TIMEOUT) {
+        fail(step == StepResolving ? "timed out looking up the server" : "timed out connecting");
+        return ConnectFailed;
+    }
+
+    if (step == StepResolving) {
+        bool done;
+        uint32_t address;
+
+        portENTER_CRITICAL(&resolveLock);
+        done = resolveDone;
+        address = resolved;
+        portEXIT_CRITICAL(&resolveLock);
+
+        if (!done) {
+            return ConnectPending;
+        }
+        if (address == 0) {
+            fail("server name not found");
+            return ConnectFailed;
+        }
+        if (!startConnect(address)) {
+            return ConnectFailed;
+        }
+    }
+
+    // writable once the connect has finished, one way or the other
+    fd_set writable;
+    FD_ZERO(&writable);
+    FD_SET(sockfd, &writable);
+    struct timeval noWait = { 0, 0 };
+
+    int ready = lwip_select(sockfd + 1, NULL, &writable, NULL, &noWait);
+    if (ready < 0) {
+        fail("select failed");
+        return ConnectFailed;
+    }
+    if (ready == 0) {
+        return ConnectPending;
+    }
+
+    int error = 0;
+    socklen_t length = sizeof(error);
+    lwip_getsockopt(sockfd, SOL_SOCKET, SO_ERROR, &error, &length);
+    if (error) {
+        if (console) {
+            console->printf("server: connect error %d\n", error);
+        }
+        fail("connect failed");
+        return ConnectFailed;
+    }
+
+    // blocking again, as WiFiClient expects
+    fcntl(sockfd, F_SETFL, fcntl(sockfd, F_GETFL, 0) & ~O_NONBLOCK);
+
+    step = StepConnected;
+    return ConnectSucceeded;
+}
+
+
+void
+ServerConnector::attach(WiFiClient *client)
+{
+    if (step != StepConnected) {
+        return;
+    }
+
+    *client = WiFiClient(sockfd);    // the client owns the socket now
+    sockfd = -1;
+    step = StepIdle;
+}
+
+
+void
+ServerConnector::cancel()
+{
+    portENTER_CRITICAL(&resolveLock);
+    generation++;                 // drop any answer still on its way
+    resolveDone = false;
+    portEXIT_CRITICAL(&resolveLock);
+
+    if (sockfd >= 0) {
+        lwip_close(sockfd);
+        sockfd = -1;
+    }
+    step = StepIdle;
+}
+
+
+void
+ServerConnector::fail(const char *why)
+{
+    if (console) {
+        console->printf("server: %s:%u: %s\n", host.c_str(), port, why);
+    }
+    cancel();
+    step = StepFailed;
+}
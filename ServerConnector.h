@@ -0,0 +1,100 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include <string>
+
+#include "Arduino.h"
+
+#include <WiFi.h>
+
+#include "lwip/ip_addr.h"
+
+
+// how long to wait for the server: name lookup and TCP connect together
+#define SERVER_CONNECT_TIMEOUT   (5000)   // ms
+
+
+struct ServerLookup;
+
+
+typedef enum ConnectResult {
+    ConnectPending = 0,
+    ConnectSucceeded,
+    ConnectFailed
+} ConnectResult;
+
+
+// Connects to the WiThrottle server without blocking the caller: the name
+// is looked up through lwIP's asynchronous DNS (started on the lwIP task,
+// as the DNS code isn't thread safe), and the TCP connect is
+// started on a non-blocking socket.  poll() checks on it (using a select()
+// that doesn't wait), so the controller's loop can go on handling the
+// knob and buttons in between.
+//
+// WiFiClient::connect() does the same things, but waits for each of them.
+class ServerConnector
+{
+  public:
+    ServerConnector();
+
+    void begin(Stream *console);
+
+    // start connecting; anything already in progress is abandoned
+    void start(const char *host, uint16_t port);
+
+    // return ConnectPending until the connection is made or has failed
+    ConnectResult poll();
+
+    // after ConnectSucceeded: hand the connected socket over to a client
+    void attach(WiFiClient *client);
+
+    void cancel();
+
+  private:
+    static void lookupStart(void *arg);
+    static void dnsFound(const char *name, const ip_addr_t *address, void *arg);
+    void lookupFinished(uint32_t generation, const ip_addr_t *address);
+    bool startConnect(uint32_t resolved);
+    void fail(const char *why);
+
+    typedef enum Step {
+        StepIdle = 0,
+        StepResolving,
+        StepConnecting,
+        StepConnected,
+        StepFailed
+    } Step;
+
+    volatile Step     step;
+    portMUX_TYPE      resolveLock;   // over the three below
+    volatile uint32_t generation;    // of the lookup we're waiting for
+    volatile uint32_t resolved;      // from lookupFinished(), on the lwIP task
+    volatile bool     resolveDone;
+    std::string       host;
+    uint16_t          port;
+    int               sockfd;
+    unsigned long     startedAt;
+    Stream           *console;
+};
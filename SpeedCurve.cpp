@@ -0,0 +1,226 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "SpeedCurve.h"
+
+
+typedef enum StepMode {
+    Steps126 = 0,
+    Steps28,
+    Steps14,
+    StepModeCount
+} StepMode;
+
+static constexpr int stepCounts[StepModeCount] = { 126, 28, 14 };
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Curve definitions.  Each maps a table index (0 - SPEED_TABLE_SIZE-1) to
+// a fraction of full speed (0.0 - 1.0).  Everything here must stay
+// constexpr (and C++11 constexpr at that: one return statement), as the
+// tables are built by the compiler.
+//
+
+// how sharply the exponential curve bends; e^(k*x) scaled onto 0..1
+#define EXPONENTIAL_CURVE_K (3.0)
+
+// the custom curve: (table index, percent of full speed) pairs, in order,
+// starting at index 0 and ending at SPEED_TABLE_SIZE-1
+static constexpr int customCurvePoints[][2] = {
+    {   0,   0 },
+    {  32,   5 },     // a long, gentle creep for switching
+    { 128,  30 },
+    { 224,  80 },
+    { 255, 100 },
+};
+static constexpr int customCurvePointCount = sizeof(customCurvePoints) / sizeof(customCurvePoints[0]);
+
+
+static constexpr double
+fraction(size_t index)
+{
+    return double(index) / (SPEED_TABLE_SIZE - 1);
+}
+
+
+// e^x as a Taylor series, summing until the terms no longer matter
+static constexpr double
+exponential(double x, double term = 1.0, int n = 1)
+{
+    return (n > 40) ? term : term + exponential(x, term * x / n, n + 1);
+}
+
+
+static constexpr double
+exponentialCurve(size_t index)
+{
+    return (exponential(EXPONENTIAL_CURVE_K * fraction(index)) - 1.0) / (exponential(EXPONENTIAL_CURVE_K) - 1.0);
+}
+
+
+// interpolate between custom curve point `point` and the one after it
+static constexpr double
+customCurve(size_t index, int point = 0)
+{
+    return (point + 1 >= customCurvePointCount - 1 || int(index) <= customCurvePoints[point + 1][0])
+        ? (customCurvePoints[point][1]
+           + double(customCurvePoints[point + 1][1] - customCurvePoints[point][1])
+             * (int(index) - customCurvePoints[point][0])
+             / (customCurvePoints[point + 1][0] - customCurvePoints[point][0])) / 100.0
+        : customCurve(index, point + 1);
+}
+
+
+static constexpr double
+curveFraction(SpeedCurve curve, size_t index)
+{
+    return (curve == ExponentialCurve) ? exponentialCurve(index)
+        : (curve == CustomCurve)       ? customCurve(index)
+        : fraction(index);
+}
+
+
+// round a fraction of full speed to the nearest decoder step, and give
+// the WiThrottle speed value that lands on that step
+static constexpr int
+decoderStep(double speed, int steps)
+{
+    return int(speed * steps + 0.5);
+}
+
+static constexpr uint8_t
+speedValue(double speed, int steps)
+{
+    return uint8_t((decoderStep(speed, steps) * MAX_SPEED_VALUE + steps / 2) / steps);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// Compile time table generation
+//
+
+template <size_t... I>
+struct IndexSequence {};
+
+template <size_t N, size_t... I>
+struct MakeIndexSequence : MakeIndexSequence<N - 1, N - 1, I...> {};
+
+template <size_t... I>
+struct MakeIndexSequence<0, I...> {
+    typedef IndexSequence<I...> type;
+};
+
+
+template <size_t... I>
+static constexpr SpeedTable
+makeTable(SpeedCurve curve, int steps, IndexSequence<I...>)
+{
+    return SpeedTable {{ speedValue(curveFraction(curve, I), steps)... }};
+}
+
+static constexpr SpeedTable
+makeTable(SpeedCurve curve, StepMode mode)
+{
+    return makeTable(curve, stepCounts[mode], MakeIndexSequence<SPEED_TABLE_SIZE>::type());
+}
+
+
+// indexed by [SpeedCurve][StepMode]
+static constexpr SpeedTable speedTables[SpeedCurveCount][StepModeCount] = {
+    {
+        makeTable(LinearCurve, Steps126),
+        makeTable(LinearCurve, Steps28),
+        makeTable(LinearCurve, Steps14),
+    },
+    {
+        makeTable(ExponentialCurve, Steps126),
+        makeTable(ExponentialCurve, Steps28),
+        makeTable(ExponentialCurve, Steps14),
+    },
+    {
+        makeTable(CustomCurve, Steps126),
+        makeTable(CustomCurve, Steps28),
+        makeTable(CustomCurve, Steps14),
+    },
+};
+
+// the ends of every curve must be a stop and full speed
+static_assert(speedTables[LinearCurve][Steps126].value[0] == 0, "speed tables must start at 0");
+static_assert(speedTables[CustomCurve][Steps14].value[SPEED_TABLE_SIZE - 1] == MAX_SPEED_VALUE,
+              "speed tables must reach full speed");
+static_assert(speedTables[ExponentialCurve][Steps28].value[SPEED_TABLE_SIZE - 1] == MAX_SPEED_VALUE,
+              "speed tables must reach full speed");
+
+//
+////////////////////////////////////////////////////////////////////////////////
+
+
+SpeedCurveTable::SpeedCurveTable(SpeedCurve curve) :
+    curve(curve),
+    stepMode(Steps126),
+    table(NULL)
+{
+    selectTable();
+}
+
+
+void
+SpeedCurveTable::selectTable()
+{
+    table = &speedTables[curve][stepMode];
+}
+
+
+void
+SpeedCurveTable::setCurve(SpeedCurve newCurve)
+{
+    if (newCurve >= 0 && newCurve < SpeedCurveCount) {
+        curve = newCurve;
+        selectTable();
+    }
+}
+
+
+int
+SpeedCurveTable::setSpeedSteps(int steps)
+{
+    switch (steps) {
+        case 14:
+        case 8:            // WiThrottle mode code for 14 steps
+            stepMode = Steps14;
+            break;
+        case 27:
+        case 28:
+        case 2:            // WiThrottle mode codes for 28 steps
+        case 4:            //   (4 is 27 steps, which 28 covers)
+        case 16:
+            stepMode = Steps28;
+            break;
+        default:           // 126, 128, and WiThrottle mode 1
+            stepMode = Steps126;
+            break;
+    }
+
+    selectTable();
+    return stepCounts[stepMode];
+}
@@ -0,0 +1,80 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+
+// The speed knob's (filtered, 12 bit) ADC reading is turned into a
+// WiThrottle speed value (0-126) by table lookup.  There is a table for
+// every combination of response curve and decoder speed step mode, all
+// generated at compile time (see SpeedCurve.cpp).
+//
+// In 14 and 28 step modes the tables only contain the speed values that
+// land on a real decoder step, so the throttle never sends a speed the
+// decoder can't represent (and then reports as something else).
+
+typedef enum SpeedCurve {
+    LinearCurve = 0,
+    ExponentialCurve,      // fine control at low speed, coarser at the top
+    CustomCurve,           // piecewise linear, see customCurvePoints
+    SpeedCurveCount
+} SpeedCurve;
+
+
+// the tables are indexed by the top 8 bits of the 12 bit reading
+#define SPEED_TABLE_SHIFT  (4)
+#define SPEED_TABLE_SIZE   (4096 >> SPEED_TABLE_SHIFT)
+
+#define MAX_SPEED_VALUE    (126)   // WiThrottle speeds are always 0-126
+
+
+typedef struct SpeedTable {
+    uint8_t value[SPEED_TABLE_SIZE];
+} SpeedTable;
+
+
+class SpeedCurveTable
+{
+  public:
+    SpeedCurveTable(SpeedCurve curve = LinearCurve);
+
+    void setCurve(SpeedCurve curve);
+
+    // steps as reported by the WiThrottle server: either the step count
+    // (14, 28, 126/128) or the protocol's mode code (8, 2/16, 1)
+    //   return the number of steps now in use
+    int setSpeedSteps(int steps);
+
+    // raw: 0-4095, returns the WiThrottle speed value for it
+    uint8_t lookup(int raw) const { return table->value[(raw >> SPEED_TABLE_SHIFT) & (SPEED_TABLE_SIZE - 1)]; }
+
+  private:
+    void selectTable();
+
+    SpeedCurve       curve;
+    int              stepMode;
+    const SpeedTable *table;
+};
@@ -0,0 +1,174 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "SpeedEncoder.h"
+#include "SpeedCurve.h"
+
+
+// Spinning the knob faster moves more steps per detent.  Entries are in
+// increasing order of detents per second.
+typedef struct EncoderAcceleration {
+    uint16_t rate;          // detents per second, at least
+    uint8_t  steps;         // per detent
+} EncoderAcceleration;
+
+static const EncoderAcceleration acceleration[] = {
+    {  0, 1 },
+    { 12, 2 },
+    { 25, 4 },
+    { 40, 8 },
+};
+
+#define ACCELERATION_COUNT (sizeof(acceleration) / sizeof(acceleration[0]))
+
+
+SpeedEncoder::SpeedEncoder() :
+    unit(PCNT_UNIT_0),
+    stopPin(-1),
+    lastCount(0),
+    partialCounts(0),
+    step(0),
+    stepCount(MAX_SPEED_VALUE),
+    lastDetent(0),
+    stopPressed(false)
+{
+}
+
+
+bool
+SpeedEncoder::begin(pcnt_unit_t unit, int pinA, int pinB, int stopPin)
+{
+    this->unit = unit;
+    this->stopPin = stopPin;
+
+    // count every edge of both phases: A's edges counted in the direction
+    // that B says, and B's in the direction that A says
+    pcnt_config_t config;
+    memset(&config, 0, sizeof(config));
+
+    config.unit           = unit;
+    config.counter_h_lim  = SPEED_ENCODER_COUNTER_LIMIT;
+    config.counter_l_lim  = -SPEED_ENCODER_COUNTER_LIMIT;
+
+    config.channel        = PCNT_CHANNEL_0;
+    config.pulse_gpio_num = pinA;
+    config.ctrl_gpio_num  = pinB;
+    config.pos_mode       = PCNT_COUNT_DEC;
+    config.neg_mode       = PCNT_COUNT_INC;
+    config.lctrl_mode     = PCNT_MODE_REVERSE;
+    config.hctrl_mode     = PCNT_MODE_KEEP;
+    if (pcnt_unit_config(&config) != ESP_OK) {
+        return false;
+    }
+
+    config.channel        = PCNT_CHANNEL_1;
+    config.pulse_gpio_num = pinB;
+    config.ctrl_gpio_num  = pinA;
+    config.pos_mode       = PCNT_COUNT_INC;
+    config.neg_mode       = PCNT_COUNT_DEC;
+    if (pcnt_unit_config(&config) != ESP_OK) {
+        return false;
+    }
+
+    // contact bounce is far shorter than a real edge when turned by hand
+    pcnt_set_filter_value(unit, SPEED_ENCODER_FILTER);
+    pcnt_filter_enable(unit);
+
+    pcnt_counter_pause(unit);
+    pcnt_counter_clear(unit);
+    pcnt_counter_resume(unit);
+
+    pinMode(stopPin, INPUT_PULLUP);
+
+    lastCount = 0;
+    return true;
+}
+
+
+void
+SpeedEncoder::setSpeedSteps(int steps)
+{
+    if (steps < 1 || steps == stepCount) {
+        return;
+    }
+
+    // stay at (about) the same speed
+    step = (step * steps + stepCount / 2) / stepCount;
+    stepCount = steps;
+}
+
+
+// Counts since the last call.  The counter goes back to 0 when it reaches
+// either limit, so it's only meaningful modulo the limit; it can't move
+// anywhere near half of that between calls.
+int
+SpeedEncoder::readCounts()
+{
+    int16_t count = 0;
+    pcnt_get_counter_value(unit, &count);
+
+    int delta = count - lastCount;
+    lastCount = count;
+
+    if (delta > SPEED_ENCODER_COUNTER_LIMIT / 2) {
+        delta -= SPEED_ENCODER_COUNTER_LIMIT;
+    }
+    else if (delta < -SPEED_ENCODER_COUNTER_LIMIT / 2) {
+        delta += SPEED_ENCODER_COUNTER_LIMIT;
+    }
+
+    return delta;
+}
+
+
+int
+SpeedEncoder::update()
+{
+    bool pressed = !digitalRead(stopPin);
+    if (pressed && !stopPressed) {
+        stop();
+    }
+    stopPressed = pressed;
+
+    partialCounts += readCounts();
+    int detents = partialCounts / SPEED_ENCODER_COUNTS_PER_DETENT;
+    partialCounts -= detents * SPEED_ENCODER_COUNTS_PER_DETENT;
+
+    if (detents != 0 && !pressed) {
+        // how fast it's being turned, from the time since the last detent
+        unsigned long now = millis();
+        unsigned long elapsed = max(now - lastDetent, 1UL);
+        unsigned long rate = abs(detents) * 1000UL / elapsed;
+        lastDetent = now;
+
+        int stepsPerDetent = 1;
+        for (unsigned i = 0; i < ACCELERATION_COUNT; i++) {
+            if (rate >= acceleration[i].rate) {
+                stepsPerDetent = acceleration[i].steps;
+            }
+        }
+
+        step = constrain(step + detents * stepsPerDetent, 0, stepCount);
+    }
+
+    // the WiThrottle speed that's on this step
+    return (step * MAX_SPEED_VALUE + stepCount / 2) / stepCount;
+}
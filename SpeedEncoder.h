@@ -0,0 +1,71 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include "Arduino.h"
+
+#include "driver/pcnt.h"
+
+
+// A quadrature encoder used as a speed knob.  Its edges are counted by one
+// of the ESP32's PCNT units, entirely in hardware; update() just reads how
+// far it has turned since last time.
+//
+// Each detent moves one of the decoder's speed steps, or more when the
+// knob is spun quickly.  Pressing the knob stops.
+
+#define SPEED_ENCODER_COUNTS_PER_DETENT (4)      // full quadrature cycle
+#define SPEED_ENCODER_COUNTER_LIMIT     (16000)  // counter wraps to 0 here
+#define SPEED_ENCODER_FILTER            (1023)   // APB cycles, ~13 us of glitch
+
+
+class SpeedEncoder
+{
+  public:
+    SpeedEncoder();
+
+    // the encoder's A and B phases, and its push switch (all active low)
+    bool begin(pcnt_unit_t unit, int pinA, int pinB, int stopPin);
+
+    // the decoder's speed step count (14, 28 or 126)
+    void setSpeedSteps(int steps);
+
+    // the speed (0-126), after whatever has happened since the last call
+    int update();
+
+    // back to 0
+    void stop() { step = 0; }
+
+  private:
+    int readCounts();
+
+    pcnt_unit_t   unit;
+    int           stopPin;
+    int16_t       lastCount;
+    int           partialCounts;    // toward the next detent
+    int           step;             // 0 to stepCount
+    int           stepCount;
+    unsigned long lastDetent;       // millis()
+    bool          stopPressed;
+};
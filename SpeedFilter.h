@@ -0,0 +1,213 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+
+
+// Building blocks for smoothing the speed input, all in integer
+// arithmetic.  Each stage has
+//
+//     int  update(int value);    // feed in one sample, get the filtered value
+//     void reset(int value);     // start over as if value had always been seen
+//
+// and stages are chained with FilterPipeline.  The pipeline is a plain
+// template composition, so the whole chain is resolved (and inlined) at
+// compile time; there are no virtual calls.
+//
+//     typedef FilterPipeline<MedianFilter<3>, EMAFilter<1>, DeadbandFilter<16, 0, 4095> > KnobFilter;
+
+
+// median of the last N samples; knocks out single sample spikes
+template <int N>
+class MedianFilter
+{
+  public:
+    MedianFilter() : next(0) { reset(0); }
+
+    int
+    update(int value)
+    {
+        history[next] = value;
+        next = (next + 1) % N;
+
+        int sorted[N];
+        for (int i = 0; i < N; i++) {
+            // insertion sort; N is tiny
+            int j = i;
+            while (j > 0 && sorted[j - 1] > history[i]) {
+                sorted[j] = sorted[j - 1];
+                j--;
+            }
+            sorted[j] = history[i];
+        }
+
+        return sorted[N / 2];
+    }
+
+    void
+    reset(int value)
+    {
+        for (int i = 0; i < N; i++) {
+            history[i] = value;
+        }
+    }
+
+  private:
+    int history[N];
+    int next;
+};
+
+
+// exponential moving average with a weight of 1/2^Shift for each new
+// sample, kept with 8 fractional bits so that small steps aren't lost
+template <int Shift>
+class EMAFilter
+{
+  public:
+    EMAFilter() : state(0) {}
+
+    int
+    update(int value)
+    {
+        state += ((value << 8) - state) >> Shift;
+        return (state + 128) >> 8;
+    }
+
+    void
+    reset(int value)
+    {
+        state = value << 8;
+    }
+
+  private:
+    int32_t state;
+};
+
+
+// hysteresis: the output only follows the input once it has moved more
+// than Width away, which stops a value sitting on a boundary from
+// flickering.  Inputs within Width of either end snap to that end, so the
+// full range stays reachable.
+template <int Width, int Min, int Max>
+class DeadbandFilter
+{
+  public:
+    DeadbandFilter() : output(Min) {}
+
+    int
+    update(int value)
+    {
+        if (value <= Min + Width) {
+            output = Min;
+        }
+        else if (value >= Max - Width) {
+            output = Max;
+        }
+        else if (value > output + Width) {
+            output = value - Width;
+        }
+        else if (value < output - Width) {
+            output = value + Width;
+        }
+        return output;
+    }
+
+    void
+    reset(int value)
+    {
+        output = value;
+    }
+
+  private:
+    int output;
+};
+
+
+// limits how far the output can move per sample
+template <int MaxStep>
+class SlewLimitFilter
+{
+  public:
+    SlewLimitFilter() : output(0) {}
+
+    int
+    update(int value)
+    {
+        if (value > output + MaxStep) {
+            output += MaxStep;
+        }
+        else if (value < output - MaxStep) {
+            output -= MaxStep;
+        }
+        else {
+            output = value;
+        }
+        return output;
+    }
+
+    void
+    reset(int value)
+    {
+        output = value;
+    }
+
+  private:
+    int output;
+};
+
+
+// runs each stage in order, the output of one feeding the next
+template <typename... Stages>
+class FilterPipeline;
+
+template <>
+class FilterPipeline<>
+{
+  public:
+    int  update(int value) { return value; }
+    void reset(int) {}
+};
+
+template <typename First, typename... Rest>
+class FilterPipeline<First, Rest...>
+{
+  public:
+    int
+    update(int value)
+    {
+        return rest.update(first.update(value));
+    }
+
+    void
+    reset(int value)
+    {
+        first.reset(value);
+        rest.reset(value);
+    }
+
+  private:
+    First                  first;
+    FilterPipeline<Rest...> rest;
+};
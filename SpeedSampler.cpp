@@ -0,0 +1,212 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "SpeedSampler.h"
+
+#include "soc/syscon_struct.h"
+
+#define SPEED_SAMPLER_I2S_PORT   (I2S_NUM_0)
+
+// The ADC samples at this rate, into a ring of DMA buffers.  The ring holds
+// a little more than the 50ms between speed reports, so a report averages
+// everything sampled since the previous one.
+#define SPEED_SAMPLE_RATE        (10000)   // Hz
+#define SPEED_DMA_BUFFER_COUNT   (4)
+#define SPEED_DMA_BUFFER_SAMPLES (256)
+#define SPEED_RING_SAMPLES       (SPEED_DMA_BUFFER_COUNT * SPEED_DMA_BUFFER_SAMPLES)
+
+// each 16 bit sample from the I2S ADC carries its channel in the top nibble
+#define SAMPLE_CHANNEL(s)        ((s) >> 12)
+#define SAMPLE_VALUE(s)          ((s) & 0x0FFF)
+
+// an entry in the ADC1 scan pattern table: channel, width and attenuation
+#define PATTERN_ENTRY(channel)   (((channel) << 4) | (ADC_WIDTH_BIT_12 << 2) | ADC_ATTEN_DB_11)
+
+
+SpeedSampler::SpeedSampler() :
+    channelCount(0),
+    running(false),
+    lowPower(false),
+    samples(NULL)
+{
+}
+
+
+bool
+SpeedSampler::begin(const adc1_channel_t *channels, int count)
+{
+    if (count < 1 || count > SPEED_SAMPLER_MAX_CHANNELS) {
+        return false;
+    }
+
+    channelCount = count;
+    for (int i = 0; i < count; i++) {
+        this->channels[i] = channels[i];
+    }
+
+    i2s_config_t config;
+    memset(&config, 0, sizeof(config));
+
+    config.mode                 = (i2s_mode_t) (I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN);
+    config.sample_rate          = SPEED_SAMPLE_RATE;
+    config.bits_per_sample      = I2S_BITS_PER_SAMPLE_16BIT;
+    config.channel_format       = I2S_CHANNEL_FMT_ONLY_LEFT;
+    config.communication_format = I2S_COMM_FORMAT_I2S_MSB;
+    config.intr_alloc_flags     = ESP_INTR_FLAG_LEVEL1;
+    config.dma_buf_count        = SPEED_DMA_BUFFER_COUNT;
+    config.dma_buf_len          = SPEED_DMA_BUFFER_SAMPLES;
+    config.use_apll             = false;
+
+    if (i2s_driver_install(SPEED_SAMPLER_I2S_PORT, &config, 0, NULL) != ESP_OK) {
+        return false;
+    }
+
+    adc1_config_width(ADC_WIDTH_BIT_12);
+    for (int i = 0; i < count; i++) {
+        adc1_config_channel_atten(channels[i], ADC_ATTEN_DB_11);
+    }
+
+    // sets up a single channel pattern; resume() extends it to the rest
+    if (i2s_set_adc_mode(ADC_UNIT_1, channels[0]) != ESP_OK) {
+        return false;
+    }
+
+    samples = new uint16_t[SPEED_RING_SAMPLES];
+
+    resume();
+    return true;
+}
+
+
+bool
+SpeedSampler::read(int *values)
+{
+    if (lowPower) {
+        bool ok = true;
+        for (int i = 0; i < channelCount; i++) {
+            adc1_config_channel_atten(channels[i], ADC_ATTEN_DB_11);
+            values[i] = adc1_get_raw(channels[i]);
+            ok &= values[i] >= 0;
+        }
+        return ok;
+    }
+
+    if (!running) {
+        return false;
+    }
+
+    // never blocks: only DMA buffers that are already complete are returned
+    size_t bytesRead = 0;
+    i2s_read(SPEED_SAMPLER_I2S_PORT, samples, SPEED_RING_SAMPLES * sizeof(uint16_t), &bytesRead, 0);
+
+    uint32_t sum[SPEED_SAMPLER_MAX_CHANNELS] = { 0 };
+    uint32_t count[SPEED_SAMPLER_MAX_CHANNELS] = { 0 };
+
+    for (size_t i = 0; i < bytesRead / sizeof(uint16_t); i++) {
+        int sampleChannel = SAMPLE_CHANNEL(samples[i]);
+        for (int c = 0; c < channelCount; c++) {
+            if (sampleChannel == channels[c]) {
+                sum[c] += SAMPLE_VALUE(samples[i]);
+                count[c]++;
+                break;
+            }
+        }
+    }
+
+    for (int c = 0; c < channelCount; c++) {
+        if (count[c] == 0) {
+            return false;
+        }
+        values[c] = sum[c] / count[c];
+    }
+
+    return true;
+}
+
+
+void
+SpeedSampler::pause()
+{
+    if (running) {
+        i2s_adc_disable(SPEED_SAMPLER_I2S_PORT);
+        running = false;
+    }
+}
+
+
+void
+SpeedSampler::resume()
+{
+    if (!samples) {
+        // never started (the speed knob isn't a potentiometer)
+        return;
+    }
+
+    if (!running && !lowPower) {
+        // throw away anything left in the ring from before the pause
+        size_t bytesRead = 0;
+        i2s_read(SPEED_SAMPLER_I2S_PORT, samples, SPEED_RING_SAMPLES * sizeof(uint16_t), &bytesRead, 0);
+
+        i2s_adc_enable(SPEED_SAMPLER_I2S_PORT);
+        setPattern();
+        running = true;
+    }
+}
+
+
+// i2s_adc_enable() puts back the single channel pattern that
+// i2s_set_adc_mode() set up, so this is needed after every one.  Each
+// pattern table word holds four entries, first entry in the top byte.
+void
+SpeedSampler::setPattern()
+{
+    if (channelCount < 2) {
+        return;
+    }
+
+    uint32_t table = 0;
+    for (int i = 0; i < channelCount; i++) {
+        table |= (uint32_t) PATTERN_ENTRY(channels[i]) << (24 - 8 * i);
+    }
+
+    SYSCON.saradc_sar1_patt_tab[0] = table;
+    SYSCON.saradc_ctrl.sar1_patt_len = channelCount - 1;
+}
+
+
+void
+SpeedSampler::setLowPower(bool newLowPower)
+{
+    if (newLowPower == lowPower || !samples) {
+        return;
+    }
+
+    if (newLowPower) {
+        pause();
+        i2s_stop(SPEED_SAMPLER_I2S_PORT);
+        lowPower = true;
+    }
+    else {
+        // i2s_adc_enable() restarts the I2S clock
+        lowPower = false;
+        resume();
+    }
+}
@@ -0,0 +1,74 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include "Arduino.h"
+
+#include "driver/adc.h"
+#include "driver/i2s.h"
+
+
+// the ADC's scan pattern table is used for up to this many channels
+#define SPEED_SAMPLER_MAX_CHANNELS (4)
+
+
+// Continuously samples one or more ADC1 channels into a DMA ring, using
+// the I2S peripheral's built-in ADC mode.  Once started, the hardware
+// keeps the ring filled at SPEED_SAMPLE_RATE (shared between the channels)
+// without any CPU involvement; read() drains whatever has arrived since
+// the last call and averages it, channel by channel.
+//
+// While the sampler is running, ADC1 belongs to the I2S peripheral.  Any
+// other ADC1 reading (analogRead, adc1_get_raw) must be bracketed by
+// pause() and resume().
+class SpeedSampler
+{
+  public:
+    SpeedSampler();
+
+    // sample count channels, scanned in turn (at most SPEED_SAMPLER_MAX_CHANNELS)
+    bool begin(const adc1_channel_t *channels, int count);
+
+    // average of the samples taken since the last read for each channel,
+    // 0-4095, in the order given to begin()
+    //   return false if any channel has no new samples
+    bool read(int *values);
+
+    void pause();
+    void resume();
+
+    // Stop the I2S clock and DMA, which otherwise keep the APB clock up
+    // (and the chip out of light sleep), and take a single direct ADC
+    // reading on each read() instead.
+    void setLowPower(bool lowPower);
+
+  private:
+    void           setPattern();
+
+    adc1_channel_t channels[SPEED_SAMPLER_MAX_CHANNELS];
+    int            channelCount;
+    bool           running;
+    bool           lowPower;
+    uint16_t       *samples;
+};
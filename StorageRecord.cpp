@@ -0,0 +1,147 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "StorageRecord.h"
+
+#include <string.h>
+
+#include <algorithm>
+
+
+// on-flash layout: this header, followed by `length` bytes of payload
+typedef struct __attribute__((packed)) RecordHeader {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t length;      // of the payload
+    uint32_t sequence;
+    uint32_t crc;         // CRC32 of the header (with crc = 0) and payload
+} RecordHeader;
+
+
+uint32_t
+crc32(uint32_t crc, const uint8_t *data, size_t length)
+{
+    crc = ~crc;
+    while (length--) {
+        crc ^= *data++;
+        for (int bit = 0; bit < 8; bit++) {
+            crc = (crc >> 1) ^ (0xEDB88320 & -(crc & 1));
+        }
+    }
+    return ~crc;
+}
+
+
+static uint32_t
+recordCRC(RecordHeader header, const uint8_t *payload, size_t length)
+{
+    header.crc = 0;
+    uint32_t crc = crc32(0, (const uint8_t *) &header, sizeof(header));
+    return crc32(crc, payload, length);
+}
+
+
+bool
+writeRecord(ThrottleStorage& storage, const std::string& path,
+            uint32_t magic, uint16_t version, uint32_t sequence,
+            const std::string& payload)
+{
+    if (payload.size() > UINT16_MAX) {
+        return false;
+    }
+
+    RecordHeader header;
+    header.magic    = magic;
+    header.version  = version;
+    header.length   = payload.size();
+    header.sequence = sequence;
+    header.crc      = recordCRC(header, (const uint8_t *) payload.data(), payload.size());
+
+    std::string record((const char *) &header, sizeof(header));
+    record += payload;
+
+    return storage.writeFile(path, record);
+}
+
+
+bool
+readRecord(ThrottleStorage& storage, const std::string& path,
+           uint32_t magic, uint16_t *version, uint32_t *sequence,
+           std::string& payload)
+{
+    std::string record;
+    RecordHeader header;
+
+    if (!storage.readFile(path, record) || record.size() < sizeof(header)) {
+        return false;
+    }
+    memcpy(&header, record.data(), sizeof(header));
+
+    if (header.magic != magic || record.size() != sizeof(header) + header.length) {
+        return false;
+    }
+    if (recordCRC(header, (const uint8_t *) record.data() + sizeof(header), header.length) != header.crc) {
+        return false;
+    }
+
+    payload.assign(record, sizeof(header), header.length);
+    *version = header.version;
+    *sequence = header.sequence;
+
+    return true;
+}
+
+
+void
+RecordWriter::putString(const std::string& value)
+{
+    // the length is stored in a single byte
+    size_t length = std::min(value.size(), (size_t) 255);
+
+    payload += (char) length;
+    payload.append(value, 0, length);
+}
+
+
+bool
+RecordReader::getBytes(void *bytes, size_t count)
+{
+    if (offset + count > length) {
+        return false;
+    }
+    memcpy(bytes, payload + offset, count);
+    offset += count;
+    return true;
+}
+
+
+bool
+RecordReader::getString(std::string& value)
+{
+    uint8_t count;
+
+    if (!getU8(count) || offset + count > length) {
+        return false;
+    }
+    value.assign((const char *) payload + offset, count);
+    offset += count;
+    return true;
+}
@@ -0,0 +1,87 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+
+#include "ThrottleStorage.h"
+
+
+// A record is a small header followed by a payload, written as a single
+// file.  The header carries a magic number identifying what the record
+// holds, a schema version, the payload length, a sequence number and a
+// CRC32 over both, so that a torn or stale write is never mistaken for
+// good data.
+//
+// Payloads are built with RecordWriter and taken apart with RecordReader.
+// Strings are stored as a one byte length followed by that many bytes.
+
+uint32_t crc32(uint32_t crc, const uint8_t *data, size_t length);
+
+bool writeRecord(ThrottleStorage& storage, const std::string& path,
+                 uint32_t magic, uint16_t version, uint32_t sequence,
+                 const std::string& payload);
+
+// return false if the file is missing, or isn't a valid record of this kind
+bool readRecord(ThrottleStorage& storage, const std::string& path,
+                uint32_t magic, uint16_t *version, uint32_t *sequence,
+                std::string& payload);
+
+
+class RecordWriter
+{
+  public:
+    void putU8(uint8_t value)   { payload += (char) value; }
+    void putU16(uint16_t value) { putBytes(&value, sizeof(value)); }
+    void putU32(uint32_t value) { putBytes(&value, sizeof(value)); }
+    void putBytes(const void *bytes, size_t length) { payload.append((const char *) bytes, length); }
+    void putString(const std::string& value);
+
+    std::string payload;
+};
+
+
+// walks a payload, refusing to read past its end
+class RecordReader
+{
+  public:
+    RecordReader(const std::string& payload) :
+        payload((const uint8_t *) payload.data()), length(payload.size()), offset(0)
+    {
+    }
+
+    bool getU8(uint8_t& value)   { return getBytes(&value, sizeof(value)); }
+    bool getU16(uint16_t& value) { return getBytes(&value, sizeof(value)); }
+    bool getU32(uint32_t& value) { return getBytes(&value, sizeof(value)); }
+    bool getBytes(void *bytes, size_t count);
+    bool getString(std::string& value);
+
+  private:
+    const uint8_t *payload;
+    size_t length;
+    size_t offset;
+};
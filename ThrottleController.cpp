@@ -35,20 +35,73 @@ using namespace std::placeholders;   // for std::bind
 // rescan for new networks every this often
 #define WIFI_RETRY_DELAY_TIME  (15000) // ms
 
+// going straight back to a known access point takes well under a second;
+// after this long, do the scan and DHCP instead
+#define FAST_JOIN_TIMEOUT       (3000)  // ms
+
+// a WiThrottle server sends its version as soon as it's connected to
+#define SERVER_HANDSHAKE_TIMEOUT (5000)  // ms
+
+// start driving anyway, if the locomotives haven't all come back by then
+#define LOCO_ACQUIRE_TIMEOUT     (3000)  // ms
+
+// wait between tries at the server, doubling each time
+#define SERVER_BACKOFF_MIN       (500)   // ms
+#define SERVER_BACKOFF_MAX       (30000) // ms
+
+
+// must match ConnectionState in ThrottleController.h
+static const char *connectionStateNames[CSTATE_COUNT] = {
+    "WIFI_SCAN",
+    "WIFI_JOIN",
+    "WIFI_RETRY",
+    "SERVER_CONNECT",
+    "HANDSHAKE",
+    "ACQUIRE",
+    "ACTIVE",
+    "BACKOFF",
+};
+
 
 ThrottleController::ThrottleController():
     client(),
     hw(),
-    wiThrottle(),
+    connection(),
+    cabs(),
+    cabCount(1),
+    activeCab(0),
+    commandPending(false),
+    commandInputAt(0),
     port(12090),
     wifiService(flashData),
+    journalService(journal),
     bleServer(NULL),
     flashData(),
+    roster(),
+    journal(),
     restartWifiOnNextCycle(false),
-    wifiRetryCheck(),
-    addressIsSelected(false)
+    connector(),
+    connectionState(CSTATE_WIFI_SCAN),
+    connectionStateEnteredAt(0),
+    connectingSince(0),
+    backoffDelay(SERVER_BACKOFF_MIN),
+    serverVersionReceived(false),
+    leaseReused(false),
+    awaitingFirstSpeed(true),
+    speedCommandPending(false),
+    wifiGotAddress(false),
+    wifiLost(false)
 {
     // hw.console->println("ThrottleController constructed");
+
+    memset(connectionStateTime, 0, sizeof(connectionStateTime));
+
+    for (int cab = 0; cab < MAX_CABS; cab++) {
+        cabs[cab].addressIsSelected = false;
+        cabs[cab].addressAcquired = false;
+        cabs[cab].speed = 0;
+        cabs[cab].togglePosition = UnknownPosition;
+    }
 }
 
 
@@ -60,6 +113,8 @@ ThrottleController::setThrottleState(ThrottleState newState)
         return;
     }
 
+    journal.log(JOURNAL_STATE, newState);
+
     // we have a new state
     switch (newState) {
         case TSTATE_UNKNOWN:
@@ -70,17 +125,17 @@ ThrottleController::setThrottleState(ThrottleState newState)
         case TSTATE_WIFI_DISCONNECTED:
             hw.console->println("TSTATE_WIFI_DISCONNECTED");
             wifiService.setConnectionState("WIFI_DISCONNECTED");
-            hw.setRGB(0, 0xFF, 0x00, 0x00);
+            hw.setRGB(0, 0xFF, 0x00, 0x00, LEDFastBlink);
             break;
         case TSTATE_WIFI_CONNECTED:
             hw.console->println("TSTATE_WIFI_CONNECTED");
             wifiService.setConnectionState("WIFI_CONNECTED");
-            hw.setRGB(0, 0xFF, 0x00, 0xFF);
+            hw.setRGB(0, 0xFF, 0x00, 0xFF, LEDBreathe);
             break;
         case TSTATE_WITHROTTLE_CONNECTED:
             hw.console->println("TSTATE_WITHROTTLE_CONNECTED");
             wifiService.setConnectionState("WITHROTTLE_CONNECTED");
-            hw.setRGB(0, 0x00, 0xFF, 0x00);
+            hw.setRGB(0, 0x00, 0xFF, 0x00, LEDFade);
             break;
         case TSTATE_WITHROTTLE_ACTIVE:
             hw.console->println("TSTATE_WITHROTTLE_ACTIVE");
@@ -97,6 +152,40 @@ ThrottleController::setThrottleState(ThrottleState newState)
 }
 
 
+void
+ThrottleController::setConnectionState(ConnectionState newState)
+{
+    uint32_t spent = timeInState();
+    connectionStateTime[connectionState] += spent;
+
+    hw.console->printf("connection: %s -> %s after %u ms\n",
+                       connectionStateNames[connectionState], connectionStateNames[newState], spent);
+
+    // time spent driving says nothing about connecting
+    if (connectionState != CSTATE_ACTIVE) {
+        journal.log(JOURNAL_CONNECTION, min(spent / 10, (uint32_t) INT16_MAX), connectionState);
+    }
+
+    if (newState == CSTATE_ACTIVE) {
+        hw.console->printf("connection: ready to drive %lu ms after ", millis() - connectingSince);
+        hw.console->println(connectingSince ? "the connection was lost" : "starting");
+
+        hw.console->printf("connection: total ms in each state:");
+        for (int state = 0; state < CSTATE_COUNT; state++) {
+            hw.console->printf(" %s %u", connectionStateNames[state], connectionStateTime[state]);
+        }
+        hw.console->println();
+    }
+    else if (connectionState == CSTATE_ACTIVE) {
+        connectingSince = millis();
+        awaitingFirstSpeed = true;
+    }
+
+    connectionState = newState;
+    connectionStateEnteredAt = millis();
+}
+
+
 #if 0
 void
 ThrottleController::readAccelerometer()
@@ -145,6 +234,7 @@ ThrottleController::setupBLE()
     wifiService.begin(bleServer, hw.console);
     throttleService.begin(bleServer, hw.console);
     batteryService.begin(bleServer, hw.console);
+    journalService.begin(bleServer, hw.console);
 
     deviceInfoService.setMfgName(MANUFACTURER_NAME);
     deviceInfoService.setModelNumber(MODEL_NUMBER);
@@ -158,22 +248,117 @@ bool
 ThrottleController::begin()
 {
     hw.begin();
+    governor.begin(hw.console);
+
+    cabCount = constrain(hw.cabCount(), 1, MAX_CABS);
+    connection.begin(cabCount, hw.console, this);
+    connector.begin(hw.console);
+    for (int cab = 0; cab < cabCount; cab++) {
+        cabs[cab].wiThrottle.begin(hw.console);
+        cabs[cab].delegate.attach(this, cab);
+    }
 
-    wiThrottle.begin(hw.console);
     flashData.begin(hw.console);
+    roster.begin(hw.console);
+    journal.begin(hw.console);
 
     setupBLE();
 
-    wiThrottle.delegate      = this;    // set up callbacks for various WiThrottle activities
+    // pick up where we left off (on the first cab); the loco is acquired
+    // once the WiThrottle connection is up, but what we know about it can
+    // be shown right away
+    cabs[0].selectedAddress = roster.getLastSelectedAddress().c_str();
+    throttleService.setSelectedAddress(roster.getLastSelectedAddress());
+    publishLocomotiveDetails(roster.getLastSelectedAddress());
+
+    for (int cab = 0; cab < cabCount; cab++) {
+        // set up callbacks for various WiThrottle activities
+        cabs[cab].wiThrottle.delegate = &cabs[cab].delegate;
+    }
     wifiService.delegate     = this;    // appropriate callbacks for BLE Wifi service
     throttleService.delegate = this;  // callbacks for the throttleService
     hw.delegate              = this;    // and for hardware changes
 
+    // once only: the handler stays registered across reconnects
+    WiFi.onEvent(std::bind(&ThrottleController::wifiEvent, this, _1));
+    WiFi.mode(WIFI_MODE_STA);
+    wifiService.setDeviceMac(WiFi.macAddress().c_str());
+
+    if (!fastJoin()) {
+        startWifi();
+    }
+
     hw.console->println("ThrottleController.begin complete");
 }
 
 
 
+// Wait for something to do (rather than spinning), then do it.  Used by
+// every loop that's waiting on the network.
+void
+ThrottleController::serviceInputs()
+{
+    switch (governor.wait()) {
+        case PowerWake:
+            hw.setLowPower(false);
+            break;
+        case PowerIdle:
+            hw.setLowPower(true);
+            break;
+        case PowerNoChange:
+            break;
+    }
+
+    hw.check();
+    flashData.check();
+    roster.check();
+}
+
+
+// Write everything the cabs have queued to the server, as one write.
+// Called once per pass through the loop.
+void
+ThrottleController::sendCommands()
+{
+    bool speedQueued = speedCommandPending;
+    speedCommandPending = false;
+
+    if (connection.send() == 0) {
+        return;
+    }
+
+    if (commandPending) {
+        commandPending = false;
+        commandSent(commandInputAt);
+        commandInputAt = 0;
+    }
+
+    // how long the train was out of reach: from power on, or from losing
+    // the connection, to the first speed the server hears from us
+    if (speedQueued && awaitingFirstSpeed) {
+        awaitingFirstSpeed = false;
+
+        uint32_t elapsed = millis() - connectingSince;
+        hw.console->printf("connection: first speed sent %u ms after %s\n",
+                           elapsed, connectingSince ? "the connection was lost" : "power on");
+        journal.log(JOURNAL_FIRST_SPEED, min(elapsed / 10, (uint32_t) INT16_MAX), connectingSince ? 1 : 0);
+    }
+}
+
+
+// called after a command the throttle's user caused is sent, with the
+// micros() timestamp of the input behind it (0 if not known)
+void
+ThrottleController::commandSent(uint32_t inputAt)
+{
+    uint32_t wakeLatency = governor.commandSent(inputAt);
+    if (wakeLatency) {
+        journal.log(JOURNAL_WAKE_LATENCY, min(wakeLatency / 100, (uint32_t) INT16_MAX));
+        hw.console->printf("power: %u us from the input that woke us to command sent\n", wakeLatency);
+    }
+}
+
+
 void
 ThrottleController::test_loop()
 {
@@ -198,36 +383,152 @@ ThrottleController::test_loop()
 
 
 
-// This loop waits for the WiFi connection, and the WiThrottle connection
-// once that's lost, it exits and restarts
+// One pass: wait for something to do, move the connection along as far as
+// it can go without blocking, and send whatever the cabs have queued.  The
+// knob and buttons are handled on every pass, whatever state the
+// connection is in.
+void
+ThrottleController::loop()
+{
+    serviceInputs();
+    handleWifiEvents();
+
+    if (restartWifiOnNextCycle) {
+        restartWifiOnNextCycle = false;
+        hw.console->printf("restarting WiFi with the new settings\n");
+        dropServer();
+        WiFi.disconnect();
+        startWifi();
+    }
+
+    runConnection();
+
+    // everything from this pass goes out together
+    sendCommands();
+}
 
-// unlike the usual Arduino loop() which is called many many times a second
-// this one contains its own tight repeat loop for action checks
 
 void
-ThrottleController::loop()
+ThrottleController::runConnection()
 {
-    bool nameSent = false;
+    switch (connectionState) {
+        case CSTATE_WIFI_SCAN:
+            if (wifiService.scanFinished()) {
+                joinNetwork();
+            }
+            break;
 
-    // BLE is not connected at this time, nor is WiFI
-    setThrottleState(TSTATE_WIFI_DISCONNECTED);
+        case CSTATE_WIFI_JOIN:
+            if (leaseReused && timeInState() > FAST_JOIN_TIMEOUT) {
+                hw.console->printf("fast connect failed, scanning\n");
+                WiFi.disconnect();
+                startWifi();
+            }
+            else if (timeInState() > WIFI_CONNECTION_TIMEOUT) {
+                hw.console->printf("no WiFi connection, disconnecting\n");
+                WiFi.disconnect();
+                setConnectionState(CSTATE_WIFI_RETRY);
+            }
+            break;
 
-    hw.console->println("wifi is disconnected");
+        case CSTATE_WIFI_RETRY:
+            if (timeInState() > WIFI_RETRY_DELAY_TIME) {
+                startWifi();
+            }
+            break;
 
-    WiFi.mode(WIFI_MODE_STA);
-    wifiService.setDeviceMac(WiFi.macAddress().c_str());
+        case CSTATE_SERVER_CONNECT:
+            switch (connector.poll()) {
+                case ConnectPending:
+                    break;
+                case ConnectSucceeded:
+                    serverConnected();
+                    break;
+                case ConnectFailed:
+                    if (leaseReused) {
+                        // the saved address may be what's wrong
+                        hw.console->printf("no server with the saved address, asking DHCP for a new one\n");
+                        flashData.forgetLease();
+                        WiFi.disconnect();
+                        startWifi();
+                    }
+                    else {
+                        backOff();
+                    }
+                    break;
+            }
+            break;
 
-    hw.console->printf("start of loop(): disconnecting\n");
-    WiFi.onEvent(std::bind(&ThrottleController::wifiEvent, this, _1));
-    //WiFi.disconnect();
-    delay(100);
+        case CSTATE_HANDSHAKE:
+        case CSTATE_ACQUIRE:
+        case CSTATE_ACTIVE:
+            serviceServer();
+            break;
+
+        case CSTATE_BACKOFF:
+            if (timeInState() > backoffDelay) {
+                backoffDelay = min(backoffDelay * 2, (uint32_t) SERVER_BACKOFF_MAX);
+                startServerConnect();
+            }
+            break;
+
+        default:
+            break;
+    }
+}
+
+
+// WiFi events arrive on the event task; they're acted on here
+void
+ThrottleController::handleWifiEvents()
+{
+    if (wifiLost) {
+        wifiLost = false;
+        wifiOnDisconnect();
+    }
+    if (wifiGotAddress) {
+        wifiGotAddress = false;
+        wifiOnConnect();
+    }
+}
+
+
+// scan for networks; the best known one is joined once the scan is done
+void
+ThrottleController::startWifi()
+{
+    useDHCP();
+    setThrottleState(TSTATE_WIFI_DISCONNECTED);
+    wifiService.startScan();
+    setConnectionState(CSTATE_WIFI_SCAN);
+}
+
+
+// pick the best known network out of the scan, and go straight to the
+// access point that was seen for it
+void
+ThrottleController::joinNetwork()
+{
+    int scanEntry = -1;
+    int profile = flashData.matchProfiles(wifiService.getScanResults(), &scanEntry);
+    if (profile >= 0) {
+        hw.console->printf("using network profile %d\n", profile);
+        flashData.selectProfile(profile);
+    }
 
     std::string ssid = flashData.getWifiSSID();
     std::string password = flashData.getWifiPassword();
 
     hw.console->printf("Wifi SSID: '%s', Password: '%s'\n", ssid.c_str(), password.c_str());
 
-    if (password == "") {
+    const char *passphrase = (password == "") ? NULL : password.c_str();
+
+    if (scanEntry >= 0) {
+        const NetworkScanEntry& ap = wifiService.getScanResults()[scanEntry];
+        hw.console->printf("Connecting to Wifi SSID:'%s' on channel %d\n", ssid.c_str(), ap.channel);
+        WiFi.begin(ssid.c_str(), passphrase, ap.channel, ap.bssid);
+    }
+    else if (password == "") {
         hw.console->printf("Connecting to Wifi SSID:'%s' (with no password)\n", ssid.c_str());
         WiFi.begin(ssid.c_str());
     }
@@ -236,113 +537,229 @@ ThrottleController::loop()
         WiFi.begin(ssid.c_str(), password.c_str());
     }
 
-    bool connectionBegun = true;
+    setConnectionState(CSTATE_WIFI_JOIN);
+}
 
-    while (WiFi.status() != WL_CONNECTED) {
-        hw.check();
-        if (restartWifiOnNextCycle) {
-            goto end;
-        }
 
-        if (connectionBegun) {
-            if (wifiRetryCheck.hasPassed(WIFI_CONNECTION_TIMEOUT)) {
-                wifiRetryCheck.restart();
-                hw.console->printf("disconnect in WiFi wait loop\n");
-                WiFi.disconnect();
-                delay(100);
-                connectionBegun = false;
-            }
-        }
-        else if (wifiRetryCheck.hasPassed(WIFI_RETRY_DELAY_TIME)) {
-            wifiRetryCheck.restart();
-            wifiService.scanNetworks();
-        }
+// Go straight back to the access point, channel and address that the
+// current profile had last time, with no scan and no DHCP.
+//   return false if there's nothing saved to go back to
+bool
+ThrottleController::fastJoin()
+{
+    static const uint8_t noBSSID[6] = { 0 };
+    NetworkProfile profile = flashData.getProfile();
+
+    if (profile.ssid.empty() || profile.channel == 0 || profile.lease.address == 0
+        || memcmp(profile.bssid, noBSSID, sizeof(noBSSID)) == 0) {
+        return false;
     }
 
-    // light blue when connected to WiThrottle server
-    setThrottleState(TSTATE_WIFI_CONNECTED);
+    IPAddress address(profile.lease.address);
+    hw.console->printf("Fast connect to Wifi SSID:'%s' on channel %d as %s\n",
+                       profile.ssid.c_str(), profile.channel, address.toString().c_str());
 
-    hw.console->println("wifi connected");
+    WiFi.config(address, IPAddress(profile.lease.gateway), IPAddress(profile.lease.netmask),
+                IPAddress(profile.lease.dns));
+    leaseReused = true;
 
-    while (! client.connected()) {
-        hw.check();
-        std::string host = flashData.getServerAddress();
-        if (!client.connect(host.c_str(), port)) {
-            hw.console->printf("connection to %s:%d failed\n", host.c_str(), port);
-        }
-        else {
-            hw.console->println("connection succeeded");
-            client.setNoDelay(true); // disable Nagle & packet coalescing
-            wiThrottle.connect(&client);
-        }
-#if 0
-        if (wifiRetryCheck.hasPassed(WIFI_RETRY_DELAY_TIME)) {
-            wifiRetryCheck.restart();
-            wifiService.scanNetworks();
-        }
-#endif
+    const char *passphrase = profile.password.empty() ? NULL : profile.password.c_str();
+    WiFi.begin(profile.ssid.c_str(), passphrase, profile.channel, profile.bssid);
+
+    setThrottleState(TSTATE_WIFI_DISCONNECTED);
+    setConnectionState(CSTATE_WIFI_JOIN);
+    return true;
+}
+
+
+// stop using the saved address; the next join asks DHCP for one
+void
+ThrottleController::useDHCP()
+{
+    if (leaseReused) {
+        WiFi.config(IPAddress((uint32_t) 0), IPAddress((uint32_t) 0), IPAddress((uint32_t) 0));
+        leaseReused = false;
     }
+}
 
-    while (true) {
-        hw.check();
 
-        if (wiThrottle.check()) {
-            if (wiThrottle.clockChanged) {
-                updateFastTimeDisplay();
-            }
-            if (wiThrottle.heartbeatChanged) {
-                wiThrottle.requireHeartbeat();
-            }
-            if (! client.connected()) {
-                hw.console->printf("no client connected, disconnecting the withrottle\n");
-                setThrottleState(TSTATE_WIFI_DISCONNECTED);
-                wiThrottle.disconnect();
-                return;
-            }
+void
+ThrottleController::startServerConnect()
+{
+    std::string host = flashData.getServerAddress();
+    port = atoi(flashData.getServerPort().c_str());
+
+    hw.console->printf("connecting to %s:%d\n", host.c_str(), port);
+    connector.start(host.c_str(), port);
+    setConnectionState(CSTATE_SERVER_CONNECT);
+}
 
-            if (!nameSent) {
-                wiThrottle.setDeviceName(flashData.getDeviceName().c_str());
-                nameSent = true;
 
-                wiThrottle.setDeviceID("BKT0");
-            }
+void
+ThrottleController::serverConnected()
+{
+    connector.attach(&client);
+
+    hw.console->println("connection succeeded");
+    journal.log(JOURNAL_SERVER_CONNECTED);
+    client.setNoDelay(true); // disable Nagle & packet coalescing
 
-            if (!addressIsSelected) {
-                if (selectedAddress != "") {
-                    hw.console->print("release current address ");
-                    hw.console->println(selectedAddress);
+    connection.connect(&client);
+    for (int cab = 0; cab < cabCount; cab++) {
+        cabs[cab].wiThrottle.connect(connection.stream(cab));
+    }
+
+    // introduce ourselves; the server answers with its version
+    serverVersionReceived = false;
+    cabs[0].wiThrottle.setDeviceName(flashData.getDeviceName().c_str());
+    cabs[0].wiThrottle.setDeviceID("BKT0");
+
+    setConnectionState(CSTATE_HANDSHAKE);
+}
 
-                    // deselect the current address; setting it to 0 speed first
-                    wiThrottle.setSpeed(0);
-                    wiThrottle.releaseLocomotive();
 
-                    addressIsSelected = wiThrottle.addLocomotive(selectedAddress);
+// Everything once the server is connected: read what it sent, watch for
+// it going away, and move from the handshake to driving
+void
+ThrottleController::serviceServer()
+{
+    connection.receive();
 
-                    std::string sa = selectedAddress.c_str();
-                    throttleService.setSelectedAddress(sa);
-                    setThrottleState(TSTATE_WITHROTTLE_ACTIVE);
+    bool changed = false;
+    for (int cab = 0; cab < cabCount; cab++) {
+        changed |= cabs[cab].wiThrottle.check();
+    }
+
+    if (changed) {
+        // what's about the connection as a whole only comes to cab 0
+        WiThrottle& wiThrottle = cabs[0].wiThrottle;
+
+        if (wiThrottle.clockChanged) {
+            updateFastTimeDisplay();
+        }
+        if (wiThrottle.heartbeatChanged) {
+            wiThrottle.requireHeartbeat();
+        }
+    }
+
+    if (! client.connected()) {
+        hw.console->printf("no client connected, disconnecting the withrottle\n");
+        journal.log(JOURNAL_SERVER_DISCONNECTED);
+        backOff();
+        return;
+    }
+
+    switch (connectionState) {
+        case CSTATE_HANDSHAKE:
+            if (serverVersionReceived) {
+                for (int cab = 0; cab < cabCount; cab++) {
+                    acquireLocomotive(cab);
                 }
+                setConnectionState(CSTATE_ACQUIRE);
             }
-        }
+            else if (timeInState() > SERVER_HANDSHAKE_TIMEOUT) {
+                hw.console->printf("no reply from the server\n");
+                backOff();
+            }
+            break;
+
+        case CSTATE_ACQUIRE:
+            if (locomotivesAcquired() || timeInState() > LOCO_ACQUIRE_TIMEOUT) {
+                backoffDelay = SERVER_BACKOFF_MIN;
+                setConnectionState(CSTATE_ACTIVE);
+            }
+            break;
+
+        case CSTATE_ACTIVE:
+            // a newly selected address
+            for (int cab = 0; cab < cabCount; cab++) {
+                acquireLocomotive(cab);
+            }
+            break;
 
-        if (restartWifiOnNextCycle) {
+        default:
             break;
+    }
+}
+
+
+// true when every cab with an address has been given it by the server
+bool
+ThrottleController::locomotivesAcquired()
+{
+    for (int cab = 0; cab < cabCount; cab++) {
+        if (cabs[cab].selectedAddress != "" && !cabs[cab].addressAcquired) {
+            return false;
         }
     }
+    return true;
+}
+
 
+// give up on the server for now, and try again in a while
+void
+ThrottleController::backOff()
+{
+    dropServer();
+    setThrottleState(TSTATE_WIFI_CONNECTED);
 
-  end:
-    restartWifiOnNextCycle = false;
-    delay(3000);
+    hw.console->printf("trying the server again in %u ms\n", backoffDelay);
+    setConnectionState(CSTATE_BACKOFF);
 }
 
 
+// Close the server connection, if there is one.  A new one starts over
+// with no locomotives.
+void
+ThrottleController::dropServer()
+{
+    connector.cancel();
+
+    for (int cab = 0; cab < cabCount; cab++) {
+        cabs[cab].wiThrottle.disconnect();
+        cabs[cab].addressIsSelected = false;
+        cabs[cab].addressAcquired = false;
+    }
+    connection.disconnect();
+    client.stop();
+}
+
+
+
+// Swap the cab's locomotive for the newly selected one, if there is one
+void
+ThrottleController::acquireLocomotive(int cab)
+{
+    Cab& c = cabs[cab];
+
+    if (c.addressIsSelected || c.selectedAddress == "") {
+        return;
+    }
+
+    hw.console->printf("cab %d: release current address ", cab);
+    hw.console->println(c.selectedAddress);
+
+    // deselect the current address; setting it to 0 speed first
+    c.wiThrottle.setSpeed(0);
+    c.wiThrottle.releaseLocomotive();
+
+    c.addressIsSelected = c.wiThrottle.addLocomotive(c.selectedAddress);
+    c.addressAcquired = false;
+
+    if (cab == activeCab) {
+        std::string sa = c.selectedAddress.c_str();
+        throttleService.setSelectedAddress(sa);
+    }
+    setThrottleState(TSTATE_WITHROTTLE_ACTIVE);
+}
+
 
 void
 ThrottleController::receivedVersion(String version)
 {
     hw.console->print("received protocol version string ");
     hw.console->println(version);
+    serverVersionReceived = true;
     setThrottleState(TSTATE_WITHROTTLE_CONNECTED);
 }
 
@@ -352,11 +769,14 @@ ThrottleController::receivedVersion(String version)
 // values at this point, we complete a feedback loop (at the expense of a
 // slightly increased latency on the indication change).
 void
-ThrottleController::receivedFunctionState(uint8_t func, bool state)
+ThrottleController::receivedFunctionState(int cab, uint8_t func, bool state)
 {
-    hw.console->printf("display function state F%d: %d\n", func, state);
+    hw.console->printf("cab %d: display function state F%d: %d\n", cab, func, state);
 
-    hw.setLight(func, state == 0 ? 0 : 255);
+    // the lights go with the buttons, which are for the active cab
+    if (cab == activeCab) {
+        hw.setLight(func, state == 0 ? 0 : 255);
+    }
 
     // do something with hw.<xyz?> to indicate the function state
     return;
@@ -364,16 +784,16 @@ ThrottleController::receivedFunctionState(uint8_t func, bool state)
 
 
 void
-ThrottleController::receivedSpeed(int speed)
+ThrottleController::receivedSpeed(int cab, int speed)
 {
-    hw.console->print("speed value "); hw.console->println(speed);
+    hw.console->printf("cab %d: speed value %d\n", cab, speed);
 }
 
 
 void
-ThrottleController::receivedDirection(Direction dir)
+ThrottleController::receivedDirection(int cab, Direction dir)
 {
-    hw.console->print("direction is ");
+    hw.console->printf("cab %d: direction is ", cab);
     switch(dir) {
         case Forward: hw.console->println("FWD"); break;
         case Reverse: hw.console->println("REV"); break;
@@ -383,9 +803,10 @@ ThrottleController::receivedDirection(Direction dir)
 
 
 void
-ThrottleController::receivedSpeedSteps(int steps)
+ThrottleController::receivedSpeedSteps(int cab, int steps)
 {
-    hw.console->print("speed steps: "); hw.console->println(steps);
+    hw.console->printf("cab %d: speed steps: %d\n", cab, steps);
+    hw.setSpeedSteps(cab, steps);
 }
 
 
@@ -397,34 +818,107 @@ ThrottleController::receivedWebPort(int port)
 
 
 void
-ThrottleController::addressAdded(String address, String entry)
+ThrottleController::addressAdded(int cab, String address, String entry)
 {
-    hw.console->printf("adding address %s: %s, resetting HW stats\n", address.c_str(), entry.c_str());
+    hw.console->printf("cab %d: adding address %s: %s, resetting HW stats\n", cab, address.c_str(), entry.c_str());
+    if (address == cabs[cab].selectedAddress) {
+        cabs[cab].addressAcquired = true;
+    }
     hw.resetStats();
 }
 
 
 void
-ThrottleController::addressRemoved(String address, String command)
+ThrottleController::addressRemoved(int cab, String address, String command)
 {
-    hw.console->printf("removing address %s: %s\n", address.c_str(), command.c_str());
+    hw.console->printf("cab %d: removing address %s: %s\n", cab, address.c_str(), command.c_str());
 }
 
 
 void
-ThrottleController::addressStealNeeded(String address, String entry)
+ThrottleController::addressStealNeeded(int cab, String address, String entry)
 {
     static int stealTryCount = 0;
-    hw.console->printf("address in use (stealable: %d) %s: %s\n",
-                       stealTryCount,  address.c_str(), entry.c_str());
+    hw.console->printf("cab %d: address in use (stealable: %d) %s: %s\n",
+                       cab, stealTryCount,  address.c_str(), entry.c_str());
 
     if (stealTryCount++ < 3) {
         // TODO: ask the user about stealing?
-        wiThrottle.stealLocomotive(address);
+        cabs[cab].wiThrottle.stealLocomotive(address);
+    }
+}
+
+
+
+
+// called from connection.receive(), on the loop task
+void
+ThrottleController::serverLine(int cab, const std::string& line)
+{
+    std::vector<RosterEntry> entries;
+    std::string address;
+    std::vector<std::string> labels;
+
+    if (RosterCache::parseRosterList(line, entries)) {
+        for (size_t index = 0; index < entries.size(); index++) {
+            receivedRosterEntry(entries[index]);
+        }
+    }
+    else if (RosterCache::parseFunctionLabelLine(line, address, labels)) {
+        receivedFunctionLabels(cab, address, labels);
     }
 }
 
 
+// the server's roster, sent when the WiThrottle connection is made
+void
+ThrottleController::receivedRosterEntry(const RosterEntry& entry)
+{
+    hw.console->printf("roster entry: %s (%c%u)\n", entry.description.c_str(),
+                       entry.longAddress ? 'L' : 'S', entry.address);
+
+    roster.updateDescription(entry.address, entry.longAddress, entry.description);
+}
+
+
+// the function labels for an acquired address
+void
+ThrottleController::receivedFunctionLabels(int cab, const std::string& address, const std::vector<std::string>& labels)
+{
+    uint16_t number;
+    bool longAddress;
+
+    if (!RosterCache::parseAddress(address, &number, &longAddress)) {
+        return;
+    }
+
+    roster.updateFunctionLabels(number, longAddress, labels);
+
+    if (cab == activeCab && address == cabs[cab].selectedAddress.c_str()) {
+        publishLocomotiveDetails(address);
+    }
+}
+
+
+void
+ThrottleController::publishLocomotiveDetails(std::string address)
+{
+    const RosterEntry *entry = roster.find(address);
+    if (!entry) {
+        return;
+    }
+
+    std::string labels;
+    for (size_t func = 0; func < entry->functionLabels.size(); func++) {
+        if (func > 0) {
+            labels += "|";
+        }
+        labels += entry->functionLabels[func];
+    }
+
+    throttleService.setLongDescription(entry->description);
+    throttleService.setFunctionLabels(labels);
+}
 
 
 void
@@ -447,6 +941,8 @@ ThrottleController::receivedTrackPower(TrackPower state)
 void
 ThrottleController::updateFastTimeDisplay()
 {
+    WiThrottle& wiThrottle = cabs[0].wiThrottle;
+
     int hour = wiThrottle.fastTimeHours();
     int minutes = wiThrottle.fastTimeMinutes();
 
@@ -484,21 +980,57 @@ ThrottleController::wifiOnConnect() {
   wifiService.setDeviceNetmask(WiFi.subnetMask());
   wifiService.setDeviceGateway(WiFi.gatewayIP());
 
-  hw.console->printf("connecting to %s:%s\n",
-                flashData.getServerAddress().c_str(),
-                flashData.getServerPort().c_str());
+  flashData.saveAccessPoint(WiFi.BSSID(), WiFi.channel());
+
+  // keep what DHCP gave us for the next fast connect
+  if (!leaseReused) {
+      NetworkLease lease;
+      lease.address = WiFi.localIP();
+      lease.netmask = WiFi.subnetMask();
+      lease.gateway = WiFi.gatewayIP();
+      lease.dns = WiFi.dnsIP();
+      flashData.saveLease(lease);
+  }
+
+  journal.log(JOURNAL_WIFI_CONNECTED, WiFi.RSSI());
+
+  // already past this (a renewed lease)?
+  if (connectionState > CSTATE_WIFI_RETRY) {
+      return;
+  }
+
+  setThrottleState(TSTATE_WIFI_CONNECTED);
+
+  // modem sleep: the radio sleeps between beacons when there's nothing to send
+  WiFi.setSleep(true);
+
+  startServerConnect();
 }
 
 
 void
 ThrottleController::wifiOnDisconnect() {
   hw.console->printf("wifiOnDisconnect()\n");
-  client.stop();
-  //wiThrottle.disconnect();
-  setThrottleState(TSTATE_WIFI_DISCONNECTED);
+  journal.log(JOURNAL_WIFI_DISCONNECTED);
+
+  // while joining, the driver keeps trying by itself
+  if (connectionState <= CSTATE_WIFI_RETRY) {
+      return;
+  }
+
+  dropServer();
+
+  // the access point is probably still there (or back shortly), and the
+  // lease is certainly still good
+  if (!fastJoin()) {
+      setThrottleState(TSTATE_WIFI_DISCONNECTED);
+      WiFi.reconnect();
+      setConnectionState(CSTATE_WIFI_JOIN);
+  }
 }
 
 
+// this is called from the WiFi event task, not ours
 void
 ThrottleController::wifiEvent(WiFiEvent_t event) {
   switch (event) {
@@ -516,14 +1048,16 @@ ThrottleController::wifiEvent(WiFiEvent_t event) {
         break;
     case SYSTEM_EVENT_STA_GOT_IP:
         hw.console->println("SYSTEM_EVENT_STA_GOT_IP");
-        wifiOnConnect();
+        wifiGotAddress = true;
+        governor.signal();
         break;
     case SYSTEM_EVENT_STA_LOST_IP:
         hw.console->println("SYSTEM_EVENT_STA_LOST_IP");
         break;
     case SYSTEM_EVENT_STA_DISCONNECTED:
         hw.console->println("SYSTEM_EVENT_STA_DISCONNECTED");
-        wifiOnDisconnect();
+        wifiLost = true;
+        governor.signal();
         break;
     default:
         hw.console->printf("unknown WiFi event: %d\n", (int) event);
@@ -537,6 +1071,10 @@ ThrottleController::wifiCommandReceived(std::string command)
 {
     hw.console->print("wifi command received "); hw.console->print(command.c_str()); hw.console->println("");
 
+    // the new settings are about to be used, so don't wait for the
+    // write-behind timer to get them onto flash
+    flashData.commit();
+
     hw.console->printf("  ssid: '%s'\n", flashData.getWifiSSID().c_str());
     hw.console->printf("  password: '%s'\n", flashData.getWifiPassword().c_str());
     hw.console->printf("  server: '%s:%s'\n", flashData.getServerAddress().c_str(), flashData.getServerPort().c_str());
@@ -546,8 +1084,11 @@ ThrottleController::wifiCommandReceived(std::string command)
 
 
 void
-ThrottleController::updateDirection(TogglePosition togglePosition)
+ThrottleController::updateDirection(int cab, TogglePosition togglePosition)
 {
+    WiThrottle& wiThrottle = cabs[cab].wiThrottle;
+
+    cabs[cab].togglePosition = togglePosition;
     throttleService.setTogglePosition(togglePosition);
 
     // Do not change direction when the toggle is CENTER OFF
@@ -556,62 +1097,128 @@ ThrottleController::updateDirection(TogglePosition togglePosition)
         Direction dir = directionFromTogglePosition(togglePosition);
         if (dir != wiThrottle.getDirection()) {
             wiThrottle.setDirection(dir);
+            commandPending = true;
+            journal.log(JOURNAL_DIRECTION, dir, cab);
             throttleService.setDirection(dir);
         }
     }
 
 }
 
+
+// Make this the cab that the function buttons, and the BLE throttle
+// service, are for
 void
-ThrottleController::speedChanged(int newSpeed, TogglePosition togglePosition)
+ThrottleController::selectCab(int cab)
 {
-    updateDirection(togglePosition);
+    if (cab == activeCab || cab < 0 || cab >= cabCount) {
+        return;
+    }
+
+    activeCab = cab;
+    hw.console->printf("cab %d is active\n", cab);
 
-    wiThrottle.setSpeed(newSpeed);
+    Cab& c = cabs[cab];
+    throttleService.setCab(cab);
+    throttleService.setSpeed(c.speed);
+    throttleService.setDirection(c.wiThrottle.getDirection());
+    throttleService.setTogglePosition(c.togglePosition);
+    throttleService.setSelectedAddress(c.selectedAddress.c_str());
+    publishLocomotiveDetails(c.selectedAddress.c_str());
+}
+
+
+void
+ThrottleController::speedChanged(int cab, int newSpeed, TogglePosition togglePosition)
+{
+    selectCab(cab);
+    updateDirection(cab, togglePosition);
+
+    cabs[cab].wiThrottle.setSpeed(newSpeed);
+    cabs[cab].speed = newSpeed;
+    commandPending = true;
+    speedCommandPending = true;
+    journal.log(JOURNAL_SPEED, newSpeed, cab);
     throttleService.setSpeed(newSpeed);
 }
 
 
 void
-ThrottleController::togglePositionChanged(TogglePosition newPosition)
+ThrottleController::togglePositionChanged(int cab, TogglePosition newPosition)
 {
-    updateDirection(newPosition);
+    selectCab(cab);
+    updateDirection(cab, newPosition);
 }
 
 
 void
-ThrottleController::throttleMoved()
+ThrottleController::throttleMoved(int magnitude)
 {
+    journal.log(JOURNAL_MOTION, magnitude);
 }
 
 
+// A dropped throttle stops the train: the knob can get knocked anywhere
+// on the way down, and no one is holding it any more.
 void
 ThrottleController::throttleFell()
 {
+    hw.console->println("!!! throttle dropped, EMERGENCY STOP");
+
+    for (int cab = 0; cab < cabCount; cab++) {
+        cabs[cab].wiThrottle.emergencyStop();
+        cabs[cab].speed = 0;
+    }
+    journal.log(JOURNAL_FELL);
+    throttleService.setSpeed(0);
 }
 
 
+// this is called from the HW scan task, not ours
 void
-ThrottleController::batteryLevelChanged(int batteryLevel)
+ThrottleController::eventsPending()
+{
+    governor.signal();
+}
+
+
+void
+ThrottleController::throttleIdle()
+{
+    hw.console->println("throttle is idle");
+    journal.log(JOURNAL_IDLE);
+}
+
+
+void
+ThrottleController::batteryLevelChanged(int millivolts, int percent, int minutesRemaining)
 {
     // by calling the delegate, the HW controller module has determined
-    // that this batteryLevel is "of interest" and should be reported
+    // that this battery level is "of interest" and should be reported
     // to all interested parties
-    int percentage = map(batteryLevel, 3200, 4300, 0, 100);
-    percentage = constrain(percentage, 0, 100);
-
-    batteryService.setBatteryLevel(percentage);
-    hw.console->printf(">>> Battery Level: %d (%d%%)\n", batteryLevel, percentage);
+    batteryService.setBatteryLevel(percent, minutesRemaining);
+    journal.log(JOURNAL_BATTERY, millivolts, percent);
+    hw.console->printf(">>> Battery Level: %d mV (%d%%, %d minutes left)\n", millivolts, percent, minutesRemaining);
 }
 
 
 // this is called by the HW module when the function button itself changes state
 void
-ThrottleController::functionButtonChanged(int func, bool pressed)
+ThrottleController::functionButtonChanged(int func, bool pressed, uint32_t timestamp)
 {
-    hw.console->printf("** button F%d changed to %s\n", func, pressed ? "PRESSED" : "RELEASED");
+    cabs[activeCab].wiThrottle.setFunction(func, pressed);
+    commandPending = true;
+    if (!commandInputAt) {
+        commandInputAt = timestamp;
+    }
+
+    // from the button interrupt to the command being queued (it's written
+    // to the server at the end of this pass through the loop)
+    uint32_t latency = micros() - timestamp;
 
-    wiThrottle.setFunction(func, pressed);
+    journal.log(JOURNAL_BUTTON, pressed, func);
+    journal.log(JOURNAL_BUTTON_LATENCY, min(latency / 100, (uint32_t) INT16_MAX), func);
+    hw.console->printf("** button F%d changed to %s (%u us)\n", func, pressed ? "PRESSED" : "RELEASED", latency);
 }
 
 
@@ -619,10 +1226,102 @@ ThrottleController::functionButtonChanged(int func, bool pressed)
 void
 ThrottleController::throttleAddressChanged(std::string address)
 {
+    governor.activity();
+
+    Cab& c = cabs[activeCab];
+
     String newAddress(address.c_str());
-    if (newAddress != selectedAddress) {
-        hw.console->printf("** address should be changed to %s\n", newAddress.c_str());
-        selectedAddress = newAddress;
-        addressIsSelected = false;
+    if (newAddress != c.selectedAddress) {
+        hw.console->printf("** cab %d address should be changed to %s\n", activeCab, newAddress.c_str());
+        c.selectedAddress = newAddress;
+        c.addressIsSelected = false;
+
+        // only the first cab's is kept for next time
+        if (activeCab == 0) {
+            roster.saveLastSelectedAddress(address);
+        }
+        publishLocomotiveDetails(address);
     }
 }
+
+
+// this is called by the ThrottleService when the cab is picked
+void
+ThrottleController::throttleCabSelected(int cab)
+{
+    governor.activity();
+    selectCab(cab);
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+//
+// CabDelegate: each cab's WiThrottle callbacks, on to the controller
+//
+
+void
+CabDelegate::attach(ThrottleController *controller, int cab)
+{
+    this->controller = controller;
+    this->cab = cab;
+}
+
+void
+CabDelegate::receivedDirection(Direction dir)
+{
+    controller->receivedDirection(cab, dir);
+}
+
+void
+CabDelegate::receivedFunctionState(uint8_t func, bool state)
+{
+    controller->receivedFunctionState(cab, func, state);
+}
+
+void
+CabDelegate::receivedSpeed(int speed)
+{
+    controller->receivedSpeed(cab, speed);
+}
+
+void
+CabDelegate::receivedSpeedSteps(int steps)
+{
+    controller->receivedSpeedSteps(cab, steps);
+}
+
+void
+CabDelegate::receivedTrackPower(TrackPower state)
+{
+    controller->receivedTrackPower(state);
+}
+
+void
+CabDelegate::receivedVersion(String version)
+{
+    controller->receivedVersion(version);
+}
+
+void
+CabDelegate::receivedWebPort(int port)
+{
+    controller->receivedWebPort(port);
+}
+
+void
+CabDelegate::addressAdded(String address, String entry)
+{
+    controller->addressAdded(cab, address, entry);
+}
+
+void
+CabDelegate::addressRemoved(String address, String command)
+{
+    controller->addressRemoved(cab, address, command);
+}
+
+void
+CabDelegate::addressStealNeeded(String address, String entry)
+{
+    controller->addressStealNeeded(cab, address, entry);
+}
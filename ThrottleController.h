@@ -26,7 +26,6 @@
 
 #include "Arduino.h"
 
-#include <Chrono.h>
 #include <Time.h>
 #include <TimeLib.h>
 
@@ -36,14 +35,21 @@
 
 
 #include "WiThrottle.h"
+#include "MultiThrottleConnection.h"
 
 #include "ThrottleData.h"
+#include "RosterCache.h"
 
 // Several BLE Services available on this device...
 #include "ThrottleService.h"
 #include "WifiService.h"
 #include "BatteryService.h"
 #include "DeviceInfoService.h"
+#include "JournalService.h"
+
+#include "EventJournal.h"
+#include "PowerGovernor.h"
+#include "ServerConnector.h"
 
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -74,12 +80,71 @@ typedef enum ThrottleState
 } ThrottleState;
 
 
+// The steps from nothing to driving a train, which loop() works through
+// without blocking.  A lost server goes back to SERVER_CONNECT (after a
+// back off); lost WiFi goes back to WIFI_JOIN.
+typedef enum ConnectionState
+{
+    CSTATE_WIFI_SCAN = 0,       // looking for known networks
+    CSTATE_WIFI_JOIN,           // joining one, waiting for an address
+    CSTATE_WIFI_RETRY,          // couldn't join, waiting to scan again
+    CSTATE_SERVER_CONNECT,      // looking up and connecting to the server
+    CSTATE_HANDSHAKE,           // waiting for the server's protocol version
+    CSTATE_ACQUIRE,             // waiting for the cabs' locomotives
+    CSTATE_ACTIVE,
+    CSTATE_BACKOFF,             // waiting to try the server again
+    CSTATE_COUNT
+} ConnectionState;
+
+
+
+class ThrottleController;
+
+
+// Passes a cab's WiThrottle callbacks on to the controller, along with
+// which cab they're for
+class CabDelegate : public WiThrottleDelegate
+{
+  public:
+    CabDelegate() : controller(NULL), cab(0) { }
+
+    void attach(ThrottleController *controller, int cab);
+
+    void receivedDirection(Direction dir);
+    void receivedFunctionState(uint8_t func, bool state);
+    void receivedSpeed(int speed);
+    void receivedSpeedSteps(int steps);
+    void receivedTrackPower(TrackPower state);
+    void receivedVersion(String version);
+    void receivedWebPort(int port);
+    void addressAdded(String address, String entry);
+    void addressRemoved(String address, String command);
+    void addressStealNeeded(String address, String entry);
+
+  private:
+    ThrottleController *controller;
+    int                cab;
+};
+
+
+// everything the controller keeps for each cab
+typedef struct Cab {
+    WiThrottle        wiThrottle;
+    CabDelegate       delegate;
+    String            selectedAddress;
+    bool              addressIsSelected; // asked the server for it
+    bool              addressAcquired;   // and the server said yes
+    int               speed;
+    TogglePosition    togglePosition;
+} Cab;
+
+
 
 class ThrottleController:
-    public WiThrottleDelegate,
     public WifiServiceDelegate,
     public ThrottleServiceDelegate,
-    public ThrottleHWDelegate
+    public ThrottleHWDelegate,
+    public ServerLineListener
 {
   public:
     ThrottleController();
@@ -91,23 +156,30 @@ class ThrottleController:
     void test_loop();   // run the HW tests
 
     void setThrottleState(ThrottleState newState);
-
-    // WiThrottleDelegate methods
-    void receivedDirection(Direction dir);
-    void receivedFastTime(uint32_t time);
-    void receivedFastTimeRate(double rate);
-    void receivedFunctionState(uint8_t func, bool state);
-    void receivedSpeed(int speed);
-    void receivedSpeedSteps(int steps);
+    void setConnectionState(ConnectionState newState);
+
+    // WiThrottle callbacks, by way of each cab's CabDelegate.  The ones
+    // that aren't about a locomotive only come from cab 0.
+    void receivedDirection(int cab, Direction dir);
+    void receivedFunctionState(int cab, uint8_t func, bool state);
+    void receivedSpeed(int cab, int speed);
+    void receivedSpeedSteps(int cab, int steps);
     void receivedTrackPower(TrackPower state);
     void receivedVersion(String version);
     void receivedWebPort(int port);
-    void addressAdded(String address, String entry);
-    void addressRemoved(String address, String command);
-    void addressStealNeeded(String address, String entry);
+    void addressAdded(int cab, String address, String entry);
+    void addressRemoved(int cab, String address, String command);
+    void addressStealNeeded(int cab, String address, String entry);
+
+    // what the WiThrottle library doesn't report: the roster, and function
+    // labels, parsed from the server's lines as they go by
+    void serverLine(int cab, const std::string& line);
+    void receivedRosterEntry(const RosterEntry& entry);
+    void receivedFunctionLabels(int cab, const std::string& address, const std::vector<std::string>& labels);
 
 
-    // WiFi callback methods
+    // WiFi callback methods: wifiEvent() is called on the event task, and
+    // passes what happened to the others, called from loop()
     void wifiOnConnect();
     void wifiOnDisconnect();
     void wifiEvent(WiFiEvent_t event);
@@ -117,39 +189,80 @@ class ThrottleController:
 
     // Throttle service callback methods
     void throttleAddressChanged(std::string address);
+    void throttleCabSelected(int cab);
 
     // ThrottleHW callback methods
-    void speedChanged(int newSpeed, TogglePosition togglePosition);
-    void togglePositionChanged(TogglePosition newPosition);
-    void speedChanged(int newSpeed);
-    void throttleMoved();
+    void speedChanged(int cab, int newSpeed, TogglePosition togglePosition);
+    void togglePositionChanged(int cab, TogglePosition newPosition);
+    void throttleMoved(int magnitude);
     void throttleFell();
-    void batteryLevelChanged(int batteryLevel);
-    void functionButtonChanged(int func, bool pressed);
+    void throttleIdle();
+    void batteryLevelChanged(int millivolts, int percent, int minutesRemaining);
+    void functionButtonChanged(int func, bool pressed, uint32_t timestamp);
+    void eventsPending();
 
 
   private:
     void updateFastTimeDisplay();
-    void updateDirection(TogglePosition togglePosition);
+    void updateDirection(int cab, TogglePosition togglePosition);
+    void selectCab(int cab);
+    void acquireLocomotive(int cab);
+    void sendCommands();
     Direction directionFromTogglePosition(TogglePosition position);
     void setupBLE();
+    void publishLocomotiveDetails(std::string address);
+    void serviceInputs();
+    void commandSent(uint32_t inputAt);
+
+    // the connection state machine
+    void runConnection();
+    void handleWifiEvents();
+    void startWifi();
+    void joinNetwork();
+    bool fastJoin();
+    void useDHCP();
+    void startServerConnect();
+    void serverConnected();
+    void serviceServer();
+    void backOff();
+    void dropServer();
+    bool locomotivesAcquired();
+    uint32_t timeInState() { return millis() - connectionStateEnteredAt; }
 
 
     WiFiClient        client;
     ESP32HW           hw;
-    WiThrottle        wiThrottle;
+    MultiThrottleConnection connection;
+    Cab               cabs[MAX_CABS];
+    int               cabCount;
+    int               activeCab;         // the one the buttons and BLE are for
+    bool              commandPending;    // queued since the last send
+    uint32_t          commandInputAt;    // micros() at the interrupt of the first of them, 0 if not known
     bool              wifiConnected;
     int               port;
     WifiService       wifiService;
     ThrottleService   throttleService;
     BatteryService    batteryService;
     DeviceInfoService deviceInfoService;
+    JournalService    journalService;
     BLEServer         *bleServer;
     ThrottleData      flashData;
+    RosterCache       roster;
+    EventJournal      journal;
+    PowerGovernor     governor;
     bool              restartWifiOnNextCycle;
     ThrottleState     currentThrottleState;
-    Chrono            wifiRetryCheck;
 
-    String            selectedAddress;
-    bool              addressIsSelected;
+    ServerConnector   connector;
+    ConnectionState   connectionState;
+    unsigned long     connectionStateEnteredAt;
+    uint32_t          connectionStateTime[CSTATE_COUNT];  // ms, in total
+    unsigned long     connectingSince;     // when the last time driving ended
+    uint32_t          backoffDelay;        // ms
+    bool              serverVersionReceived;
+    bool              leaseReused;         // using the saved address, not DHCP
+    bool              awaitingFirstSpeed;  // since connectingSince
+    bool              speedCommandPending; // queued since the last send
+    volatile bool     wifiGotAddress;      // set by wifiEvent(), on the event task
+    volatile bool     wifiLost;
 };
@@ -23,14 +23,10 @@
 
 #include "ThrottleData.h"
 
-#include "FS.h"
-#include "SPIFFS.h"
-
-/* You only need to format SPIFFS the first time you run a
-   test or else use the SPIFFS plugin to create a partition
-   https://github.com/me-no-dev/arduino-esp32fs-plugin */
-#define FORMAT_SPIFFS_IF_FAILED true
+#include "StorageRecord.h"
 
+// legacy layout: one file per setting.  These are only read once, to
+// migrate an older throttle to the packed config record below.
 #define DEVICE_NAME_FILE "/deviceName"
 #define SSID_FILE "/ssid"
 #define PASSWORD_FILE "/password"
@@ -38,8 +34,79 @@
 #define SERVER_PORT_FILE "/serverPort"
 #define SERIAL_NUMBER_FILE "/serialNumber"
 
+// all settings live in a single packed record, written alternately to one
+// of two slots.  A commit only ever rewrites the slot that is NOT current,
+// so losing power part way through leaves the previous record intact (its
+// CRC still checks, the half-written one's doesn't).
+#define CONFIG_SLOT_A_FILE "/config.a"
+#define CONFIG_SLOT_B_FILE "/config.b"
+
+#define CONFIG_MAGIC   (0x43544B42)   // "BKTC"
+
+// schema versions
+//   1: a single network (deviceName, serialNumber, ssid, password, server, serverPort)
+//   2: deviceName, serialNumber, current profile, then MAX_NETWORK_PROFILES network profiles
+//   3: as 2, with each profile's DHCP lease after its access point
+#define CONFIG_VERSION_SINGLE_NETWORK (1)
+#define CONFIG_VERSION_PROFILES       (2)
+#define CONFIG_VERSION                (3)
+
+// changed settings are written to flash once no further change has been
+// made for this long (BLE provisioning writes several fields in a burst)
+#define WRITE_BEHIND_DELAY (2000)  // ms
+
+#define DEFAULT_DEVICE_NAME    "Device Name"
+#define DEFAULT_SERIAL_NUMBER  "00000000"
+#define DEFAULT_SSID           "SSID"
+#define DEFAULT_PASSWORD       "Password"
+#define DEFAULT_SERVER_ADDRESS "Server"
+#define DEFAULT_SERVER_PORT    "12090"
+
+// a scan entry whose BSSID matches the access point a profile last used
+// is preferred over a slightly stronger one that we've never associated with
+#define KNOWN_BSSID_RSSI_BONUS (10)   // dB
+
+
+static const char *configSlotFiles[2] = { CONFIG_SLOT_A_FILE, CONFIG_SLOT_B_FILE };
+
+
+// Holds the settings for the life of the object.  They're read and written
+// from the controller's loop and from the BLE task (provisioning), and a
+// commit must not interleave with either.  The lock is recursive, so public
+// methods can call each other.  Until begin() creates it, only the task
+// calling begin() can be using the settings.
+class SettingsLock
+{
+  public:
+    SettingsLock(SemaphoreHandle_t lock) : lock(lock) { if (lock) xSemaphoreTakeRecursive(lock, portMAX_DELAY); }
+    ~SettingsLock() { if (lock) xSemaphoreGiveRecursive(lock); }
+
+  private:
+    SemaphoreHandle_t lock;
+};
+
+
+static void
+clearProfile(NetworkProfile& profile)
+{
+    profile.ssid = "";
+    profile.password = "";
+    profile.serverAddress = "";
+    profile.serverPort = DEFAULT_SERVER_PORT;
+    memset(profile.bssid, 0, sizeof(profile.bssid));
+    profile.channel = 0;
+    memset(&profile.lease, 0, sizeof(profile.lease));
+}
+
 
-ThrottleData::ThrottleData()
+ThrottleData::ThrottleData(ThrottleStorage& storage) :
+    storage(storage),
+    settings(),
+    dirty(false),
+    writeBehindTimer(),
+    activeSlot(-1),
+    sequence(0),
+    lock(NULL)
 {
 }
 
@@ -49,57 +116,291 @@ ThrottleData::begin(Stream *console)
 {
     this->console = console;
 
+    if (!lock) {
+        lock = xSemaphoreCreateRecursiveMutex();
+    }
+    SettingsLock hold(lock);
+
     bool rv = true;
 
-    if(!SPIFFS.begin(FORMAT_SPIFFS_IF_FAILED)){
+    unsigned long mountStart = micros();
+
+    if (!storage.begin()) {
         rv = false;
     }
     else {
-        size_t total = SPIFFS.totalBytes();
-        size_t used  = SPIFFS.usedBytes();
+        unsigned long mountTime = micros() - mountStart;
+        size_t total = storage.totalBytes();
+        size_t used  = storage.usedBytes();
 
-        console->printf("FS %d/%d bytes\n", used, total);
+        console->printf("FS %s %d/%d bytes, mounted in %lu us\n", storage.name(), (int) used, (int) total, mountTime);
+    }
+
+    settings.deviceName = DEFAULT_DEVICE_NAME;
+    settings.serialNumber = DEFAULT_SERIAL_NUMBER;
+    settings.currentProfile = 0;
+    for (int profile = 0; profile < MAX_NETWORK_PROFILES; profile++) {
+        clearProfile(settings.profiles[profile]);
+    }
+    settings.profiles[0].ssid = DEFAULT_SSID;
+    settings.profiles[0].password = DEFAULT_PASSWORD;
+    settings.profiles[0].serverAddress = DEFAULT_SERVER_ADDRESS;
+    dirty = false;
+
+    if (!loadConfig()) {
+        migrateLegacyFiles();
     }
 
     return rv;
 }
 
 
+void
+ThrottleData::check()
+{
+    SettingsLock hold(lock);
+
+    if (dirty && writeBehindTimer.hasPassed(WRITE_BEHIND_DELAY)) {
+        commit();
+    }
+}
+
+
 bool
-ThrottleData::writeFile(std::string filename, std::string content)
+ThrottleData::commit()
 {
-    bool rv = false;
+    SettingsLock hold(lock);
 
-    File file = SPIFFS.open(filename.c_str(), FILE_WRITE);
-    if (!file || file.isDirectory()) {
-        rv = false;
-        console->printf("unable to open file %s\n", filename.c_str());
+    if (!dirty) {
+        return true;
+    }
+
+    std::string payload = packConfig();
+
+    // never overwrite the record we booted from (or last committed)
+    int slot = (activeSlot == 0) ? 1 : 0;
+
+    bool rv = writeRecord(storage, configSlotFiles[slot], CONFIG_MAGIC, CONFIG_VERSION, sequence + 1, payload);
+    console->printf("write config record to %s: %d\n", configSlotFiles[slot], rv);
+
+    if (rv) {
+        activeSlot = slot;
+        sequence++;
+        dirty = false;
     }
     else {
-        rv = file.print(content.c_str());
-        console->printf("write file %s with '%s': %d\n", filename.c_str(), content.c_str(), rv);
+        // try again after the next delay
+        writeBehindTimer.restart();
     }
 
     return rv;
 }
 
 
+void
+ThrottleData::settingsChanged()
+{
+    dirty = true;
+    writeBehindTimer.restart();
+}
+
+
+void
+ThrottleData::setString(std::string& setting, const std::string& value)
+{
+    if (setting == value) {
+        return;
+    }
+
+    setting = value;
+    settingsChanged();
+}
+
+
 std::string
-ThrottleData::readFile(std::string filename, std::string defaultContent)
+ThrottleData::packConfig()
 {
-    std::string content;
+    RecordWriter writer;
+
+    writer.putString(settings.deviceName);
+    writer.putString(settings.serialNumber);
+    writer.putU8(settings.currentProfile);
+
+    for (int index = 0; index < MAX_NETWORK_PROFILES; index++) {
+        const NetworkProfile& profile = settings.profiles[index];
+
+        writer.putString(profile.ssid);
+        writer.putString(profile.password);
+        writer.putString(profile.serverAddress);
+        writer.putString(profile.serverPort);
+        writer.putBytes(profile.bssid, sizeof(profile.bssid));
+        writer.putU8(profile.channel);
+        writer.putU32(profile.lease.address);
+        writer.putU32(profile.lease.netmask);
+        writer.putU32(profile.lease.gateway);
+        writer.putU32(profile.lease.dns);
+    }
 
-    File file = SPIFFS.open(filename.c_str());
-    if (!file || file.isDirectory()) {
-        return defaultContent;
+    return writer.payload;
+}
+
+
+bool
+ThrottleData::unpackConfig(const std::string& payload, uint16_t version, Settings& settings)
+{
+    RecordReader reader(payload);
+
+    if (!reader.getString(settings.deviceName) || !reader.getString(settings.serialNumber)) {
+        return false;
+    }
+
+    if (version == CONFIG_VERSION_SINGLE_NETWORK) {
+        NetworkProfile& profile = settings.profiles[0];
+
+        settings.currentProfile = 0;
+        if (!reader.getString(profile.ssid)
+            || !reader.getString(profile.password)
+            || !reader.getString(profile.serverAddress)
+            || !reader.getString(profile.serverPort)) {
+            return false;
+        }
+    }
+    else if (version == CONFIG_VERSION_PROFILES || version == CONFIG_VERSION) {
+        if (!reader.getU8(settings.currentProfile)) {
+            return false;
+        }
+        if (settings.currentProfile >= MAX_NETWORK_PROFILES) {
+            settings.currentProfile = 0;
+        }
+
+        for (int index = 0; index < MAX_NETWORK_PROFILES; index++) {
+            NetworkProfile& profile = settings.profiles[index];
+
+            if (!reader.getString(profile.ssid)
+                || !reader.getString(profile.password)
+                || !reader.getString(profile.serverAddress)
+                || !reader.getString(profile.serverPort)
+                || !reader.getBytes(profile.bssid, sizeof(profile.bssid))
+                || !reader.getU8(profile.channel)) {
+                return false;
+            }
+
+            // older records have no lease, which leaves it cleared
+            if (version == CONFIG_VERSION
+                && (!reader.getU32(profile.lease.address)
+                    || !reader.getU32(profile.lease.netmask)
+                    || !reader.getU32(profile.lease.gateway)
+                    || !reader.getU32(profile.lease.dns))) {
+                return false;
+            }
+        }
     }
     else {
-        while (file.available()) {
-            char c = file.read();
+        return false;
+    }
+
+    return true;
+}
+
+
+// Load the newest valid config record.  Returns false if neither slot
+// holds one (a new throttle, or one still using the legacy layout).
+bool
+ThrottleData::loadConfig()
+{
+    Settings candidates[2] = { settings, settings };
+    uint32_t sequences[2];
+    uint16_t versions[2];
+    bool valid[2];
+
+    for (int slot = 0; slot < 2; slot++) {
+        std::string payload;
+        valid[slot] = readRecord(storage, configSlotFiles[slot], CONFIG_MAGIC, &versions[slot], &sequences[slot], payload)
+            && unpackConfig(payload, versions[slot], candidates[slot]);
+    }
+
+    int slot = -1;
+    if (valid[0] && valid[1]) {
+        // sequence numbers are compared with wraparound in mind
+        slot = (int32_t) (sequences[1] - sequences[0]) > 0 ? 1 : 0;
+    }
+    else if (valid[0]) {
+        slot = 0;
+    }
+    else if (valid[1]) {
+        slot = 1;
+    }
 
-            content += c;
+    if (slot < 0) {
+        return false;
+    }
+
+    settings = candidates[slot];
+    sequence = sequences[slot];
+    activeSlot = slot;
+
+    console->printf("config loaded from %s (version %u, sequence %u)\n",
+                    configSlotFiles[slot], versions[slot], sequence);
+
+    if (versions[slot] != CONFIG_VERSION) {
+        // rewrite it in the current format
+        settingsChanged();
+    }
+
+    return true;
+}
+
+
+// Read the one-file-per-setting layout used by earlier firmware, write it
+// out as a config record, and then remove the old files.
+void
+ThrottleData::migrateLegacyFiles()
+{
+    const struct {
+        const char  *filename;
+        std::string *setting;
+    } legacyFiles[] = {
+        { DEVICE_NAME_FILE,    &settings.deviceName },
+        { SERIAL_NUMBER_FILE,  &settings.serialNumber },
+        { SSID_FILE,           &settings.profiles[0].ssid },
+        { PASSWORD_FILE,       &settings.profiles[0].password },
+        { SERVER_ADDRESS_FILE, &settings.profiles[0].serverAddress },
+        { SERVER_PORT_FILE,    &settings.profiles[0].serverPort },
+    };
+    const int legacyFileCount = sizeof(legacyFiles) / sizeof(legacyFiles[0]);
+
+    bool found = false;
+
+    for (int file = 0; file < legacyFileCount; file++) {
+        if (storage.exists(legacyFiles[file].filename)) {
+            *legacyFiles[file].setting = readFile(legacyFiles[file].filename, *legacyFiles[file].setting);
+            found = true;
+        }
+    }
+
+    if (!found) {
+        return;
+    }
+
+    console->println("migrating legacy settings files to config record");
+
+    settingsChanged();
+    if (commit()) {
+        for (int file = 0; file < legacyFileCount; file++) {
+            storage.remove(legacyFiles[file].filename);
         }
     }
+}
+
+
+std::string
+ThrottleData::readFile(std::string filename, std::string defaultContent)
+{
+    std::string content;
+
+    if (!storage.readFile(filename, content)) {
+        return defaultContent;
+    }
 
     return content;
 }
@@ -111,14 +412,15 @@ ThrottleData::readFile(std::string filename, std::string defaultContent)
 std::string
 ThrottleData::getDeviceName()
 {
-    std::string deviceName = readFile(DEVICE_NAME_FILE, "Device Name");
-    return deviceName;
+    SettingsLock hold(lock);
+    return settings.deviceName;
 }
 
 void
 ThrottleData::saveDeviceName(std::string deviceName)
 {
-    writeFile(DEVICE_NAME_FILE, deviceName);
+    SettingsLock hold(lock);
+    setString(settings.deviceName, deviceName);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -126,72 +428,197 @@ ThrottleData::saveDeviceName(std::string deviceName)
 std::string
 ThrottleData::getSerialNumber()
 {
-    std::string serialNumber = readFile(SERIAL_NUMBER_FILE, "00000000");
-    return serialNumber;
+    SettingsLock hold(lock);
+    return settings.serialNumber;
 }
 
 void
 ThrottleData::saveSerialNumber(std::string serialNumber)
 {
-    writeFile(SERIAL_NUMBER_FILE, serialNumber);
+    SettingsLock hold(lock);
+    setString(settings.serialNumber, serialNumber);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+int
+ThrottleData::getCurrentProfile()
+{
+    SettingsLock hold(lock);
+    return settings.currentProfile;
+}
+
+void
+ThrottleData::selectProfile(int profile)
+{
+    SettingsLock hold(lock);
+
+    if (profile < 0 || profile >= MAX_NETWORK_PROFILES || profile == settings.currentProfile) {
+        return;
+    }
+
+    settings.currentProfile = profile;
+    settingsChanged();
+}
+
+NetworkProfile&
+ThrottleData::profileFor(int profile)
+{
+    if (profile < 0 || profile >= MAX_NETWORK_PROFILES) {
+        return currentProfile();
+    }
+    return settings.profiles[profile];
+}
+
+NetworkProfile
+ThrottleData::getProfile(int profile)
+{
+    SettingsLock hold(lock);
+    return profileFor(profile);
+}
+
+int
+ThrottleData::matchProfiles(const std::vector<NetworkScanEntry>& scan, int *entry)
+{
+    SettingsLock hold(lock);
+
+    int bestProfile = -1;
+    int bestEntry = -1;
+    int bestScore = 0;
+
+    for (int profile = 0; profile < MAX_NETWORK_PROFILES; profile++) {
+        const NetworkProfile& candidate = settings.profiles[profile];
+        if (candidate.ssid.empty()) {
+            continue;
+        }
+
+        for (size_t index = 0; index < scan.size(); index++) {
+            if (scan[index].ssid != candidate.ssid) {
+                continue;
+            }
+
+            int score = scan[index].rssi;
+            if (memcmp(scan[index].bssid, candidate.bssid, sizeof(candidate.bssid)) == 0) {
+                score += KNOWN_BSSID_RSSI_BONUS;
+            }
+
+            if (bestProfile < 0 || score > bestScore) {
+                bestProfile = profile;
+                bestEntry = index;
+                bestScore = score;
+            }
+        }
+    }
+
+    if (entry) {
+        *entry = bestEntry;
+    }
+    return bestProfile;
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 std::string
-ThrottleData::getWifiSSID()
+ThrottleData::getWifiSSID(int profile)
 {
-    std::string ssid = readFile(SSID_FILE, "SSID");
-    return ssid;
+    SettingsLock hold(lock);
+    return profileFor(profile).ssid;
 }
 
 void
-ThrottleData::saveWifiSSID(std::string ssid)
+ThrottleData::saveWifiSSID(std::string ssid, int profile)
 {
-    writeFile(SSID_FILE, ssid);
+    SettingsLock hold(lock);
+    setString(profileFor(profile).ssid, ssid);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 std::string
-ThrottleData::getWifiPassword()
+ThrottleData::getWifiPassword(int profile)
 {
-    std::string password = readFile(PASSWORD_FILE, "Password");
-    return password;
+    SettingsLock hold(lock);
+    return profileFor(profile).password;
 }
 
 void
-ThrottleData::saveWifiPassword(std::string password)
+ThrottleData::saveWifiPassword(std::string password, int profile)
 {
-    writeFile(PASSWORD_FILE, password);
+    SettingsLock hold(lock);
+    setString(profileFor(profile).password, password);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 std::string
-ThrottleData::getServerAddress()
+ThrottleData::getServerAddress(int profile)
 {
-    std::string server = readFile(SERVER_ADDRESS_FILE, "Server");
-    return server;
+    SettingsLock hold(lock);
+    return profileFor(profile).serverAddress;
 }
 
 void
-ThrottleData::saveServerAddress(std::string server)
+ThrottleData::saveServerAddress(std::string server, int profile)
 {
-    writeFile(SERVER_ADDRESS_FILE, server);
+    SettingsLock hold(lock);
+    setString(profileFor(profile).serverAddress, server);
 }
 
 ////////////////////////////////////////////////////////////////////////////////
 
 std::string
-ThrottleData::getServerPort()
+ThrottleData::getServerPort(int profile)
+{
+    SettingsLock hold(lock);
+    return profileFor(profile).serverPort;
+}
+
+void
+ThrottleData::saveServerPort(std::string serverPort, int profile)
+{
+    SettingsLock hold(lock);
+    setString(profileFor(profile).serverPort, serverPort);
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+void
+ThrottleData::saveAccessPoint(const uint8_t *bssid, uint8_t channel)
+{
+    SettingsLock hold(lock);
+
+    NetworkProfile& profile = currentProfile();
+
+    if (memcmp(profile.bssid, bssid, sizeof(profile.bssid)) == 0 && profile.channel == channel) {
+        return;
+    }
+
+    memcpy(profile.bssid, bssid, sizeof(profile.bssid));
+    profile.channel = channel;
+    settingsChanged();
+}
+
+void
+ThrottleData::saveLease(const NetworkLease& lease)
 {
-    std::string server = readFile(SERVER_PORT_FILE, "12090");
-    return server;
+    SettingsLock hold(lock);
+
+    NetworkProfile& profile = currentProfile();
+
+    if (memcmp(&profile.lease, &lease, sizeof(profile.lease)) == 0) {
+        return;
+    }
+
+    profile.lease = lease;
+    settingsChanged();
 }
 
 void
-ThrottleData::saveServerPort(std::string serverPort)
+ThrottleData::forgetLease()
 {
-    writeFile(SERVER_PORT_FILE, serverPort);
+    SettingsLock hold(lock);
+
+    NetworkLease none;
+    memset(&none, 0, sizeof(none));
+    saveLease(none);
 }
@@ -25,7 +25,53 @@
 
 #include "Arduino.h"
 
+#include <Chrono.h>
+
+#include <freertos/FreeRTOS.h>
+#include <freertos/semphr.h>
+
 #include <string>
+#include <vector>
+
+#include "ThrottleStorage.h"
+
+
+// number of networks (layouts) the throttle remembers
+#define MAX_NETWORK_PROFILES (4)
+
+// for the profile argument below: the one in use
+#define CURRENT_PROFILE      (-1)
+
+
+// the DHCP lease from the last connection to a network, to use again
+// instead of asking for a new one (all in network byte order, as IPAddress)
+typedef struct NetworkLease {
+    uint32_t    address;           // 0 if there isn't one
+    uint32_t    netmask;
+    uint32_t    gateway;
+    uint32_t    dns;
+} NetworkLease;
+
+
+typedef struct NetworkProfile {
+    std::string ssid;              // empty if this profile is unused
+    std::string password;
+    std::string serverAddress;
+    std::string serverPort;
+    uint8_t     bssid[6];          // last access point associated with, all 0 if unknown
+    uint8_t     channel;           // and its channel, 0 if unknown
+    NetworkLease lease;
+} NetworkProfile;
+
+
+// one access point seen in a WiFi scan
+typedef struct NetworkScanEntry {
+    std::string ssid;
+    uint8_t     bssid[6];
+    int         channel;
+    int         rssi;
+} NetworkScanEntry;
+
 
 class ThrottleDataDelegate
 {
@@ -37,31 +83,89 @@ class ThrottleDataDelegate
 class ThrottleData
 {
   public:
-    ThrottleData();
+    ThrottleData(ThrottleStorage& storage = defaultThrottleStorage());
+
+    // load every setting from flash into RAM; after this, the getters
+    // never touch the filesystem
     bool begin(Stream *console);
 
+    // flush any changed settings once they have been stable for a while,
+    // to be called VERY frequently
+    void check();
+
+    // flush any changed settings to flash right now
+    bool commit();
+
     std::string getDeviceName();
     void saveDeviceName(std::string);
 
     std::string getSerialNumber();
     void saveSerialNumber(std::string);
 
-    std::string getWifiSSID();
-    void saveWifiSSID(std::string);
+    // The WiFi and server settings below all belong to the current network
+    // profile.  Selecting a different profile changes what they return and
+    // which profile they save into.
+    int getCurrentProfile();
+    void selectProfile(int profile);
+    NetworkProfile getProfile(int profile = CURRENT_PROFILE);
+
+    // pick the configured profile that best matches a scan
+    //   return the profile index (and, in entry, the scan entry that
+    //   matched), or -1 if no configured network was seen
+    int matchProfiles(const std::vector<NetworkScanEntry>& scan, int *entry);
+
+    // These can also be given a profile number, to read or change a
+    // profile other than the current one (as BLE provisioning does)
+    // without switching to it.
+    std::string getWifiSSID(int profile = CURRENT_PROFILE);
+    void saveWifiSSID(std::string, int profile = CURRENT_PROFILE);
 
-    std::string getWifiPassword();
-    void saveWifiPassword(std::string);
+    std::string getWifiPassword(int profile = CURRENT_PROFILE);
+    void saveWifiPassword(std::string, int profile = CURRENT_PROFILE);
 
-    std::string getServerAddress();
-    void saveServerAddress(std::string);
+    std::string getServerAddress(int profile = CURRENT_PROFILE);
+    void saveServerAddress(std::string, int profile = CURRENT_PROFILE);
 
-    std::string getServerPort();
-    void saveServerPort(std::string);
+    std::string getServerPort(int profile = CURRENT_PROFILE);
+    void saveServerPort(std::string, int profile = CURRENT_PROFILE);
+
+    // remember the access point the current profile last connected to
+    void saveAccessPoint(const uint8_t *bssid, uint8_t channel);
+
+    // and the address it was given there; forget it once it stops working
+    void saveLease(const NetworkLease& lease);
+    void forgetLease();
 
   private:
-    bool writeFile(std::string filename, std::string content);
+    typedef struct Settings {
+        std::string    deviceName;
+        std::string    serialNumber;
+        uint8_t        currentProfile;
+        NetworkProfile profiles[MAX_NETWORK_PROFILES];
+    } Settings;
+
+    NetworkProfile& currentProfile() { return settings.profiles[settings.currentProfile]; }
+    NetworkProfile& profileFor(int profile);
+    void setString(std::string& setting, const std::string& value);
+    void settingsChanged();
+
+    bool loadConfig();
+    void migrateLegacyFiles();
+    std::string packConfig();
+    static bool unpackConfig(const std::string& payload, uint16_t version, Settings& settings);
+
     std::string readFile(std::string filename, std::string defaultContent);
-    std::string getFileContent(std::string path);
-    bool saveContentToFile(std::string data, std::string path);
+
+    ThrottleStorage& storage;
+
+    Settings    settings;
+    bool        dirty;           // settings have changed since they were last written
+    Chrono      writeBehindTimer;
+
+    int         activeSlot;      // config slot holding the current record, -1 if none
+    uint32_t    sequence;        // of the record in activeSlot
+
+    SemaphoreHandle_t lock;      // over all of the above; see SettingsLock
+
     Stream *console;
 };
@@ -23,7 +23,16 @@
 
 #pragma once
 
+// this is also built on a host, for SimHW (see sim/SimHW.h)
+#ifdef ARDUINO
 #include <Arduino.h>
+#else
+#include <cstddef>
+#include <cstdint>
+class Stream;
+#endif
+
+#include <string>
 
 
 
@@ -45,15 +54,42 @@ typedef enum TimeStatus {
 } TimeStatus;
 
 
+// How an RGB light shows its color.  Anything but LEDSteady is left to the
+// LED driver hardware where there is one.
+typedef enum LEDPattern {
+    LEDSteady = 0,
+    LEDBlink,         // 1/2 s on, 1/2 s off
+    LEDFastBlink,     // 1/4 s on, 1/4 s off
+    LEDBreathe,       // fade up, hold, fade down, hold
+    LEDFade,          // fade up and down, continuously
+    LEDPatternCount
+} LEDPattern;
+
+
+// A cab is one speed knob and direction toggle, driving one locomotive.
+// The HW may have up to this many, numbered from 0.
+#define MAX_CABS (2)
+
+
 class ThrottleHWDelegate
 {
 public:
-    virtual void speedChanged(int newSpeed, TogglePosition togglePosition) {}
-    virtual void togglePositionChanged(TogglePosition newPosition) {}
-    virtual void throttleMoved() {}
+    virtual void speedChanged(int cab, int newSpeed, TogglePosition togglePosition) {}
+    virtual void togglePositionChanged(int cab, TogglePosition newPosition) {}
+    // magnitude: the largest change in acceleration seen (mg)
+    virtual void throttleMoved(int magnitude) {}
     virtual void throttleFell() {}
-    virtual void batteryLevelChanged(int batteryLevel) {}
-    virtual void functionButtonChanged(int func, bool pressed) {}
+    // not moved in a while (set down, or forgotten)
+    virtual void throttleIdle() {}
+    // millivolts: battery voltage, percent: charge (0-100), minutesRemaining: -1 if not known
+    virtual void batteryLevelChanged(int millivolts, int percent, int minutesRemaining) {}
+    // timestamp: micros() when the button changed
+    virtual void functionButtonChanged(int func, bool pressed, uint32_t timestamp) {}
+
+    // Called from the HW's own task, NOT the one that calls check(), when
+    // there are changes waiting to be delivered by check().  Only use it
+    // to wake that task up.
+    virtual void eventsPending() {}
 };
 
 class ThrottleHW
@@ -75,17 +111,28 @@ class ThrottleHW
 
     virtual void setLight(int light, uint8_t state) = 0;  // state: 0=off
 
-    virtual void setRGB(int light, uint8_t red, uint8_t green, uint8_t blue) = 0;  // all colors: 0=off, !0=PWM
+    virtual void setRGB(int light, uint8_t red, uint8_t green, uint8_t blue,
+                        LEDPattern pattern = LEDSteady) = 0;  // all colors: 0=off, !0=PWM
 
     virtual void triggerHapticMotor(int mode) = 0;
 
     virtual void setTimeDisplay(int hour, int minute) = 0;
     virtual void setTimeStatus(TimeStatus status) = 0;
 
+    // how many cabs this HW has (1 to MAX_CABS)
+    virtual int cabCount() { return 1; }
+
+    // the number of speed steps the cab's locomotive's decoder uses (as
+    // reported by the server), so speed values can be kept on real steps
+    virtual void setSpeedSteps(int cab, int steps) {}
+
+    // nothing is happening: trade input responsiveness for power
+    virtual void setLowPower(bool lowPower) {}
+
     // Call this function to reset all "last known" values and have them be sent again
-    virtual void resetStats();
+    virtual void resetStats() = 0;
 
-    virtual std::string getHWVersion();
+    virtual std::string getHWVersion() = 0;
 
     Stream* console;
 
@@ -28,7 +28,8 @@
 ThrottleService::ThrottleService() :
     speed(0),
     direction(Forward),
-    togglePosition(UnknownPosition)
+    togglePosition(UnknownPosition),
+    cab(0)
 {
 }
 
@@ -65,6 +66,16 @@ ThrottleService::begin(BLEServer *bleServer, Stream *console)
             BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
         descriptionCharacteristic->setCallbacks(this);
 
+        functionLabelsCharacteristic = throttleService->createCharacteristic(
+            THROTTLE_FUNCTION_LABELS_CHARACTERISTIC_UUID,
+            BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_NOTIFY);
+        functionLabelsCharacteristic->setCallbacks(this);
+
+        cabCharacteristic = throttleService->createCharacteristic(
+            THROTTLE_CAB_CHARACTERISTIC_UUID,
+            BLECharacteristic::PROPERTY_READ | BLECharacteristic::PROPERTY_WRITE | BLECharacteristic::PROPERTY_NOTIFY);
+        cabCharacteristic->setCallbacks(this);
+
         throttleService->start();
     }
     else {
@@ -130,6 +141,30 @@ ThrottleService::setLongDescription(std::string description)
 }
 
 
+void
+ThrottleService::setFunctionLabels(std::string labels)
+{
+    if (functionLabels != labels) {
+        functionLabels = labels;
+
+        functionLabelsCharacteristic->setValue(functionLabels);
+        functionLabelsCharacteristic->notify();
+    }
+}
+
+
+void
+ThrottleService::setCab(int newCab)
+{
+    if (cab != newCab) {
+        cab = (uint8_t) newCab;
+
+        cabCharacteristic->setValue(&cab, 1);
+        cabCharacteristic->notify();
+    }
+}
+
+
 std::string
 ThrottleService::directionString(Direction direction)
 {
@@ -181,6 +216,12 @@ ThrottleService::onWrite(BLECharacteristic *characteristic)
             delegate->throttleAddressChanged(characteristic->getValue());
         }
     }
+    else if (characteristic->getUUID().equals(BLEUUID(THROTTLE_CAB_CHARACTERISTIC_UUID))) {
+        std::string value = characteristic->getValue();
+        if (delegate && value.size() == 1) {
+            delegate->throttleCabSelected((uint8_t) value[0]);
+        }
+    }
 }
 
 
@@ -207,4 +248,10 @@ ThrottleService::onRead(BLECharacteristic *characteristic)
     else if (characteristic->getUUID().equals(BLEUUID(THROTTLE_DESCRIPTION_CHARACTERISTIC_UUID))) {
         characteristic->setValue(longDescription);
     }
+    else if (characteristic->getUUID().equals(BLEUUID(THROTTLE_FUNCTION_LABELS_CHARACTERISTIC_UUID))) {
+        characteristic->setValue(functionLabels);
+    }
+    else if (characteristic->getUUID().equals(BLEUUID(THROTTLE_CAB_CHARACTERISTIC_UUID))) {
+        characteristic->setValue(&cab, 1);
+    }
 }
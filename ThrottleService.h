@@ -40,11 +40,15 @@
 #define THROTTLE_TOGGLE_CHARACTERISTIC_UUID    "426c7565-37e3-4688-b7f5-4b646f626279"
 #define THROTTLE_ADDRESS_CHARACTERISTIC_UUID   "426c7565-37e4-4688-b7f5-4b646f626279"
 #define THROTTLE_DESCRIPTION_CHARACTERISTIC_UUID "426c7565-37e5-4688-b7f5-4b646f626279"
+#define THROTTLE_FUNCTION_LABELS_CHARACTERISTIC_UUID "426c7565-37e6-4688-b7f5-4b646f626279"
+#define THROTTLE_CAB_CHARACTERISTIC_UUID       "426c7565-37e7-4688-b7f5-4b646f626279"
 
 class ThrottleServiceDelegate
 {
   public:
+    // for the cab that's currently selected
     virtual void throttleAddressChanged(std::string address) { };
+    virtual void throttleCabSelected(int cab) { };
 };
 
 
@@ -65,6 +69,10 @@ class ThrottleService :
     void setTogglePosition(TogglePosition position);
     void setSelectedAddress(std::string address);
     void setLongDescription(std::string address);
+    void setFunctionLabels(std::string labels);   // "|" separated, F0 first
+
+    // the values above are all for this cab (0 on a single cab throttle)
+    void setCab(int cab);
 
     ThrottleServiceDelegate *delegate;
 
@@ -79,12 +87,16 @@ class ThrottleService :
     BLECharacteristic *toggleCharacteristic;
     BLECharacteristic *addressCharacteristic;
     BLECharacteristic *descriptionCharacteristic;
+    BLECharacteristic *functionLabelsCharacteristic;
+    BLECharacteristic *cabCharacteristic;
 
     uint8_t speed;
     Direction direction;
     TogglePosition togglePosition;
     std::string address;
     std::string longDescription;
+    std::string functionLabels;
+    uint8_t cab;
 
     Stream *console;
 };
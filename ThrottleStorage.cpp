@@ -0,0 +1,323 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "ThrottleStorage.h"
+
+
+#ifdef ARDUINO
+
+#if THROTTLE_STORAGE == THROTTLE_STORAGE_SPIFFS
+#include "SPIFFS.h"
+#elif THROTTLE_STORAGE == THROTTLE_STORAGE_LITTLEFS
+// https://github.com/lorol/LITTLEFS
+#include "LITTLEFS.h"
+#endif
+
+/* You only need to format the filesystem the first time you run a
+   test or else use the SPIFFS plugin to create a partition
+   https://github.com/me-no-dev/arduino-esp32fs-plugin */
+#define FORMAT_FS_IF_FAILED true
+
+
+bool
+ArduinoFSStorage::readFile(const std::string& path, std::string& content)
+{
+    stats.opens++;
+
+    File file = fs.open(path.c_str(), FILE_READ);
+    if (!file || file.isDirectory()) {
+        return false;
+    }
+
+    // size the buffer once and fill it with block reads, rather than
+    // growing it one filesystem read (and possible reallocation) per byte
+    size_t size = file.size();
+    content.resize(size);
+
+    size_t offset = 0;
+    while (offset < size) {
+        size_t count = file.read((uint8_t *) &content[offset], size - offset);
+        stats.reads++;
+        if (count == 0) {
+            break;
+        }
+        offset += count;
+    }
+
+    content.resize(offset);
+    stats.bytesRead += offset;
+
+    return true;
+}
+
+
+bool
+ArduinoFSStorage::writeFile(const std::string& path, const std::string& content)
+{
+    stats.opens++;
+
+    File file = fs.open(path.c_str(), FILE_WRITE);
+    if (!file || file.isDirectory()) {
+        return false;
+    }
+
+    size_t count = file.write((const uint8_t *) content.data(), content.size());
+    stats.writes++;
+    stats.bytesWritten += count;
+
+    return count == content.size();
+}
+
+
+bool
+ArduinoFSStorage::exists(const std::string& path)
+{
+    return fs.exists(path.c_str());
+}
+
+
+bool
+ArduinoFSStorage::remove(const std::string& path)
+{
+    stats.removes++;
+    return fs.remove(path.c_str());
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+#if THROTTLE_STORAGE == THROTTLE_STORAGE_SPIFFS
+
+SPIFFSStorage::SPIFFSStorage() :
+    ArduinoFSStorage(SPIFFS)
+{
+}
+
+
+bool
+SPIFFSStorage::begin()
+{
+    return SPIFFS.begin(FORMAT_FS_IF_FAILED);
+}
+
+
+size_t
+SPIFFSStorage::totalBytes()
+{
+    return SPIFFS.totalBytes();
+}
+
+
+size_t
+SPIFFSStorage::usedBytes()
+{
+    return SPIFFS.usedBytes();
+}
+
+
+ThrottleStorage&
+defaultThrottleStorage()
+{
+    static SPIFFSStorage storage;
+    return storage;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+
+#elif THROTTLE_STORAGE == THROTTLE_STORAGE_LITTLEFS
+
+LittleFSStorage::LittleFSStorage() :
+    ArduinoFSStorage(LITTLEFS)
+{
+}
+
+
+bool
+LittleFSStorage::begin()
+{
+    return LITTLEFS.begin(FORMAT_FS_IF_FAILED);
+}
+
+
+size_t
+LittleFSStorage::totalBytes()
+{
+    return LITTLEFS.totalBytes();
+}
+
+
+size_t
+LittleFSStorage::usedBytes()
+{
+    return LITTLEFS.usedBytes();
+}
+
+
+ThrottleStorage&
+defaultThrottleStorage()
+{
+    static LittleFSStorage storage;
+    return storage;
+}
+
+#else
+#error "THROTTLE_STORAGE must be SPIFFS or LITTLEFS on the ESP32"
+#endif
+
+////////////////////////////////////////////////////////////////////////////////
+
+#else  // !ARDUINO
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/statvfs.h>
+
+
+PosixStorage::PosixStorage(const std::string& root) :
+    root(root)
+{
+}
+
+
+std::string
+PosixStorage::hostPath(const std::string& path)
+{
+    // config paths are all absolute ("/config.a"), relative to the root
+    return root + path;
+}
+
+
+bool
+PosixStorage::begin()
+{
+    struct stat st;
+
+    if (stat(root.c_str(), &st) != 0) {
+        return mkdir(root.c_str(), 0755) == 0;
+    }
+    return S_ISDIR(st.st_mode);
+}
+
+
+bool
+PosixStorage::readFile(const std::string& path, std::string& content)
+{
+    stats.opens++;
+
+    FILE *file = fopen(hostPath(path).c_str(), "rb");
+    if (!file) {
+        return false;
+    }
+
+    struct stat st;
+    if (fstat(fileno(file), &st) != 0 || !S_ISREG(st.st_mode)) {
+        fclose(file);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    content.resize(size);
+
+    size_t offset = 0;
+    while (offset < size) {
+        size_t count = fread(&content[offset], 1, size - offset, file);
+        stats.reads++;
+        if (count == 0) {
+            break;
+        }
+        offset += count;
+    }
+
+    content.resize(offset);
+    stats.bytesRead += offset;
+
+    fclose(file);
+    return true;
+}
+
+
+bool
+PosixStorage::writeFile(const std::string& path, const std::string& content)
+{
+    stats.opens++;
+
+    FILE *file = fopen(hostPath(path).c_str(), "wb");
+    if (!file) {
+        return false;
+    }
+
+    size_t count = fwrite(content.data(), 1, content.size(), file);
+    stats.writes++;
+    stats.bytesWritten += count;
+
+    bool rv = (fclose(file) == 0) && (count == content.size());
+    return rv;
+}
+
+
+bool
+PosixStorage::exists(const std::string& path)
+{
+    return access(hostPath(path).c_str(), F_OK) == 0;
+}
+
+
+bool
+PosixStorage::remove(const std::string& path)
+{
+    stats.removes++;
+    return ::remove(hostPath(path).c_str()) == 0;
+}
+
+
+size_t
+PosixStorage::totalBytes()
+{
+    struct statvfs vfs;
+    if (statvfs(root.c_str(), &vfs) != 0) {
+        return 0;
+    }
+    return vfs.f_blocks * vfs.f_frsize;
+}
+
+
+size_t
+PosixStorage::usedBytes()
+{
+    struct statvfs vfs;
+    if (statvfs(root.c_str(), &vfs) != 0) {
+        return 0;
+    }
+    return (vfs.f_blocks - vfs.f_bfree) * vfs.f_frsize;
+}
+
+
+ThrottleStorage&
+defaultThrottleStorage()
+{
+    const char *root = getenv("THROTTLE_STORAGE_ROOT");
+    static PosixStorage storage(root ? root : ".");
+    return storage;
+}
+
+#endif
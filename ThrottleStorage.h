@@ -0,0 +1,169 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+
+#include <string>
+
+
+// Select the filesystem that holds the throttle's settings by defining
+// THROTTLE_STORAGE to one of these (SPIFFS is the default).  The POSIX
+// backend is only available on a host build, where it lets the config
+// layer be exercised against a plain directory.
+#define THROTTLE_STORAGE_SPIFFS    (1)
+#define THROTTLE_STORAGE_LITTLEFS  (2)
+#define THROTTLE_STORAGE_POSIX     (3)
+
+#ifndef THROTTLE_STORAGE
+#ifdef ARDUINO
+#define THROTTLE_STORAGE THROTTLE_STORAGE_SPIFFS
+#else
+#define THROTTLE_STORAGE THROTTLE_STORAGE_POSIX
+#endif
+#endif
+
+
+// Counts of the operations issued to the underlying filesystem, so that
+// backends can be compared and callers can check they aren't touching
+// flash when they shouldn't be.
+typedef struct StorageStats {
+    uint32_t opens;
+    uint32_t reads;          // read calls issued (not files read)
+    uint32_t writes;         // write calls issued
+    uint32_t removes;
+    uint32_t bytesRead;
+    uint32_t bytesWritten;
+} StorageStats;
+
+
+class ThrottleStorage
+{
+  public:
+    ThrottleStorage() : stats() {}
+    virtual ~ThrottleStorage() {}
+
+    // mount the filesystem (formatting it if it can't be mounted)
+    //   return true if the filesystem is usable
+    virtual bool begin() = 0;
+
+    // read the whole file into content
+    //   return false if the file doesn't exist or can't be read
+    virtual bool readFile(const std::string& path, std::string& content) = 0;
+
+    // replace the file with content
+    virtual bool writeFile(const std::string& path, const std::string& content) = 0;
+
+    virtual bool exists(const std::string& path) = 0;
+    virtual bool remove(const std::string& path) = 0;
+
+    virtual size_t totalBytes() = 0;
+    virtual size_t usedBytes() = 0;
+
+    virtual const char *name() = 0;
+
+    void resetStats() { stats = StorageStats(); }
+
+    StorageStats stats;
+};
+
+
+#ifdef ARDUINO
+
+#include "FS.h"
+
+// Common implementation for the filesystems that sit behind the Arduino
+// fs::FS interface; subclasses only need to know how to mount theirs.
+class ArduinoFSStorage : public ThrottleStorage
+{
+  public:
+    ArduinoFSStorage(fs::FS& fs) : fs(fs) {}
+
+    bool readFile(const std::string& path, std::string& content);
+    bool writeFile(const std::string& path, const std::string& content);
+    bool exists(const std::string& path);
+    bool remove(const std::string& path);
+
+  protected:
+    fs::FS& fs;
+};
+
+
+#if THROTTLE_STORAGE == THROTTLE_STORAGE_SPIFFS
+
+class SPIFFSStorage : public ArduinoFSStorage
+{
+  public:
+    SPIFFSStorage();
+
+    bool begin();
+    size_t totalBytes();
+    size_t usedBytes();
+    const char *name() { return "SPIFFS"; }
+};
+
+#elif THROTTLE_STORAGE == THROTTLE_STORAGE_LITTLEFS
+
+class LittleFSStorage : public ArduinoFSStorage
+{
+  public:
+    LittleFSStorage();
+
+    bool begin();
+    size_t totalBytes();
+    size_t usedBytes();
+    const char *name() { return "LittleFS"; }
+};
+
+#endif
+
+#else  // !ARDUINO
+
+// Stores each file under a directory on the host
+class PosixStorage : public ThrottleStorage
+{
+  public:
+    PosixStorage(const std::string& root);
+
+    bool begin();
+    bool readFile(const std::string& path, std::string& content);
+    bool writeFile(const std::string& path, const std::string& content);
+    bool exists(const std::string& path);
+    bool remove(const std::string& path);
+    size_t totalBytes();
+    size_t usedBytes();
+    const char *name() { return "POSIX"; }
+
+  private:
+    std::string hostPath(const std::string& path);
+
+    std::string root;
+};
+
+#endif
+
+
+// the backend selected by THROTTLE_STORAGE (on a host build, rooted at the
+// directory named by $THROTTLE_STORAGE_ROOT, or the current directory)
+ThrottleStorage& defaultThrottleStorage();
@@ -38,6 +38,9 @@ WifiService::WifiService(ThrottleData& flashData):
     deviceNetmask(),
     deviceGateway(),
     deviceMac(),
+    scanResults(),
+    scanStartedAt(0),
+    editingProfile(CURRENT_PROFILE),
     connectionState("DISCONNECTED"),
     delegate(NULL),
     advertisements(NULL),
@@ -126,6 +129,13 @@ WifiService::begin(BLEServer *bleServer, Stream *console)
                                                                         | BLECharacteristic::PROPERTY_NOTIFY);
             deviceMacCharacteristic->setCallbacks(this);
 
+            // selects which network profile the SSID, password, server and
+            // port characteristics read and write
+            profileCharacteristic = wifiService->createCharacteristic(WIFI_PROFILE_CHARACTERISTIC_UUID,
+                                                                      BLECharacteristic::PROPERTY_READ
+                                                                      | BLECharacteristic::PROPERTY_WRITE);
+            profileCharacteristic->setCallbacks(this);
+
 
             wifiService->start();
             console->println("BLE wifiService started");
@@ -161,30 +171,33 @@ WifiService::onWrite(BLECharacteristic *characteristic)
 
     if (characteristic->getUUID().equals(BLEUUID(WIFI_SSID_CHARACTERISTIC_UUID))) {
         ssid = characteristic->getValue();
-        flashData.saveWifiSSID(ssid);
+        flashData.saveWifiSSID(ssid, editingProfile);
         console->print("write for ssid "); console->println(characteristic->getValue().c_str());
     }
     else
     if (characteristic->getUUID().equals(BLEUUID(WIFI_PASSWORD_CHARACTERISTIC_UUID))) {
         password = characteristic->getValue();
-        flashData.saveWifiPassword(password);
+        flashData.saveWifiPassword(password, editingProfile);
         console->print("write for password "); console->println(characteristic->getValue().c_str());
     }
     else
     if (characteristic->getUUID().equals(BLEUUID(WIFI_SERVER_CHARACTERISTIC_UUID))) {
         serverAddress = characteristic->getValue();
-        flashData.saveServerAddress(serverAddress);
+        flashData.saveServerAddress(serverAddress, editingProfile);
         console->print("write for server address "); console->println(characteristic->getValue().c_str());
     }
     else
     if (characteristic->getUUID().equals(BLEUUID(WIFI_PORT_CHARACTERISTIC_UUID))) {
         serverPort = characteristic->getValue();
-        flashData.saveServerPort(serverPort);
+        flashData.saveServerPort(serverPort, editingProfile);
         console->print("write for server port "); console->println(characteristic->getValue().c_str());
     }
     else
     if (characteristic->getUUID().equals(BLEUUID(WIFI_COMMAND_CHARACTERISTIC_UUID))) {
         console->print("write for command "); console->println(characteristic->getValue().c_str());
+        if (characteristic->getValue() == WIFI_COMMAND_USE_PROFILE && editingProfile != CURRENT_PROFILE) {
+            flashData.selectProfile(editingProfile);
+        }
         if (delegate) {
             delegate->wifiCommandReceived(characteristic->getValue());
         }
@@ -195,6 +208,14 @@ WifiService::onWrite(BLECharacteristic *characteristic)
         flashData.saveDeviceName(deviceName);
         console->print("write for device name "); console->println(characteristic->getValue().c_str());
     }
+    else
+    if (characteristic->getUUID().equals(BLEUUID(WIFI_PROFILE_CHARACTERISTIC_UUID))) {
+        // only which profile the other characteristics show and change;
+        // the one in use stays as it is until WIFI_COMMAND_USE_PROFILE
+        int profile = atoi(characteristic->getValue().c_str());
+        editingProfile = (profile >= 0 && profile < MAX_NETWORK_PROFILES) ? profile : CURRENT_PROFILE;
+        console->printf("write for network profile %d\n", profile);
+    }
     else {
         console->printf("received write for unknown UUID: %s\n", characteristic->getUUID().toString());
     }
@@ -212,22 +233,22 @@ WifiService::onRead(BLECharacteristic *characteristic)
     console->println(characteristic->getUUID().toString().c_str());
 
     if (characteristic->getUUID().equals(BLEUUID(WIFI_SSID_CHARACTERISTIC_UUID))) {
-        auto ssid = flashData.getWifiSSID();
+        auto ssid = flashData.getWifiSSID(editingProfile);
         characteristic->setValue(ssid);
     }
     else
     if (characteristic->getUUID().equals(BLEUUID(WIFI_PASSWORD_CHARACTERISTIC_UUID))) {
-        auto password = flashData.getWifiPassword();
+        auto password = flashData.getWifiPassword(editingProfile);
         characteristic->setValue(password);
     }
     else
     if (characteristic->getUUID().equals(BLEUUID(WIFI_SERVER_CHARACTERISTIC_UUID))) {
-        auto serverAddress = flashData.getServerAddress();
+        auto serverAddress = flashData.getServerAddress(editingProfile);
         characteristic->setValue(serverAddress);
     }
     else
     if (characteristic->getUUID().equals(BLEUUID(WIFI_PORT_CHARACTERISTIC_UUID))) {
-        auto serverPort = flashData.getServerPort();
+        auto serverPort = flashData.getServerPort(editingProfile);
         characteristic->setValue(serverPort);
     }
     else
@@ -258,6 +279,12 @@ WifiService::onRead(BLECharacteristic *characteristic)
     if (characteristic->getUUID().equals(BLEUUID(WIFI_DEVICE_MAC_CHARACTERISTIC_UUID))) {
         characteristic->setValue(deviceMac);
     }
+    else
+    if (characteristic->getUUID().equals(BLEUUID(WIFI_PROFILE_CHARACTERISTIC_UUID))) {
+        std::ostringstream s;
+        s << (editingProfile == CURRENT_PROFILE ? flashData.getCurrentProfile() : editingProfile);
+        characteristic->setValue(s.str());
+    }
 }
 
 
@@ -324,10 +351,22 @@ WifiService::setDeviceMac(std::string mac)
 
 
 void
-WifiService::scanNetworks()
+WifiService::startScan()
+{
+    scanStartedAt = millis();
+    WiFi.scanNetworks(true);
+}
+
+
+bool
+WifiService::scanFinished()
 {
-    auto start = millis();
-    int n = WiFi.scanNetworks();
+    int n = WiFi.scanComplete();
+    if (n == WIFI_SCAN_RUNNING) {
+        return false;
+    }
+
+    scanResults.clear();
 
     if (n > 0) {
         std::ostringstream s;
@@ -344,6 +383,13 @@ WifiService::scanNetworks()
             std::string encryption = ((WiFi.encryptionType(thisNet) == WIFI_AUTH_OPEN) ? "OPEN " : "*");
 
             s << "|" << ssid << "," << rssi << "," << encryption;
+
+            NetworkScanEntry entry;
+            entry.ssid = ssid;
+            memcpy(entry.bssid, WiFi.BSSID(thisNet), sizeof(entry.bssid));
+            entry.channel = WiFi.channel(thisNet);
+            entry.rssi = rssi;
+            scanResults.push_back(entry);
         }
 
         const std::string wifiListString(s.str());
@@ -352,8 +398,16 @@ WifiService::scanNetworks()
         ssidListCharacteristic->setValue(wifiListString);
         ssidListCharacteristic->notify();
     }
-    auto end = millis();
+    WiFi.scanDelete();
 
-    auto duration = end - start;
+    auto duration = millis() - scanStartedAt;
     console->printf("scanNetworks took %u millis\n", duration);
+    return true;
+}
+
+
+const std::vector<NetworkScanEntry>&
+WifiService::getScanResults()
+{
+    return scanResults;
 }
@@ -26,6 +26,7 @@
 #include "Arduino.h"
 
 #include <string>
+#include <vector>
 #include <iostream>
 
 #include <BLEDevice.h>
@@ -47,9 +48,14 @@
 #define WIFI_DEVICE_NETMASK_CHARACTERISTIC_UUID "426c7565-36e9-4688-b7f5-4b646f626279"
 #define WIFI_DEVICE_GATEWAY_CHARACTERISTIC_UUID "426c7565-36ea-4688-b7f5-4b646f626279"
 #define WIFI_DEVICE_MAC_CHARACTERISTIC_UUID     "426c7565-36eb-4688-b7f5-4b646f626279"
+#define WIFI_PROFILE_CHARACTERISTIC_UUID        "426c7565-36ec-4688-b7f5-4b646f626279"
 
 #define DEVICE_NAME_CHARACTERISTIC_UUID    "426c7565-36f0-4688-b7f5-4b646f626279"
 
+// written to the command characteristic: switch to the profile being
+// edited, then reconnect.  Any other command just reconnects.
+#define WIFI_COMMAND_USE_PROFILE "use"
+
 
 class WifiServiceDelegate
 {
@@ -75,7 +81,11 @@ class WifiService:
     void setDeviceGateway(IPAddress gateway);
     void setDeviceMac(std::string mac);
 
-    void scanNetworks();
+    // scan in the background; scanFinished() is true once the results
+    // are in (and published over BLE)
+    void startScan();
+    bool scanFinished();
+    const std::vector<NetworkScanEntry>& getScanResults();
 
     WifiServiceDelegate *delegate;
 
@@ -88,6 +98,9 @@ class WifiService:
     IPAddress deviceNetmask;
     IPAddress deviceGateway;
     std::string deviceMac;
+    std::vector<NetworkScanEntry> scanResults;
+    unsigned long scanStartedAt;
+    int         editingProfile;    // the profile characteristic's choice, or CURRENT_PROFILE
 
 
     BLEService *wifiService;
@@ -105,6 +118,7 @@ class WifiService:
     BLECharacteristic *deviceNetmaskCharacteristic;
     BLECharacteristic *deviceGatewayCharacteristic;
     BLECharacteristic *deviceMacCharacteristic;
+    BLECharacteristic *profileCharacteristic;
 
     BLEAdvertising *advertisements;
 
@@ -0,0 +1,314 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "FlashModel.h"
+
+#define FLASH_BLOCK_SIZE          (4096)
+
+// SPIFFS, as arduino-esp32 configures it
+#define SPIFFS_PAGE_SIZE          (256)
+#define SPIFFS_PAGE_HEADER        (5)
+#define SPIFFS_PAGES_PER_BLOCK    (FLASH_BLOCK_SIZE / SPIFFS_PAGE_SIZE)
+#define SPIFFS_DATA_PAGES         (SPIFFS_PAGES_PER_BLOCK - 1)   // less the lookup page
+#define SPIFFS_LOOKUP_ENTRY       (2)
+
+// LittleFS, with the esp_littlefs defaults
+#define LITTLEFS_PROG_SIZE        (128)
+#define LITTLEFS_INLINE_MAX       (512)      // the cache size
+#define LITTLEFS_TAG              (4)
+#define LITTLEFS_CTZ_STRUCT       (8)        // head block, size
+#define LITTLEFS_SUPERBLOCK       (LITTLEFS_TAG + 8 + LITTLEFS_TAG + 24)
+
+
+static uint32_t
+roundUp(uint32_t value, uint32_t multiple)
+{
+    return (value + multiple - 1) / multiple * multiple;
+}
+
+
+FlashModelStorage::FlashModelStorage(ThrottleStorage& files, size_t partitionSize) :
+    cost(),
+    files(files),
+    partitionSize(partitionSize),
+    sizes()
+{
+}
+
+
+bool
+FlashModelStorage::begin()
+{
+    bool rv = files.begin();
+    mountCost();
+    return rv;
+}
+
+
+bool
+FlashModelStorage::readFile(const std::string& path, std::string& content)
+{
+    stats.opens++;
+
+    bool found = sizes.count(path) != 0;
+    openCost(path, found);
+
+    if (!found || !files.readFile(path, content)) {
+        return false;
+    }
+
+    stats.reads++;
+    stats.bytesRead += content.size();
+    readCost(content.size());
+    return true;
+}
+
+
+bool
+FlashModelStorage::writeFile(const std::string& path, const std::string& content)
+{
+    stats.opens++;
+
+    bool existed = sizes.count(path) != 0;
+    size_t oldSize = existed ? sizes[path] : 0;
+    openCost(path, existed);
+
+    if (!files.writeFile(path, content)) {
+        return false;
+    }
+
+    stats.writes++;
+    stats.bytesWritten += content.size();
+    sizes[path] = content.size();
+    writeCost(path, oldSize, existed, content.size());
+    return true;
+}
+
+
+bool
+FlashModelStorage::exists(const std::string& path)
+{
+    bool found = sizes.count(path) != 0;
+    openCost(path, found);
+    return found;
+}
+
+
+bool
+FlashModelStorage::remove(const std::string& path)
+{
+    stats.removes++;
+
+    bool found = sizes.count(path) != 0;
+    openCost(path, found);
+
+    if (!found || !files.remove(path)) {
+        return false;
+    }
+
+    size_t size = sizes[path];
+    sizes.erase(path);
+    removeCost(path, size);
+    return true;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+SPIFFSModelStorage::SPIFFSModelStorage(ThrottleStorage& files, size_t partitionSize) :
+    FlashModelStorage(files, partitionSize),
+    deletedPages(0)
+{
+}
+
+
+// an index header page, and the data pages
+uint32_t
+SPIFFSModelStorage::pagesFor(size_t size)
+{
+    uint32_t payload = SPIFFS_PAGE_SIZE - SPIFFS_PAGE_HEADER;
+    return 1 + (size + payload - 1) / payload;
+}
+
+
+// flag each page deleted, and its lookup entry; garbage collection
+// erases a block once a block's worth of pages have been deleted
+void
+SPIFFSModelStorage::deletePages(uint32_t pages)
+{
+    program(1, pages);
+    program(SPIFFS_LOOKUP_ENTRY, pages);
+
+    deletedPages += pages;
+    cost.erases += deletedPages / SPIFFS_DATA_PAGES;
+    deletedPages %= SPIFFS_DATA_PAGES;
+}
+
+
+// the object lookup page of every block
+void
+SPIFFSModelStorage::mountCost()
+{
+    cost.bytesRead += (partitionSize / FLASH_BLOCK_SIZE) * SPIFFS_PAGE_SIZE;
+}
+
+
+// finding a name scans the lookup pages for index headers: on average
+// half of them to find a file, all of them to find it isn't there
+void
+SPIFFSModelStorage::openCost(const std::string&, bool found)
+{
+    uint32_t blocks = partitionSize / FLASH_BLOCK_SIZE;
+
+    if (found) {
+        cost.bytesRead += (blocks / 2) * SPIFFS_PAGE_SIZE + SPIFFS_PAGE_SIZE;
+    }
+    else {
+        cost.bytesRead += blocks * SPIFFS_PAGE_SIZE;
+    }
+}
+
+
+void
+SPIFFSModelStorage::readCost(size_t size)
+{
+    cost.bytesRead += (pagesFor(size) - 1) * SPIFFS_PAGE_SIZE;
+}
+
+
+void
+SPIFFSModelStorage::writeCost(const std::string&, size_t oldSize, bool existed, size_t newSize)
+{
+    if (existed) {
+        deletePages(pagesFor(oldSize));
+    }
+
+    uint32_t pages = pagesFor(newSize);
+    program(SPIFFS_PAGE_SIZE, pages);
+    program(SPIFFS_LOOKUP_ENTRY, pages);
+
+    // the index header is rewritten with the final size on close
+    program(SPIFFS_PAGE_SIZE);
+    deletePages(1);
+}
+
+
+void
+SPIFFSModelStorage::removeCost(const std::string&, size_t size)
+{
+    deletePages(pagesFor(size));
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+LittleFSModelStorage::LittleFSModelStorage(ThrottleStorage& files, size_t partitionSize) :
+    FlashModelStorage(files, partitionSize),
+    metadataUsed(roundUp(LITTLEFS_SUPERBLOCK, LITTLEFS_PROG_SIZE))
+{
+}
+
+
+// a file's entry in the directory: its name, and either its data
+// (inline) or where its blocks are
+uint32_t
+LittleFSModelStorage::entrySize(const std::string& path, size_t size)
+{
+    uint32_t entry = LITTLEFS_TAG + path.size() + LITTLEFS_TAG;
+    return entry + (size <= LITTLEFS_INLINE_MAX ? size : LITTLEFS_CTZ_STRUCT);
+}
+
+
+// append a commit (and its CRC) to the metadata block, compacting the
+// pair first if it won't fit
+void
+LittleFSModelStorage::commit(uint32_t bytes)
+{
+    uint32_t commitSize = roundUp(bytes + LITTLEFS_TAG + 4, LITTLEFS_PROG_SIZE);
+
+    if (metadataUsed + commitSize > FLASH_BLOCK_SIZE) {
+        uint32_t live = LITTLEFS_SUPERBLOCK;
+        for (std::map<std::string, size_t>::iterator file = sizes.begin(); file != sizes.end(); ++file) {
+            live += entrySize(file->first, file->second);
+        }
+        live = roundUp(live + LITTLEFS_TAG + 4, LITTLEFS_PROG_SIZE);
+
+        cost.erases++;
+        program(live, live / LITTLEFS_PROG_SIZE);
+        metadataUsed = live;
+    }
+
+    program(commitSize, commitSize / LITTLEFS_PROG_SIZE);
+    metadataUsed += commitSize;
+}
+
+
+// both blocks' revision counts, then the current one's commits
+void
+LittleFSModelStorage::mountCost()
+{
+    cost.bytesRead += 2 * LITTLEFS_PROG_SIZE + metadataUsed;
+}
+
+
+void
+LittleFSModelStorage::openCost(const std::string&, bool)
+{
+    cost.bytesRead += metadataUsed;
+}
+
+
+void
+LittleFSModelStorage::readCost(size_t size)
+{
+    if (size > LITTLEFS_INLINE_MAX) {
+        cost.bytesRead += roundUp(size, LITTLEFS_PROG_SIZE);
+    }
+}
+
+
+void
+LittleFSModelStorage::writeCost(const std::string& path, size_t, bool existed, size_t newSize)
+{
+    if (!existed) {
+        commit(LITTLEFS_TAG + path.size() + LITTLEFS_TAG);     // create
+    }
+
+    // copy on write: the old blocks are just left to the allocator
+    if (newSize > LITTLEFS_INLINE_MAX) {
+        uint32_t blocks = (newSize + FLASH_BLOCK_SIZE - 1) / FLASH_BLOCK_SIZE;
+        uint32_t bytes = roundUp(newSize, LITTLEFS_PROG_SIZE);
+
+        cost.erases += blocks;
+        program(bytes, bytes / LITTLEFS_PROG_SIZE);
+    }
+
+    commit(entrySize(path, newSize));
+}
+
+
+void
+LittleFSModelStorage::removeCost(const std::string&, size_t)
+{
+    commit(LITTLEFS_TAG);
+}
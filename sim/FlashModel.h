@@ -0,0 +1,139 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+
+#pragma once
+
+#include <map>
+#include <string>
+
+#include "ThrottleStorage.h"
+
+
+// What a workload is estimated to cost the flash chip itself
+typedef struct FlashCost {
+    uint32_t bytesRead;          // read from flash, including metadata
+    uint32_t programs;           // program operations issued
+    uint32_t bytesProgrammed;
+    uint32_t erases;             // 4 KB sector erases
+} FlashCost;
+
+
+// A ThrottleStorage that keeps its files in another (host) ThrottleStorage,
+// and estimates what each operation would cost on flash under SPIFFS or
+// LittleFS.  The firmware's calls are the same whichever filesystem is
+// underneath; how many flash reads, programs and erases they turn into is
+// what differs, and what these models count.
+//
+// Both are simplified models of the filesystems' on-flash layouts, as
+// configured by arduino-esp32 (4 KB blocks), for files the size of the
+// throttle's.  They don't model caching or wear leveling, so the numbers
+// are for comparing the two, not for predicting flash lifetime.
+class FlashModelStorage : public ThrottleStorage
+{
+  public:
+    FlashModelStorage(ThrottleStorage& files, size_t partitionSize);
+
+    bool begin();
+    bool readFile(const std::string& path, std::string& content);
+    bool writeFile(const std::string& path, const std::string& content);
+    bool exists(const std::string& path);
+    bool remove(const std::string& path);
+    size_t totalBytes() { return partitionSize; }
+    size_t usedBytes() { return files.usedBytes(); }
+
+    void resetCost() { cost = FlashCost(); }
+
+    FlashCost cost;
+
+  protected:
+    // the cost of each operation, given the sizes of the files involved
+    virtual void mountCost() = 0;
+    virtual void openCost(const std::string& path, bool found) = 0;
+    virtual void readCost(size_t size) = 0;
+    virtual void writeCost(const std::string& path, size_t oldSize, bool existed, size_t newSize) = 0;
+    virtual void removeCost(const std::string& path, size_t size) = 0;
+
+    void program(uint32_t bytes, uint32_t count = 1) { cost.programs += count; cost.bytesProgrammed += bytes; }
+
+    ThrottleStorage&              files;
+    size_t                        partitionSize;
+    std::map<std::string, size_t> sizes;      // of the files that exist
+};
+
+
+// SPIFFS: 256 byte pages, each with a 5 byte header; the first page of
+// each block is its object lookup table.  A file is an index header page
+// plus its data pages.  Rewriting a file marks its old pages deleted (a
+// program each, plus their lookup entries), and garbage collection later
+// erases a block for each block's worth of deleted pages.  Finding a file
+// by name scans the lookup pages, as does mounting.
+class SPIFFSModelStorage : public FlashModelStorage
+{
+  public:
+    SPIFFSModelStorage(ThrottleStorage& files, size_t partitionSize);
+
+    const char *name() { return "SPIFFS (model)"; }
+
+  protected:
+    void mountCost();
+    void openCost(const std::string& path, bool found);
+    void readCost(size_t size);
+    void writeCost(const std::string& path, size_t oldSize, bool existed, size_t newSize);
+    void removeCost(const std::string& path, size_t size);
+
+  private:
+    uint32_t pagesFor(size_t size);
+    void deletePages(uint32_t pages);
+
+    uint32_t deletedPages;       // not yet reclaimed by an erase
+};
+
+
+// LittleFS: the root directory (and superblock) is a metadata pair that
+// each change is appended to as a commit, rounded up to the program size.
+// Files up to the inline limit live in the commit; larger ones get their
+// own blocks, erased and written copy-on-write.  When the metadata block
+// fills, it's compacted into its partner: one erase, and the live entries
+// written again.  Mounting reads the pair's revision counts and the
+// current block's commits.
+class LittleFSModelStorage : public FlashModelStorage
+{
+  public:
+    LittleFSModelStorage(ThrottleStorage& files, size_t partitionSize);
+
+    const char *name() { return "LittleFS (model)"; }
+
+  protected:
+    void mountCost();
+    void openCost(const std::string& path, bool found);
+    void readCost(size_t size);
+    void writeCost(const std::string& path, size_t oldSize, bool existed, size_t newSize);
+    void removeCost(const std::string& path, size_t size);
+
+  private:
+    uint32_t entrySize(const std::string& path, size_t size);
+    void commit(uint32_t bytes);
+
+    uint32_t metadataUsed;       // bytes of the current metadata block in use
+};
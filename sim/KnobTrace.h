@@ -0,0 +1,113 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+
+#pragma once
+
+#include <stdio.h>
+
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "SimHW.h"
+
+
+// The knob readings from a SimHW trace (see SimHW.h), for running the
+// speed filters over, in test_speed_filter and bench_speed_filter
+
+typedef struct KnobSample {
+    uint32_t time;      // ms
+    int      reading;   // 0-4095
+} KnobSample;
+
+
+// the readings for one cab, in time order
+//   return false if the trace can't be read
+static inline bool
+loadKnobTrace(const char *path, std::vector<KnobSample>& samples, int cab = 0)
+{
+    std::ifstream trace(path);
+    std::string error;
+    SimHW hw(MAX_CABS);
+
+    if (!trace.is_open() || !hw.loadTrace(trace, &error)) {
+        fprintf(stderr, "%s: %s\n", path, error.empty() ? "can't read it" : error.c_str());
+        return false;
+    }
+
+    const std::vector<SimInput>& inputs = hw.traceInputs();
+    for (size_t index = 0; index < inputs.size(); index++) {
+        if (inputs[index].type == SimKnob && inputs[index].arg == cab) {
+            KnobSample sample = { inputs[index].time, inputs[index].value };
+            samples.push_back(sample);
+        }
+    }
+
+    return !samples.empty();
+}
+
+
+// the speed value the throttle would send after each reading
+template <typename Filter>
+static std::vector<int>
+replayKnobTrace(const std::vector<KnobSample>& samples)
+{
+    Filter filter;
+    SpeedCurveTable speedCurve;
+    std::vector<int> speeds;
+
+    for (size_t index = 0; index < samples.size(); index++) {
+        speeds.push_back(speedCurve.lookup(filter.update(samples[index].reading)));
+    }
+    return speeds;
+}
+
+
+// how many speed changes would be sent in [start, end)
+static inline int
+speedChangesBetween(const std::vector<KnobSample>& samples, const std::vector<int>& speeds,
+                    uint32_t start, uint32_t end)
+{
+    int changes = 0;
+    for (size_t index = 1; index < samples.size(); index++) {
+        if (samples[index].time >= start && samples[index].time < end
+            && speeds[index] != speeds[index - 1]) {
+            changes++;
+        }
+    }
+    return changes;
+}
+
+
+// the speed value at a time, -1 if the trace has ended
+static inline int
+speedAt(const std::vector<KnobSample>& samples, const std::vector<int>& speeds, uint32_t time)
+{
+    for (size_t index = 0; index < samples.size(); index++) {
+        if (samples[index].time >= time) {
+            return speeds[index];
+        }
+    }
+    return -1;
+}
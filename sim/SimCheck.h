@@ -0,0 +1,66 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+
+#pragma once
+
+#include <cstdio>
+
+
+// Just enough of a test harness for the host tests in sim/: each CHECK
+// that fails is reported (with where it was), and checkResult() gives the
+// exit status for main() to return.
+
+static int simCheckFailures = 0;
+
+#define CHECK(condition)                                                \
+    do {                                                                \
+        if (!(condition)) {                                             \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n",                \
+                    __FILE__, __LINE__, #condition);                    \
+            simCheckFailures++;                                         \
+        }                                                               \
+    } while (0)
+
+#define CHECK_EQUAL(expected, actual)                                   \
+    do {                                                                \
+        long long e_ = (long long) (expected);                          \
+        long long a_ = (long long) (actual);                            \
+        if (e_ != a_) {                                                 \
+            fprintf(stderr, "%s:%d: %s: expected %lld, got %lld\n",     \
+                    __FILE__, __LINE__, #actual, e_, a_);               \
+            simCheckFailures++;                                         \
+        }                                                               \
+    } while (0)
+
+
+static inline int
+checkResult(const char *name)
+{
+    if (simCheckFailures) {
+        printf("%s: %d check(s) FAILED\n", name, simCheckFailures);
+        return 1;
+    }
+    printf("%s: passed\n", name);
+    return 0;
+}
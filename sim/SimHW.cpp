@@ -0,0 +1,392 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include <algorithm>
+#include <sstream>
+
+#include "SimHW.h"
+
+
+SimHW::SimHW(int cabs) :
+    numCabs(std::min(std::max(cabs, 1), MAX_CABS)),
+    inputs(),
+    nextInputIndex(0),
+    recorded(),
+    clock(0),
+    reportAll(false)
+{
+    console = NULL;
+
+    for (int c = 0; c < MAX_CABS; c++) {
+        cabState[c].knob = 0;
+        cabState[c].togglePosition = UnknownPosition;
+        cabState[c].previousSpeedValue = -1;
+        cabState[c].previousTogglePosition = UnknownPosition;
+    }
+}
+
+
+static bool
+parseToggle(const std::string& word, int *position)
+{
+    if (word == "left") {
+        *position = Left;
+    }
+    else if (word == "right") {
+        *position = Right;
+    }
+    else if (word == "center") {
+        *position = CenterOff;
+    }
+    else {
+        return false;
+    }
+    return true;
+}
+
+
+bool
+SimHW::loadTrace(std::istream& trace, std::string *error)
+{
+    std::string line;
+    int lineNumber = 0;
+
+    while (std::getline(trace, line)) {
+        lineNumber++;
+
+        size_t comment = line.find('#');
+        if (comment != std::string::npos) {
+            line.erase(comment);
+        }
+
+        std::istringstream words(line);
+        SimInput input = { 0, SimKnob, 0, 0, 0 };
+        std::string type, word;
+
+        if (!(words >> input.time)) {
+            if (words.eof()) {
+                continue;    // blank
+            }
+        }
+        else if (words >> type) {
+            bool ok = false;
+
+            if (type == "knob") {
+                input.type = SimKnob;
+                ok = (words >> input.arg >> input.value) && input.arg < numCabs;
+            }
+            else if (type == "toggle") {
+                input.type = SimToggle;
+                ok = (words >> input.arg >> word) && input.arg < numCabs && parseToggle(word, &input.value);
+            }
+            else if (type == "button") {
+                input.type = SimButton;
+                ok = (words >> input.arg >> word) && (word == "down" || word == "up");
+                input.value = (word == "down");
+            }
+            else if (type == "battery") {
+                input.type = SimBattery;
+                ok = (bool) (words >> input.value >> input.arg >> input.extra);
+            }
+            else if (type == "motion") {
+                input.type = SimMotion;
+                ok = (bool) (words >> input.value);
+            }
+            else if (type == "fall") {
+                input.type = SimFall;
+                ok = true;
+            }
+            else if (type == "idle") {
+                input.type = SimIdle;
+                ok = true;
+            }
+
+            if (ok) {
+                addInput(input);
+                continue;
+            }
+        }
+
+        if (error) {
+            std::ostringstream message;
+            message << "line " << lineNumber << ": can't parse '" << line << "'";
+            *error = message.str();
+        }
+        return false;
+    }
+
+    return true;
+}
+
+
+void
+SimHW::addInput(const SimInput& input)
+{
+    // after anything at the same time, so a trace keeps its own order
+    std::vector<SimInput>::iterator position = inputs.begin() + nextInputIndex;
+    while (position != inputs.end() && position->time <= input.time) {
+        ++position;
+    }
+    inputs.insert(position, input);
+}
+
+
+bool
+SimHW::nextInput(uint32_t *time) const
+{
+    if (nextInputIndex >= inputs.size()) {
+        return false;
+    }
+    *time = inputs[nextInputIndex].time;
+    return true;
+}
+
+
+void
+SimHW::run()
+{
+    uint32_t time;
+    while (nextInput(&time)) {
+        if (time > clock) {
+            clock = time;
+        }
+        check();
+    }
+}
+
+
+size_t
+SimHW::outputCount(SimOutputType type) const
+{
+    size_t count = 0;
+    for (size_t i = 0; i < recorded.size(); i++) {
+        if (recorded[i].type == type) {
+            count++;
+        }
+    }
+    return count;
+}
+
+
+const SimOutput *
+SimHW::lastOutput(SimOutputType type) const
+{
+    for (size_t i = recorded.size(); i > 0; i--) {
+        if (recorded[i - 1].type == type) {
+            return &recorded[i - 1];
+        }
+    }
+    return NULL;
+}
+
+
+bool
+SimHW::begin()
+{
+    return true;
+}
+
+
+// Hand every input that's due to the delegate
+bool
+SimHW::check()
+{
+    bool actionTaken = false;
+
+    if (reportAll) {
+        reportAll = false;
+        for (int c = 0; c < numCabs; c++) {
+            report(c);
+        }
+    }
+
+    while (nextInputIndex < inputs.size() && inputs[nextInputIndex].time <= clock) {
+        deliver(inputs[nextInputIndex++]);
+        actionTaken = true;
+    }
+
+    return actionTaken;
+}
+
+
+void
+SimHW::deliver(const SimInput& input)
+{
+    switch (input.type) {
+        case SimKnob:
+            cabState[input.arg].knob = input.value;
+            report(input.arg);
+            break;
+        case SimToggle:
+            cabState[input.arg].togglePosition = (TogglePosition) input.value;
+            report(input.arg);
+            break;
+        case SimButton:
+            if (delegate) {
+                delegate->functionButtonChanged(input.arg, input.value != 0, input.time * 1000);
+            }
+            break;
+        case SimBattery:
+            if (delegate) {
+                delegate->batteryLevelChanged(input.value, input.arg, input.extra);
+            }
+            break;
+        case SimMotion:
+            if (delegate) {
+                delegate->throttleMoved(input.value);
+            }
+            break;
+        case SimFall:
+            if (delegate) {
+                delegate->throttleFell();
+            }
+            break;
+        case SimIdle:
+            if (delegate) {
+                delegate->throttleIdle();
+            }
+            break;
+    }
+}
+
+
+// as ESP32HW::report_cab_speed()
+void
+SimHW::report(int cab)
+{
+    SimCab& state = cabState[cab];
+
+    int speedValue = state.speedCurve.lookup(state.knob);
+    TogglePosition togglePosition = state.togglePosition;
+
+    bool turnedToZero = (speedValue == 0 && state.previousSpeedValue > 0);
+    bool turnedToMax = (speedValue == MAX_SPEED_VALUE && state.previousSpeedValue != MAX_SPEED_VALUE);
+
+    if (togglePosition == CenterOff) {
+        speedValue = 0;
+        turnedToZero = turnedToMax = false;
+    }
+
+    bool toggleChanged = (togglePosition != state.previousTogglePosition);
+    bool speedChanged = (speedValue != state.previousSpeedValue);
+    state.previousTogglePosition = togglePosition;
+    state.previousSpeedValue = speedValue;
+
+    if (delegate) {
+        if (toggleChanged) {
+            delegate->togglePositionChanged(cab, togglePosition);
+        }
+        if (speedChanged) {
+            delegate->speedChanged(cab, speedValue, togglePosition);
+        }
+    }
+
+    if (turnedToZero) {
+        triggerHapticMotor(26);
+    }
+    else if (turnedToMax) {
+        triggerHapticMotor(17);
+    }
+}
+
+
+void
+SimHW::record(SimOutputType type, int v0, int v1, int v2, int v3, int v4)
+{
+    SimOutput output = { clock, type, { v0, v1, v2, v3, v4 } };
+    recorded.push_back(output);
+}
+
+
+void
+SimHW::setLight(int light, uint8_t state)
+{
+    record(SimLight, light, state);
+}
+
+
+void
+SimHW::setRGB(int light, uint8_t red, uint8_t green, uint8_t blue, LEDPattern pattern)
+{
+    record(SimRGB, light, red, green, blue, pattern);
+}
+
+
+void
+SimHW::triggerHapticMotor(int mode)
+{
+    record(SimHaptic, mode);
+}
+
+
+void
+SimHW::setTimeDisplay(int hour, int minute)
+{
+    record(SimTimeDisplay, hour, minute);
+}
+
+
+void
+SimHW::setTimeStatus(TimeStatus status)
+{
+    record(SimTimeStatus, status);
+}
+
+
+void
+SimHW::setSpeedSteps(int cab, int steps)
+{
+    if (cab < 0 || cab >= numCabs) {
+        return;
+    }
+
+    int stepCount = cabState[cab].speedCurve.setSpeedSteps(steps);
+    record(SimSpeedSteps, cab, stepCount);
+
+    // the current knob position may be a different speed now
+    cabState[cab].previousSpeedValue = -1;
+    reportAll = true;
+}
+
+
+void
+SimHW::setLowPower(bool lowPower)
+{
+    record(SimLowPower, lowPower);
+}
+
+
+void
+SimHW::resetStats()
+{
+    for (int c = 0; c < numCabs; c++) {
+        cabState[c].previousSpeedValue = -1;
+        cabState[c].previousTogglePosition = UnknownPosition;
+    }
+    reportAll = true;
+}
+
+
+std::string
+SimHW::getHWVersion()
+{
+    return "sim";
+}
@@ -0,0 +1,161 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+#pragma once
+
+#include <istream>
+#include <string>
+#include <vector>
+
+#include "../ThrottleHW.h"
+#include "../SpeedCurve.h"
+
+
+// A ThrottleHW for a host (Linux) build rather than the throttle.  Its
+// inputs come from a trace of timestamped events, replayed against a
+// simulated clock, and every output call made on it is recorded, so the
+// same trace always gives the same results.
+//
+// It behaves like ESP32HW where that matters to the delegate: knob
+// readings go through the same speed curve, center off is speed 0, only
+// changes are reported, and the haptic motor is buzzed at 0 and full
+// speed.
+//
+// Built with the other host-safe parts of the firmware by sim/Makefile;
+// "make -C sim test" replays the traces in sim/traces.
+
+
+// Trace lines are "<ms> <input> <values...>", '#' starts a comment:
+//     100   knob    <cab> <0-4095>
+//     100   toggle  <cab> left|right|center
+//     100   button  <function> down|up
+//     100   battery <mV> <percent> <minutes remaining>
+//     100   motion  <mg>
+//     100   fall
+//     100   idle
+typedef enum SimInputType {
+    SimKnob = 0,        // arg: cab, value: raw ADC reading
+    SimToggle,          // arg: cab, value: TogglePosition
+    SimButton,          // arg: function, value: pressed
+    SimBattery,         // value: mV, arg: percent, extra: minutes
+    SimMotion,          // value: mg
+    SimFall,
+    SimIdle
+} SimInputType;
+
+typedef struct SimInput {
+    uint32_t     time;   // ms
+    SimInputType type;
+    int          arg;
+    int          value;
+    int          extra;
+} SimInput;
+
+
+// Everything asked of the HW, in the order it was asked
+typedef enum SimOutputType {
+    SimLight = 0,       // light, state
+    SimRGB,             // light, red, green, blue, pattern
+    SimHaptic,          // mode
+    SimTimeDisplay,     // hour, minute
+    SimTimeStatus,      // TimeStatus
+    SimSpeedSteps,      // cab, steps
+    SimLowPower         // lowPower
+} SimOutputType;
+
+#define SIM_OUTPUT_VALUES (5)
+
+typedef struct SimOutput {
+    uint32_t      time;  // ms
+    SimOutputType type;
+    int           values[SIM_OUTPUT_VALUES];
+} SimOutput;
+
+
+class SimHW : public ThrottleHW
+{
+  public:
+    SimHW(int cabs = 1);
+
+    // add inputs to be replayed (kept in time order)
+    //   return false (and stop) at a line that can't be parsed
+    bool loadTrace(std::istream& trace, std::string *error = NULL);
+    void addInput(const SimInput& input);
+
+    // everything loaded, delivered or not
+    const std::vector<SimInput>& traceInputs() const { return inputs; }
+
+    // the simulated clock
+    uint32_t now() const { return clock; }
+    void     advance(uint32_t ms) { clock += ms; }
+
+    // the time of the next input, or false if there are none left
+    bool     nextInput(uint32_t *time) const;
+
+    // deliver every input that's due, then check() until the trace is done
+    void     run();
+
+    const std::vector<SimOutput>& outputs() const { return recorded; }
+    size_t   outputCount(SimOutputType type) const;
+    const SimOutput *lastOutput(SimOutputType type) const;
+    void     clearOutputs() { recorded.clear(); }
+
+    // ThrottleHW
+    bool begin();
+    bool check();
+
+    void setLight(int light, uint8_t state);
+    void setRGB(int light, uint8_t red, uint8_t green, uint8_t blue,
+                LEDPattern pattern = LEDSteady);
+    void triggerHapticMotor(int mode);
+    void setTimeDisplay(int hour, int minute);
+    void setTimeStatus(TimeStatus status);
+
+    int  cabCount() { return numCabs; }
+    void setSpeedSteps(int cab, int steps);
+    void setLowPower(bool lowPower);
+    void resetStats();
+
+    std::string getHWVersion();
+
+  private:
+    typedef struct SimCab {
+        SpeedCurveTable speedCurve;
+        int             knob;            // raw reading
+        TogglePosition  togglePosition;
+        int             previousSpeedValue;
+        TogglePosition  previousTogglePosition;
+    } SimCab;
+
+    void deliver(const SimInput& input);
+    void report(int cab);
+    void record(SimOutputType type, int v0 = 0, int v1 = 0, int v2 = 0, int v3 = 0, int v4 = 0);
+
+    int                    numCabs;
+    SimCab                 cabState[MAX_CABS];
+    std::vector<SimInput>  inputs;
+    size_t                 nextInputIndex;
+    std::vector<SimOutput> recorded;
+    uint32_t               clock;
+    bool                   reportAll;
+};
@@ -0,0 +1,129 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+// Compares the way ThrottleData used to read a file, a byte per call and
+// appending each to the string, with the block read ThrottleStorage does
+// now, on PosixStorage.  The old way's calls are read(2)s of one byte,
+// standing in for one SPIFFS call per byte.
+
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <chrono>
+#include <string>
+
+#include "ThrottleStorage.h"
+
+#define ITERATIONS (2000)
+
+
+// as ThrottleData::readFile() was
+static bool
+byteAtATimeRead(const std::string& path, std::string& content, uint32_t *calls)
+{
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    content.clear();
+    char c;
+    while (true) {
+        (*calls)++;
+        if (read(fd, &c, 1) != 1) {
+            break;
+        }
+        content += c;
+    }
+
+    close(fd);
+    return true;
+}
+
+
+static double
+microseconds(std::chrono::steady_clock::duration elapsed)
+{
+    return std::chrono::duration<double, std::micro>(elapsed).count();
+}
+
+
+int
+main()
+{
+    const char *root = "build/bench-read";
+    PosixStorage storage(root);
+    if (!storage.begin()) {
+        fprintf(stderr, "can't use %s\n", root);
+        return 1;
+    }
+
+    // about the size of a config record, up to a full roster cache
+    const size_t sizes[] = { 64, 256, 1024, 4096, 16384 };
+
+    printf("%8s %14s %10s %14s %10s %8s\n",
+           "bytes", "per byte us", "calls", "block us", "calls", "speedup");
+
+    for (size_t index = 0; index < sizeof(sizes) / sizeof(sizes[0]); index++) {
+        std::string content;
+        for (size_t offset = 0; offset < sizes[index]; offset++) {
+            content += (char) ('a' + offset % 26);
+        }
+
+        char path[32];
+        snprintf(path, sizeof(path), "/file%zu", sizes[index]);
+        storage.writeFile(path, content);
+
+        std::string hostPath = std::string(root) + path;
+        std::string result;
+        uint32_t oldCalls = 0;
+
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        for (int iteration = 0; iteration < ITERATIONS; iteration++) {
+            byteAtATimeRead(hostPath, result, &oldCalls);
+        }
+        double oldTime = microseconds(std::chrono::steady_clock::now() - start) / ITERATIONS;
+        bool oldOk = (result == content);
+
+        storage.resetStats();
+        start = std::chrono::steady_clock::now();
+        for (int iteration = 0; iteration < ITERATIONS; iteration++) {
+            storage.readFile(path, result);
+        }
+        double newTime = microseconds(std::chrono::steady_clock::now() - start) / ITERATIONS;
+        bool newOk = (result == content);
+
+        if (!oldOk || !newOk) {
+            fprintf(stderr, "%zu bytes: read back the wrong content\n", sizes[index]);
+            return 1;
+        }
+
+        printf("%8zu %14.2f %10u %14.2f %10u %7.1fx\n",
+               sizes[index],
+               oldTime, oldCalls / ITERATIONS,
+               newTime, storage.stats.reads / ITERATIONS,
+               oldTime / newTime);
+    }
+
+    return 0;
+}
@@ -0,0 +1,123 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+// Times the speed knob filter stages and some pipelines built from them,
+// over a knob trace, and counts the speed changes each would have sent:
+// all of them, those while the knob was at rest, and how many samples
+// each lags behind the unfiltered speed after the knob stops turning.
+
+#include <algorithm>
+#include <chrono>
+#include <vector>
+
+#include "KnobTrace.h"
+#include "../SpeedFilter.h"
+
+#define PASSES (2000)
+
+// keeps the filtering from being optimized away
+static volatile uint32_t filterSink;
+
+
+// when, in the default trace, the knob comes to rest somewhere new
+static const uint32_t turnEnds[] = { 1500, 3800, 4700 };
+
+
+template <typename Filter>
+static void
+measure(const char *name, const std::vector<KnobSample>& samples, const std::vector<int>& unfiltered)
+{
+    // the filtering alone: no speed table lookup
+    Filter filter;
+    uint32_t checksum = 0;
+
+    std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    for (int pass = 0; pass < PASSES; pass++) {
+        for (size_t index = 0; index < samples.size(); index++) {
+            checksum += filter.update(samples[index].reading);
+        }
+    }
+    double nanoseconds = std::chrono::duration<double, std::nano>(std::chrono::steady_clock::now() - start).count()
+        / ((double) PASSES * samples.size());
+
+    std::vector<int> speeds = replayKnobTrace<Filter>(samples);
+    int changes = speedChangesBetween(samples, speeds, 0, 0xFFFFFFFF);
+
+    // at rest: from 100 ms after each move ends, to the next move
+    int resting = speedChangesBetween(samples, speeds, 100, 1000)
+        + speedChangesBetween(samples, speeds, 1600, 3500)
+        + speedChangesBetween(samples, speeds, 3900, 4500)
+        + speedChangesBetween(samples, speeds, 4800, 0xFFFFFFFF);
+
+    // samples until within a step of where the unfiltered speed settles
+    int worstLag = 0;
+    for (size_t turn = 0; turn < sizeof(turnEnds) / sizeof(turnEnds[0]); turn++) {
+        int target = speedAt(samples, unfiltered, turnEnds[turn] + 100);
+        int lag = 0;
+        for (size_t index = 0; index < samples.size(); index++) {
+            if (samples[index].time < turnEnds[turn]) {
+                continue;
+            }
+            if (speeds[index] >= target - 1 && speeds[index] <= target + 1) {
+                break;
+            }
+            lag++;
+        }
+        worstLag = std::max(worstLag, lag);
+    }
+
+    filterSink = checksum;
+
+    printf("%-40s %8.2f %8d %8d %10d\n", name, nanoseconds, changes, resting, worstLag);
+}
+
+
+int
+main(int argc, char **argv)
+{
+    const char *tracePath = (argc > 1) ? argv[1] : "traces/pot_rest_turn.trace";
+    std::vector<KnobSample> samples;
+
+    if (!loadKnobTrace(tracePath, samples)) {
+        return 1;
+    }
+
+    std::vector<int> unfiltered = replayKnobTrace<FilterPipeline<> >(samples);
+
+    printf("%zu samples from %s\n", samples.size(), tracePath);
+    printf("%-40s %8s %8s %8s %10s\n", "filter", "ns/samp", "changes", "at rest", "lag (samp)");
+
+    measure<FilterPipeline<> >("none", samples, unfiltered);
+    measure<FilterPipeline<MedianFilter<3> > >("median 3", samples, unfiltered);
+    measure<FilterPipeline<MedianFilter<5> > >("median 5", samples, unfiltered);
+    measure<FilterPipeline<EMAFilter<1> > >("EMA 1/2", samples, unfiltered);
+    measure<FilterPipeline<EMAFilter<2> > >("EMA 1/4", samples, unfiltered);
+    measure<FilterPipeline<DeadbandFilter<16, 0, 4095> > >("deadband 16", samples, unfiltered);
+    measure<FilterPipeline<SlewLimitFilter<256> > >("slew 256", samples, unfiltered);
+    measure<FilterPipeline<MedianFilter<3>, EMAFilter<1>, DeadbandFilter<16, 0, 4095> > >(
+        "median 3, EMA 1/2, deadband 16 (ESP32)", samples, unfiltered);
+    measure<FilterPipeline<MedianFilter<5>, EMAFilter<2>, DeadbandFilter<24, 0, 4095> > >(
+        "median 5, EMA 1/4, deadband 24", samples, unfiltered);
+    measure<FilterPipeline<MedianFilter<3>, EMAFilter<1>, DeadbandFilter<16, 0, 4095>, SlewLimitFilter<256> > >(
+        "ESP32 pipeline, slew 256", samples, unfiltered);
+
+    return 0;
+}
@@ -0,0 +1,221 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+// Runs the throttle's config and roster workloads against the SPIFFS and
+// LittleFS flash models, and prints what each filesystem is estimated to
+// do to the flash for them.  The filesystem calls made are the same for
+// both; see FlashModel.h for what the models do and don't account for.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "ThrottleData.h"
+#include "RosterCache.h"
+#include "FlashModel.h"
+
+// the spiffs partition in partitions.csv
+#define PARTITION_SIZE      (0x170000)
+
+// as in ThrottleData.cpp and RosterCache.cpp
+#define CONFIG_WRITE_BEHIND (2000)
+#define ROSTER_WRITE_BEHIND (5000)
+
+#define BOOTS               (100)
+#define PROVISIONINGS       (100)
+#define ROSTER_UPDATES      (20)
+#define ROSTER_SIZE         (40)
+
+
+static HostConsole console;
+
+
+typedef void (*Workload)(FlashModelStorage& storage);
+
+
+// an older throttle's settings, one file each
+static void
+legacyFiles(FlashModelStorage& storage)
+{
+    storage.writeFile("/deviceName", "Throttle 7");
+    storage.writeFile("/ssid", "Basement");
+    storage.writeFile("/password", "hunter22");
+    storage.writeFile("/server", "192.168.1.10");
+    storage.writeFile("/serverPort", "12090");
+    storage.writeFile("/serialNumber", "00001234");
+}
+
+
+static void
+legacyMigration(FlashModelStorage& storage)
+{
+    ThrottleData data(storage);
+    data.begin(&console);
+}
+
+
+static void
+boots(FlashModelStorage& storage)
+{
+    for (int boot = 0; boot < BOOTS; boot++) {
+        ThrottleData data(storage);
+        RosterCache roster(storage);
+        data.begin(&console);
+        roster.begin(&console);
+    }
+}
+
+
+// BLE provisioning writes a profile a field at a time
+static void
+provisioning(FlashModelStorage& storage)
+{
+    ThrottleData data(storage);
+    data.begin(&console);
+
+    for (int pass = 0; pass < PROVISIONINGS; pass++) {
+        char text[32];
+        int profile = pass % MAX_NETWORK_PROFILES;
+
+        snprintf(text, sizeof(text), "Layout %d", pass);
+        data.saveWifiSSID(text, profile);
+        data.saveWifiPassword("password1", profile);
+        snprintf(text, sizeof(text), "192.168.%d.1", pass % 250);
+        data.saveServerAddress(text, profile);
+        data.saveServerPort("12090", profile);
+
+        hostAdvance(CONFIG_WRITE_BEHIND);
+        data.check();
+    }
+}
+
+
+// a server's roster, with function labels, described again and again
+static void
+rosterUpdates(FlashModelStorage& storage)
+{
+    RosterCache roster(storage);
+    roster.begin(&console);
+
+    std::vector<std::string> labels;
+    const char *names[] = { "Headlight", "Bell", "Horn", "Dynamic Brake", "Mute", "Coupler" };
+    for (size_t label = 0; label < sizeof(names) / sizeof(names[0]); label++) {
+        labels.push_back(names[label]);
+    }
+
+    for (int update = 0; update < ROSTER_UPDATES; update++) {
+        for (int loco = 1; loco <= ROSTER_SIZE; loco++) {
+            char description[32];
+            snprintf(description, sizeof(description), "Loco %d (%d)", loco, update);
+            roster.updateDescription(loco * 100, true, description);
+            roster.updateFunctionLabels(loco * 100, true, labels);
+        }
+
+        hostAdvance(ROSTER_WRITE_BEHIND);
+        roster.check();
+    }
+}
+
+
+// a throttle that has been set up, and has seen a server's roster
+static void
+configured(FlashModelStorage& storage)
+{
+    legacyFiles(storage);
+    legacyMigration(storage);
+
+    ThrottleData data(storage);
+    data.begin(&console);
+    data.saveWifiSSID("Club", 1);
+    data.commit();
+
+    RosterCache roster(storage);
+    roster.begin(&console);
+    for (int loco = 1; loco <= ROSTER_SIZE; loco++) {
+        roster.updateDescription(loco * 100, true, "Loco");
+    }
+    roster.saveLastSelectedAddress("L100");
+    roster.commit();
+}
+
+
+static void
+report(const char *workload, FlashModelStorage& storage)
+{
+    const StorageStats& stats = storage.stats;
+    const FlashCost& cost = storage.cost;
+
+    printf("%-22s %-18s %5u %5u %5u %5u %10u %9u %10u %7u\n",
+           workload, storage.name(),
+           stats.opens, stats.reads, stats.writes, stats.removes,
+           cost.bytesRead, cost.programs, cost.bytesProgrammed, cost.erases);
+}
+
+
+static void
+run(const char *workload, Workload prepare, Workload function, const char *root)
+{
+    std::string spiffsRoot = std::string(root) + "-spiffs";
+    std::string littlefsRoot = std::string(root) + "-littlefs";
+    std::string command = "rm -rf " + spiffsRoot + " " + littlefsRoot;
+    if (system(command.c_str()) != 0) {
+        return;
+    }
+
+    PosixStorage spiffsFiles(spiffsRoot);
+    PosixStorage littlefsFiles(littlefsRoot);
+    SPIFFSModelStorage spiffs(spiffsFiles, PARTITION_SIZE);
+    LittleFSModelStorage littlefs(littlefsFiles, PARTITION_SIZE);
+
+    FlashModelStorage *models[] = { &spiffs, &littlefs };
+
+    for (int model = 0; model < 2; model++) {
+        FlashModelStorage& storage = *models[model];
+        storage.begin();
+        if (prepare) {
+            prepare(storage);
+        }
+
+        storage.resetStats();
+        storage.resetCost();
+        function(storage);
+        report(workload, storage);
+    }
+}
+
+
+int
+main()
+{
+    console.verbose = false;
+
+    printf("%-22s %-18s %5s %5s %5s %5s %10s %9s %10s %7s\n",
+           "workload", "filesystem", "opens", "reads", "write", "remov",
+           "flash read", "programs", "programmed", "erases");
+
+    run("legacy migration", legacyFiles, legacyMigration, "build/bench-migration");
+    run("100 boots", configured, boots, "build/bench-boots");
+    run("100 provisionings", configured, provisioning, "build/bench-provisioning");
+    run("20 roster updates", configured, rosterUpdates, "build/bench-roster");
+
+    return 0;
+}
@@ -0,0 +1,89 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+
+#pragma once
+
+// Host stand-in for the parts of the Arduino core that the host-built
+// firmware files use: Print/Stream for the console, and the clock.  The
+// clock is simulated, and only moves when a test calls hostAdvance(), so
+// that write-behind timers fire exactly when a test says.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+#define constrain(value, low, high) ((value) < (low) ? (low) : ((value) > (high) ? (high) : (value)))
+
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+
+// move the simulated clock on
+void hostAdvance(unsigned long ms);
+
+
+class Print
+{
+  public:
+    virtual ~Print() {}
+
+    virtual size_t write(uint8_t c) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size);
+
+    size_t print(const char *text);
+    size_t println(const char *text = "");
+    size_t printf(const char *format, ...) __attribute__ ((format (printf, 2, 3)));
+};
+
+
+class Stream : public Print
+{
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+    virtual int peek() = 0;
+    virtual void flush() {}
+};
+
+
+// A console for host builds: written to stdout if verbose, else dropped
+class HostConsole : public Stream
+{
+  public:
+    HostConsole(bool verbose = false) : verbose(verbose) {}
+
+    int available() { return 0; }
+    int read() { return -1; }
+    int peek() { return -1; }
+    size_t write(uint8_t c);
+    using Print::write;
+
+    bool verbose;
+};
@@ -0,0 +1,59 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+
+#pragma once
+
+// Host stand-in for the Chrono library's millisecond timer, on the
+// simulated clock (see Arduino.h)
+
+#include "Arduino.h"
+
+
+class Chrono
+{
+  public:
+    Chrono(bool startNow = true) : startTime(millis()), running(startNow) {}
+
+    void restart(unsigned long offset = 0) { startTime = millis() - offset; running = true; }
+    void stop() { running = false; }
+    bool isRunning() const { return running; }
+
+    unsigned long elapsed() const { return millis() - startTime; }
+
+    bool hasPassed(unsigned long timeout) const { return elapsed() >= timeout; }
+    bool hasPassed(unsigned long timeout, bool restartIfPassed)
+    {
+        if (!hasPassed(timeout)) {
+            return false;
+        }
+        if (restartIfPassed) {
+            restart();
+        }
+        return true;
+    }
+
+  private:
+    unsigned long startTime;
+    bool          running;
+};
@@ -0,0 +1,118 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+#include "Arduino.h"
+
+#include <stdarg.h>
+#include <stdio.h>
+
+#include <string>
+
+
+static unsigned long simulatedMillis = 0;
+
+
+unsigned long
+millis()
+{
+    return simulatedMillis;
+}
+
+
+unsigned long
+micros()
+{
+    return simulatedMillis * 1000;
+}
+
+
+void
+delay(unsigned long ms)
+{
+    hostAdvance(ms);
+}
+
+
+void
+hostAdvance(unsigned long ms)
+{
+    simulatedMillis += ms;
+}
+
+
+////////////////////////////////////////////////////////////////////////////////
+
+
+size_t
+Print::write(const uint8_t *buffer, size_t size)
+{
+    size_t count = 0;
+    while (count < size && write(buffer[count])) {
+        count++;
+    }
+    return count;
+}
+
+
+size_t
+Print::print(const char *text)
+{
+    return write((const uint8_t *) text, strlen(text));
+}
+
+
+size_t
+Print::println(const char *text)
+{
+    return print(text) + print("\n");
+}
+
+
+size_t
+Print::printf(const char *format, ...)
+{
+    va_list args;
+
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    if (length <= 0) {
+        return 0;
+    }
+
+    std::string text(length + 1, '\0');
+    va_start(args, format);
+    vsnprintf(&text[0], text.size(), format, args);
+    va_end(args);
+
+    return write((const uint8_t *) text.data(), length);
+}
+
+
+size_t
+HostConsole::write(uint8_t c)
+{
+    if (verbose) {
+        putchar(c);
+    }
+    return 1;
+}
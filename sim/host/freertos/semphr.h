@@ -0,0 +1,59 @@
+/* -*- c++ -*-
+ *
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+
+
+#pragma once
+
+// Host stand-in for FreeRTOS recursive mutexes, as std::recursive_mutex
+
+#include <mutex>
+
+#include "FreeRTOS.h"
+
+typedef std::recursive_mutex *SemaphoreHandle_t;
+
+static inline SemaphoreHandle_t
+xSemaphoreCreateRecursiveMutex()
+{
+    return new std::recursive_mutex;
+}
+
+static inline BaseType_t
+xSemaphoreTakeRecursive(SemaphoreHandle_t mutex, TickType_t)
+{
+    mutex->lock();
+    return pdTRUE;
+}
+
+static inline BaseType_t
+xSemaphoreGiveRecursive(SemaphoreHandle_t mutex)
+{
+    mutex->unlock();
+    return pdTRUE;
+}
+
+static inline void
+vSemaphoreDelete(SemaphoreHandle_t mutex)
+{
+    delete mutex;
+}
@@ -0,0 +1,222 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+// Replays sim/traces/controls.trace through SimHW, and checks what the
+// delegate was told and what was asked of the HW along the way.
+
+#include <cstdarg>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "SimHW.h"
+#include "SimCheck.h"
+
+
+// writes down each callback as a line of text, with the time it came in
+class RecordingDelegate : public ThrottleHWDelegate
+{
+  public:
+    RecordingDelegate(SimHW& hw) : hw(hw) {}
+
+    void speedChanged(int cab, int newSpeed, TogglePosition togglePosition)
+    {
+        log("speed %d %d %d", cab, newSpeed, togglePosition);
+    }
+    void togglePositionChanged(int cab, TogglePosition newPosition)
+    {
+        log("toggle %d %d", cab, newPosition);
+    }
+    void throttleMoved(int magnitude) { log("moved %d", magnitude); }
+    void throttleFell() { log("fell"); }
+    void throttleIdle() { log("idle"); }
+    void batteryLevelChanged(int millivolts, int percent, int minutesRemaining)
+    {
+        log("battery %d %d %d", millivolts, percent, minutesRemaining);
+    }
+    void functionButtonChanged(int func, bool pressed, uint32_t timestamp)
+    {
+        log("button %d %d %u", func, pressed, timestamp);
+    }
+
+    std::vector<std::string> calls;
+
+  private:
+    void log(const char *format, ...)
+    {
+        char line[64];
+        int offset = snprintf(line, sizeof(line), "%u ", hw.now());
+
+        va_list args;
+        va_start(args, format);
+        vsnprintf(line + offset, sizeof(line) - offset, format, args);
+        va_end(args);
+
+        calls.push_back(line);
+    }
+
+    SimHW& hw;
+};
+
+
+static const char *expectedCalls[] = {
+    "0 toggle 0 1",
+    "0 speed 0 0 1",
+    "0 toggle 1 0",
+    "0 speed 1 0 0",
+    "100 speed 0 31 1",
+    "200 speed 0 126 1",
+    "400 button 2 1 400000",
+    "450 button 2 0 450000",
+    "500 speed 0 0 1",
+    "600 toggle 1 2",
+    "700 battery 3700 55 120",
+    "800 moved 350",
+    "900 fell",
+    "1000 idle",
+};
+
+
+static void
+replay(const char *tracePath, std::vector<std::string>& calls, std::vector<SimOutput>& outputs)
+{
+    SimHW hw(2);
+    RecordingDelegate delegate(hw);
+    hw.delegate = &delegate;
+
+    std::ifstream trace(tracePath);
+    std::string error;
+    CHECK(trace.is_open());
+    CHECK(hw.loadTrace(trace, &error));
+    CHECK(error.empty());
+
+    CHECK(hw.begin());
+    hw.run();
+
+    uint32_t time;
+    CHECK(!hw.nextInput(&time));
+
+    calls = delegate.calls;
+    outputs = hw.outputs();
+}
+
+
+static void
+testControlsTrace(const char *tracePath)
+{
+    std::vector<std::string> calls;
+    std::vector<SimOutput> outputs;
+    replay(tracePath, calls, outputs);
+
+    size_t expectedCount = sizeof(expectedCalls) / sizeof(expectedCalls[0]);
+    CHECK_EQUAL(expectedCount, calls.size());
+    for (size_t index = 0; index < expectedCount && index < calls.size(); index++) {
+        if (calls[index] != expectedCalls[index]) {
+            fprintf(stderr, "call %zu: expected \"%s\", got \"%s\"\n",
+                    index, expectedCalls[index], calls[index].c_str());
+            CHECK(calls[index] == expectedCalls[index]);
+        }
+    }
+
+    // a buzz on reaching full speed, and another on coming back to zero;
+    // nothing for cab 1, as it was turned with the toggle at center off
+    CHECK_EQUAL(2, outputs.size());
+    if (outputs.size() == 2) {
+        CHECK_EQUAL(SimHaptic, outputs[0].type);
+        CHECK_EQUAL(200, outputs[0].time);
+        CHECK_EQUAL(17, outputs[0].values[0]);
+        CHECK_EQUAL(SimHaptic, outputs[1].type);
+        CHECK_EQUAL(500, outputs[1].time);
+        CHECK_EQUAL(26, outputs[1].values[0]);
+    }
+
+    // and the same again, every time
+    std::vector<std::string> againCalls;
+    std::vector<SimOutput> againOutputs;
+    replay(tracePath, againCalls, againOutputs);
+    CHECK(againCalls == calls);
+    CHECK_EQUAL(outputs.size(), againOutputs.size());
+}
+
+
+static void
+testOutputsRecorded()
+{
+    SimHW hw(1);
+
+    hw.advance(10);
+    hw.setRGB(0, 0xFF, 0x80, 0x00, LEDFastBlink);
+    hw.advance(10);
+    hw.setTimeDisplay(12, 34);
+    hw.setLight(1, hw.LIGHT_ON);
+    hw.triggerHapticMotor(47);
+
+    CHECK_EQUAL(4, hw.outputs().size());
+    CHECK_EQUAL(1, hw.outputCount(SimRGB));
+
+    const SimOutput *rgb = hw.lastOutput(SimRGB);
+    CHECK(rgb != NULL);
+    if (rgb) {
+        CHECK_EQUAL(10, rgb->time);
+        CHECK_EQUAL(0xFF, rgb->values[1]);
+        CHECK_EQUAL(0x80, rgb->values[2]);
+        CHECK_EQUAL(LEDFastBlink, rgb->values[4]);
+    }
+
+    const SimOutput *display = hw.lastOutput(SimTimeDisplay);
+    CHECK(display != NULL);
+    if (display) {
+        CHECK_EQUAL(20, display->time);
+        CHECK_EQUAL(12, display->values[0]);
+        CHECK_EQUAL(34, display->values[1]);
+    }
+
+    CHECK(hw.lastOutput(SimLowPower) == NULL);
+}
+
+
+static void
+testBadTrace()
+{
+    SimHW hw(1);
+    std::string error;
+
+    std::istringstream badCab("10 knob 0 100\n20 knob 1 100\n");
+    CHECK(!hw.loadTrace(badCab, &error));
+    CHECK(!error.empty());
+
+    std::istringstream badInput("10 warp 9\n");
+    CHECK(!hw.loadTrace(badInput, &error));
+}
+
+
+int
+main(int argc, char **argv)
+{
+    const char *tracePath = (argc > 1) ? argv[1] : "traces/controls.trace";
+
+    testControlsTrace(tracePath);
+    testOutputsRecorded();
+    testBadTrace();
+
+    return checkResult("test_sim_hw");
+}
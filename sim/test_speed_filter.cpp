@@ -0,0 +1,143 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+// Replays sim/traces/pot_rest_turn.trace through the speed knob filter
+// pipeline, as ESP32HW runs it, and checks that the knob resting on a
+// speed boundary doesn't send a stream of speed changes, while turning it
+// still gets to the new speed promptly.  Also checks each filter stage.
+
+#include <vector>
+
+#include "KnobTrace.h"
+#include "SimCheck.h"
+#include "../SpeedFilter.h"
+#include "../SpeedCurve.h"
+
+
+// as SpeedKnobFilter in ESP32HW.h
+typedef FilterPipeline<MedianFilter<3>,
+                       EMAFilter<1>,
+                       DeadbandFilter<16, 0, 4095> > BoardKnobFilter;
+
+#define SAMPLE_INTERVAL (10)    // ms, as the trace
+
+
+static void
+testReplay(const char *tracePath)
+{
+    std::vector<KnobSample> samples;
+    CHECK(loadKnobTrace(tracePath, samples));
+
+    std::vector<int> unfiltered = replayKnobTrace<FilterPipeline<> >(samples);
+    std::vector<int> filtered = replayKnobTrace<BoardKnobFilter>(samples);
+    SpeedCurveTable speedCurve;
+
+    // resting on a boundary: the bare reading flickers between speeds,
+    // the filtered one holds still, bad readings and all
+    CHECK(speedChangesBetween(samples, unfiltered, 1600, 3500) >= 20);
+    CHECK_EQUAL(0, speedChangesBetween(samples, filtered, 1600, 3500));
+
+    // and resting at either end is exactly stopped, or full speed
+    CHECK_EQUAL(0, speedChangesBetween(samples, filtered, 0, 1000));
+    CHECK_EQUAL(0, speedAt(samples, filtered, 500));
+    CHECK_EQUAL(0, speedChangesBetween(samples, filtered, 3900, 4500));
+    CHECK_EQUAL(MAX_SPEED_VALUE, speedAt(samples, filtered, 4000));
+    CHECK_EQUAL(0, speedAt(samples, filtered, 5000));
+
+    // within a step of the knob 5 samples after it stops turning, and
+    // exactly there within 10
+    int target = speedCurve.lookup(2000);
+    int settled = speedAt(samples, filtered, 1500 + 5 * SAMPLE_INTERVAL);
+    CHECK(settled >= target - 1 && settled <= target + 1);
+    CHECK_EQUAL(MAX_SPEED_VALUE, speedAt(samples, filtered, 3800 + 5 * SAMPLE_INTERVAL));
+    CHECK(speedAt(samples, filtered, 4700 + 5 * SAMPLE_INTERVAL) <= 1);
+    CHECK_EQUAL(0, speedAt(samples, filtered, 4700 + 10 * SAMPLE_INTERVAL));
+    CHECK_EQUAL(0, speedChangesBetween(samples, filtered, 4800, 5200));
+
+    // all of the speed changes sent while the knob was at rest
+    int unfilteredResting = speedChangesBetween(samples, unfiltered, 0, 1000)
+        + speedChangesBetween(samples, unfiltered, 1600, 3500)
+        + speedChangesBetween(samples, unfiltered, 3900, 4500)
+        + speedChangesBetween(samples, unfiltered, 4800, 5200);
+    int filteredResting = speedChangesBetween(samples, filtered, 0, 1000)
+        + speedChangesBetween(samples, filtered, 1600, 3500)
+        + speedChangesBetween(samples, filtered, 3900, 4500)
+        + speedChangesBetween(samples, filtered, 4800, 5200);
+    printf("speed changes at rest: %d unfiltered, %d filtered\n",
+           unfilteredResting, filteredResting);
+    CHECK_EQUAL(0, filteredResting);
+}
+
+
+static void
+testStages()
+{
+    MedianFilter<3> median;
+    median.reset(100);
+    CHECK_EQUAL(100, median.update(4095));     // one spike is dropped
+    CHECK_EQUAL(100, median.update(100));
+    CHECK_EQUAL(100, median.update(100));
+    CHECK_EQUAL(100, median.update(500));
+    CHECK_EQUAL(500, median.update(500));      // a real change gets through
+
+    EMAFilter<2> ema;
+    ema.reset(0);
+    CHECK_EQUAL(250, ema.update(1000));        // a quarter of the way
+    int value = 0;
+    for (int sample = 0; sample < 50; sample++) {
+        value = ema.update(1000);
+    }
+    CHECK_EQUAL(1000, value);                  // and all the way, in time
+
+    DeadbandFilter<16, 0, 4095> deadband;
+    deadband.reset(2000);
+    CHECK_EQUAL(2000, deadband.update(2016));
+    CHECK_EQUAL(2000, deadband.update(1984));
+    CHECK_EQUAL(2004, deadband.update(2020));  // follows, Width behind
+    CHECK_EQUAL(0, deadband.update(10));       // the ends snap
+    CHECK_EQUAL(4095, deadband.update(4085));
+
+    SlewLimitFilter<100> slew;
+    slew.reset(0);
+    CHECK_EQUAL(100, slew.update(1000));
+    CHECK_EQUAL(200, slew.update(1000));
+    CHECK_EQUAL(150, slew.update(150));
+
+    FilterPipeline<MedianFilter<3>, SlewLimitFilter<100> > pipeline;
+    pipeline.reset(500);
+    CHECK_EQUAL(500, pipeline.update(4095));
+    CHECK_EQUAL(600, pipeline.update(4095));
+
+    FilterPipeline<> empty;
+    CHECK_EQUAL(1234, empty.update(1234));
+}
+
+
+int
+main(int argc, char **argv)
+{
+    const char *tracePath = (argc > 1) ? argv[1] : "traces/pot_rest_turn.trace";
+
+    testStages();
+    testReplay(tracePath);
+
+    return checkResult("test_speed_filter");
+}
@@ -0,0 +1,333 @@
+/*
+ * Copyright © 2018-2019 Blue Knobby Systems Inc.
+ *
+ * This work is licensed under the Creative Commons Attribution-ShareAlike
+ * 4.0 International License. To view a copy of this license, visit
+ * http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+ * Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+ *
+ * Attribution — You must give appropriate credit, provide a link to the
+ * license, and indicate if changes were made. You may do so in any
+ * reasonable manner, but not in any way that suggests the licensor
+ * endorses you or your use.
+ *
+ * ShareAlike — If you remix, transform, or build upon the material, you
+ * must distribute your contributions under the same license as the
+ * original.
+ *
+ * All other rights reserved.
+ *
+ */
+
+// Host tests for ThrottleData on PosixStorage: loading, migration from the
+// legacy files and older record versions, the A/B slots, and how many
+// filesystem operations each of those takes.
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <string>
+
+#include "ThrottleData.h"
+#include "StorageRecord.h"
+#include "SimCheck.h"
+
+// as in ThrottleData.cpp
+#define CONFIG_MAGIC             (0x43544B42)
+#define CONFIG_VERSION_PROFILES  (2)
+#define WRITE_BEHIND_DELAY       (2000)
+
+
+static HostConsole console;
+
+
+// an empty directory to hold the "flash" for one test
+static std::string
+freshRoot(const char *name)
+{
+    std::string root = std::string("build/fs-") + name;
+    std::string command = "rm -rf " + root;
+    CHECK(system(command.c_str()) == 0);
+    return root;
+}
+
+
+static void
+writeHostFile(const std::string& root, const char *path, const char *content)
+{
+    std::string hostPath = root + path;
+    FILE *file = fopen(hostPath.c_str(), "wb");
+    CHECK(file != NULL);
+    if (file) {
+        fputs(content, file);
+        fclose(file);
+    }
+}
+
+
+static void
+testDefaults()
+{
+    PosixStorage storage(freshRoot("defaults"));
+    ThrottleData data(storage);
+
+    CHECK(data.begin(&console));
+    CHECK(data.getDeviceName() == "Device Name");
+    CHECK(data.getWifiSSID() == "SSID");
+    CHECK(data.getServerPort() == "12090");
+    CHECK_EQUAL(0, data.getCurrentProfile());
+
+    // nothing to save until something changes
+    CHECK(!storage.exists("/config.a"));
+    CHECK(!storage.exists("/config.b"));
+}
+
+
+static void
+testLegacyMigration()
+{
+    std::string root = freshRoot("legacy");
+    PosixStorage storage(root);
+    CHECK(storage.begin());
+
+    writeHostFile(root, "/deviceName", "Throttle 7");
+    writeHostFile(root, "/ssid", "Basement");
+    writeHostFile(root, "/password", "hunter22");
+    writeHostFile(root, "/serverPort", "2560");
+
+    storage.resetStats();
+    {
+        ThrottleData data(storage);
+        CHECK(data.begin(&console));
+
+        CHECK(data.getDeviceName() == "Throttle 7");
+        CHECK(data.getWifiSSID() == "Basement");
+        CHECK(data.getWifiPassword() == "hunter22");
+        CHECK(data.getServerAddress() == "Server");     // no file: the default
+        CHECK(data.getServerPort() == "2560");
+    }
+
+    // both (empty) slots tried, four legacy files read, one record
+    // written, then all six legacy files removed
+    CHECK_EQUAL(2 + 4 + 1, storage.stats.opens);
+    CHECK_EQUAL(1, storage.stats.writes);
+    CHECK_EQUAL(6, storage.stats.removes);
+
+    CHECK(storage.exists("/config.a"));
+    CHECK(!storage.exists("/ssid"));
+    CHECK(!storage.exists("/deviceName"));
+
+    // and the next boot reads the record, not the legacy files
+    storage.resetStats();
+    ThrottleData data(storage);
+    CHECK(data.begin(&console));
+    CHECK(data.getWifiSSID() == "Basement");
+    CHECK_EQUAL(0, storage.stats.writes);
+    CHECK_EQUAL(0, storage.stats.removes);
+}
+
+
+static void
+testVersion2Migration()
+{
+    PosixStorage storage(freshRoot("v2"));
+    CHECK(storage.begin());
+
+    // a version 2 record: profiles, but no DHCP leases
+    RecordWriter writer;
+    writer.putString("Old Throttle");
+    writer.putString("12345678");
+    writer.putU8(1);
+    for (int index = 0; index < MAX_NETWORK_PROFILES; index++) {
+        uint8_t bssid[6] = { 0, 0, 0, 0, 0, (uint8_t) index };
+        writer.putString(index == 1 ? "Club" : "");
+        writer.putString(index == 1 ? "secret" : "");
+        writer.putString(index == 1 ? "10.0.0.2" : "");
+        writer.putString("12090");
+        writer.putBytes(bssid, sizeof(bssid));
+        writer.putU8(index == 1 ? 6 : 0);
+    }
+    CHECK(writeRecord(storage, "/config.a", CONFIG_MAGIC, CONFIG_VERSION_PROFILES, 41, writer.payload));
+
+    {
+        ThrottleData data(storage);
+        CHECK(data.begin(&console));
+
+        CHECK(data.getDeviceName() == "Old Throttle");
+        CHECK_EQUAL(1, data.getCurrentProfile());
+        CHECK(data.getWifiSSID() == "Club");
+        CHECK(data.getServerAddress() == "10.0.0.2");
+
+        NetworkProfile profile = data.getProfile(1);
+        CHECK_EQUAL(6, profile.channel);
+        CHECK_EQUAL(1, profile.bssid[5]);
+        CHECK_EQUAL(0, profile.lease.address);
+
+        // rewritten in the current format, into the other slot
+        storage.resetStats();
+        hostAdvance(WRITE_BEHIND_DELAY);
+        data.check();
+        CHECK_EQUAL(1, storage.stats.writes);
+        CHECK(storage.exists("/config.b"));
+    }
+
+    uint16_t version;
+    uint32_t sequence;
+    std::string payload;
+    CHECK(readRecord(storage, "/config.b", CONFIG_MAGIC, &version, &sequence, payload));
+    CHECK_EQUAL(3, version);
+    CHECK_EQUAL(42, sequence);
+
+    ThrottleData data(storage);
+    CHECK(data.begin(&console));
+    CHECK(data.getWifiSSID() == "Club");
+    CHECK_EQUAL(6, data.getProfile(1).channel);
+}
+
+
+static void
+testSlotsAndRecovery()
+{
+    std::string root = freshRoot("slots");
+    PosixStorage storage(root);
+
+    {
+        ThrottleData data(storage);
+        CHECK(data.begin(&console));
+
+        data.saveWifiSSID("First");
+        CHECK(data.commit());
+        CHECK(storage.exists("/config.a"));
+
+        data.saveWifiSSID("Second");
+        CHECK(data.commit());
+        CHECK(storage.exists("/config.b"));
+    }
+
+    {
+        ThrottleData data(storage);
+        CHECK(data.begin(&console));
+        CHECK(data.getWifiSSID() == "Second");
+    }
+
+    // a torn write of the newer slot leaves the older one in charge
+    std::string hostPath = root + "/config.b";
+    FILE *file = fopen(hostPath.c_str(), "r+b");
+    CHECK(file != NULL);
+    if (file) {
+        fseek(file, 20, SEEK_SET);
+        fputc('X', file);
+        fclose(file);
+    }
+
+    ThrottleData data(storage);
+    CHECK(data.begin(&console));
+    CHECK(data.getWifiSSID() == "First");
+
+    // and the next commit goes over the broken one, not the good one
+    data.saveWifiSSID("Third");
+    CHECK(data.commit());
+
+    uint16_t version;
+    uint32_t sequence;
+    std::string payload;
+    CHECK(readRecord(storage, "/config.b", CONFIG_MAGIC, &version, &sequence, payload));
+    CHECK(readRecord(storage, "/config.a", CONFIG_MAGIC, &version, &sequence, payload));
+}
+
+
+static void
+testFlashOperationCounts()
+{
+    PosixStorage storage(freshRoot("counts"));
+    ThrottleData data(storage);
+    CHECK(data.begin(&console));
+    CHECK(data.commit());
+
+    // getters never touch the filesystem
+    storage.resetStats();
+    for (int pass = 0; pass < 100; pass++) {
+        data.getDeviceName();
+        data.getWifiSSID();
+        data.getServerAddress();
+        data.getServerPort();
+        data.getProfile(2);
+    }
+    CHECK_EQUAL(0, storage.stats.opens);
+
+    // a BLE provisioning burst is written once, after it's gone quiet
+    data.saveWifiSSID("Layout");
+    hostAdvance(500);
+    data.check();
+    data.saveWifiPassword("password1");
+    hostAdvance(500);
+    data.check();
+    data.saveServerAddress("192.168.4.1");
+    data.saveServerPort("12090");          // unchanged
+    hostAdvance(WRITE_BEHIND_DELAY - 1);
+    data.check();
+    CHECK_EQUAL(0, storage.stats.writes);
+
+    hostAdvance(1);
+    data.check();
+    CHECK_EQUAL(1, storage.stats.opens);
+    CHECK_EQUAL(1, storage.stats.writes);
+
+    // saving what's already there, or committing nothing, costs nothing
+    storage.resetStats();
+    data.saveWifiSSID("Layout");
+    CHECK(data.commit());
+    hostAdvance(WRITE_BEHIND_DELAY);
+    data.check();
+    CHECK_EQUAL(0, storage.stats.opens);
+
+    // and loading tries both slots, but only one has been written yet
+    storage.resetStats();
+    ThrottleData reloaded(storage);
+    CHECK(reloaded.begin(&console));
+    CHECK(reloaded.getServerAddress() == "192.168.4.1");
+    CHECK_EQUAL(2, storage.stats.opens);
+    CHECK_EQUAL(1, storage.stats.reads);
+    CHECK_EQUAL(0, storage.stats.writes);
+}
+
+
+static void
+testEditOtherProfile()
+{
+    PosixStorage storage(freshRoot("profiles"));
+    ThrottleData data(storage);
+    CHECK(data.begin(&console));
+
+    data.saveWifiSSID("Club", 2);
+    data.saveServerAddress("club.local", 2);
+
+    CHECK_EQUAL(0, data.getCurrentProfile());
+    CHECK(data.getWifiSSID() == "SSID");
+    CHECK(data.getWifiSSID(2) == "Club");
+    CHECK(data.getServerAddress(2) == "club.local");
+
+    data.selectProfile(2);
+    CHECK(data.getServerAddress() == "club.local");
+
+    // out of range indexes fall back to the current profile
+    CHECK(data.getProfile().ssid == "Club");
+    CHECK(data.getProfile(-5).ssid == "Club");
+    CHECK(data.getProfile(MAX_NETWORK_PROFILES).ssid == "Club");
+}
+
+
+int
+main(int argc, char **argv)
+{
+    console.verbose = (argc > 1);
+
+    testDefaults();
+    testLegacyMigration();
+    testVersion2Migration();
+    testSlotsAndRecovery();
+    testFlashOperationCounts();
+    testEditOtherProfile();
+
+    return checkResult("test_throttle_data");
+}
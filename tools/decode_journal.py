@@ -0,0 +1,169 @@
+#!/usr/bin/env python3
+#
+# Copyright © 2018-2019 Blue Knobby Systems Inc.
+#
+# This work is licensed under the Creative Commons Attribution-ShareAlike
+# 4.0 International License. To view a copy of this license, visit
+# http://creativecommons.org/licenses/by-sa/4.0/ or send a letter to
+# Creative Commons, PO Box 1866, Mountain View, CA 94042, USA.
+#
+"""Decode a throttle event journal.
+
+The input is the raw journal, either read over BLE from the journal
+service or dumped straight from flash.  The journal partition's offset
+and size come from partitions.csv, so print the read command rather than
+copying them from here:
+
+    decode_journal.py --read-command
+    esptool.py read_flash <offset> <size> journal.bin
+    decode_journal.py journal.bin
+
+Layout (see EventJournal.h): a ring of 4096 byte sectors, each starting
+with an 8 byte header (magic "BKTJ", sequence number) followed by 8 byte
+events (uint32 millis, uint8 type, uint8 arg, int16 value).  Unwritten
+event slots are all 0xFF.
+"""
+
+import csv
+import os
+import struct
+import sys
+
+SECTOR_SIZE = 4096
+SECTOR_MAGIC = 0x4A544B42
+SECTOR_HEADER = struct.Struct('<II')
+EVENT = struct.Struct('<IBBh')
+
+PARTITION_TABLE = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                               os.pardir, 'partitions.csv')
+PARTITION_NAME = 'journal'
+
+# must match JournalEventType in EventJournal.h
+EVENT_TYPES = [
+    'BOOT',
+    'STATE',
+    'WIFI_CONNECTED',
+    'WIFI_DISCONNECTED',
+    'SERVER_CONNECTED',
+    'SERVER_DISCONNECTED',
+    'SPEED',
+    'DIRECTION',
+    'BUTTON',
+    'BATTERY',
+    'BUTTON_LATENCY',
+    'MOTION',
+    'FELL',
+    'IDLE',
+    'WAKE_LATENCY',
+    'CONNECTION',
+    'FIRST_SPEED',
+]
+
+# must match ThrottleState in ThrottleController.h
+THROTTLE_STATES = [
+    'UNKNOWN',
+    'WIFI_DISCONNECTED',
+    'WIFI_CONNECTED',
+    'WITHROTTLE_CONNECTED',
+    'WITHROTTLE_ACTIVE',
+]
+
+# must match ConnectionState in ThrottleController.h
+CONNECTION_STATES = [
+    'WIFI_SCAN',
+    'WIFI_JOIN',
+    'WIFI_RETRY',
+    'SERVER_CONNECT',
+    'HANDSHAKE',
+    'ACQUIRE',
+    'ACTIVE',
+    'BACKOFF',
+]
+
+
+def describe(type_name, arg, value):
+    if type_name == 'STATE' and 0 <= value < len(THROTTLE_STATES):
+        return THROTTLE_STATES[value]
+    if type_name == 'BUTTON':
+        return 'F%d %s' % (arg, 'pressed' if value else 'released')
+    if type_name == 'SPEED':
+        return 'cab %d: %d' % (arg, value)
+    if type_name == 'DIRECTION':
+        return 'cab %d: %s' % (arg, 'Forward' if value == 1 else 'Reverse')
+    if type_name == 'BATTERY':
+        return '%d mV (%d%%)' % (value, arg)
+    if type_name == 'BUTTON_LATENCY':
+        return 'F%d %.1f ms' % (arg, value / 10.0)
+    if type_name == 'WAKE_LATENCY':
+        return '%.1f ms' % (value / 10.0)
+    if type_name == 'CONNECTION' and arg < len(CONNECTION_STATES):
+        return '%s for %.2f s' % (CONNECTION_STATES[arg], value / 100.0)
+    if type_name == 'FIRST_SPEED':
+        return '%.2f s after %s' % (value / 100.0, 'reconnecting' if arg else 'power on')
+    if type_name == 'MOTION':
+        return '%d mg' % value
+    if type_name == 'BOOT':
+        return 'reset reason %d' % value
+    if type_name == 'WIFI_CONNECTED':
+        return 'RSSI %d' % value
+    return str(value)
+
+
+def journal_partition(path=PARTITION_TABLE):
+    """Return (offset, size) of the journal partition in the table."""
+    with open(path) as f:
+        rows = (line for line in f if not line.lstrip().startswith('#'))
+        for row in csv.reader(rows):
+            fields = [field.strip() for field in row]
+            if len(fields) >= 5 and fields[0] == PARTITION_NAME:
+                return int(fields[3], 0), int(fields[4], 0)
+    sys.exit('%s: no %s partition' % (path, PARTITION_NAME))
+
+
+def sectors(data):
+    found = []
+    for base in range(0, len(data) - SECTOR_SIZE + 1, SECTOR_SIZE):
+        magic, sequence = SECTOR_HEADER.unpack_from(data, base)
+        if magic == SECTOR_MAGIC:
+            found.append((sequence, base))
+    # oldest first; sequence numbers may have wrapped, so order them
+    # relative to the newest
+    if found:
+        newest = max(found)[0]
+        found.sort(key=lambda s: (s[0] - newest - 1) & 0xFFFFFFFF)
+    return found
+
+
+def events(data, base):
+    offset = base + SECTOR_HEADER.size
+    while offset + EVENT.size <= base + SECTOR_SIZE:
+        timestamp, type_code, arg, value = EVENT.unpack_from(data, offset)
+        if type_code == 0xFF:
+            return
+        yield timestamp, type_code, arg, value
+        offset += EVENT.size
+
+
+def main(paths):
+    for path in paths:
+        with open(path, 'rb') as f:
+            data = f.read()
+
+        for sequence, base in sectors(data):
+            for timestamp, type_code, arg, value in events(data, base):
+                if type_code < len(EVENT_TYPES):
+                    type_name = EVENT_TYPES[type_code]
+                else:
+                    type_name = 'TYPE_%d' % type_code
+                print('%10.3f  %-20s %s' % (timestamp / 1000.0, type_name,
+                                             describe(type_name, arg, value)))
+
+
+if __name__ == '__main__':
+    if len(sys.argv) == 2 and sys.argv[1] == '--read-command':
+        offset, size = journal_partition()
+        print('esptool.py read_flash 0x%X 0x%X journal.bin' % (offset, size))
+        sys.exit(0)
+    if len(sys.argv) < 2:
+        sys.exit('usage: %s --read-command | journal.bin...' % sys.argv[0])
+    main(sys.argv[1:])